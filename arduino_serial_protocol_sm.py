@@ -12,39 +12,94 @@ class _Side:
 
 class _ProtocolWorkflow(Workflow):
 
+    # mirrors ArduinoSerialProtocolState
     states = (
-        ('UNDEFINED',        'Undefined state, protocol handler encountered unrecoverable error'),
-        ('WAITING_SYNC',     'Waiting for SYNC request packet, initial state for secondary'),
-        ('SENDING_SYNC',     'Sending SYNC request packets, initial state for primary'),
-        ('IDLE',             'Idle state, waiting to receive packet'),
-        ('SCAN_STROBE',      'Scan strobe state, usually happen on error in header (CRC)'),
-        ('WRITE_SYNC_REPLY', 'Waiting for SYNC response packet to be send'),
-        ('READ_SYNC_REST',   'Waiting for rest of SYNC to arrive'),
-        ('READ_SYNC_R_REST', 'Waiting for rest of SYNC reply to arrive'),
-        ('READ_HEADER',      'Waiting for rest of header to arrive'),
-        ('READ_PAYLOAD',     'Waiting for payload to arrive'),
+        ('UNDEFINED',          'Undefined state, protocol handler encountered unrecoverable error'),
+        ('WAITING_SYNC',       'Waiting for SYNC request packet, initial state for secondary'),
+        ('IDLE',               'Idle state, waiting to receive packet (or scanning for strobe after an error)'),
+        ('READ_STROBE_2',      'Waiting for second strobe of packet'),
+        ('READ_SYNC_STROBE_2', 'Waiting for second strobe of SYNC request'),
+        ('READ_SYNC_STROBE_3', 'Waiting for third strobe of SYNC request'),
+        ('READ_SYNC_STROBE_4', 'Waiting for last strobe of SYNC request'),
+        ('WRITE_SYNC_REPLY',   'Waiting for SYNC response packet to be send'),
+        ('READ_HEADER',        'Waiting for rest of header to arrive'),
+        ('READ_PAYLOAD',       'Waiting for payload to arrive'),
+        ('SENDING_SYNC',       'Waiting for SYNC request packet to be send, initial state for primary'),
+        ('READ_SYNC_REPLY_1',  'Waiting for first strobe of SYNC reply, packets sent meanwhile are pipelined'),
+        ('READ_SYNC_REPLY_2',  'Waiting for second strobe of SYNC reply'),
+        ('READ_SYNC_REPLY_3',  'Waiting for third strobe of SYNC reply'),
+        ('READ_SYNC_REPLY_4',  'Waiting for last strobe of SYNC reply'),
+        ('READ_SYNC_PARAMS',   'Waiting for feature and baud rate offer of SYNC request'),
+        ('READ_SYNC_REPLY_PARAMS', 'Waiting for accepted features and baud rate of SYNC reply'),
+        ('READ_EXTENDED_HEADER', 'Waiting for rest of extended header to arrive'),
+        ('READ_SHORT_HEADER',  'Waiting for rest of short header to arrive'),
     )
 
     transitions = (
-        ('sync_strobe_read',    'WAITING_SYNC',     'READ_SYNC_REST'),
-        ('sync_rest_read',      'READ_SYNC_REST',   'WRITE_SYNC_REPLY'),
-        ('unexp_sync_rest_w',   'READ_SYNC_REST',   'WAITING_SYNC'),
-        ('unexp_sync_rest_i',   'READ_SYNC_REST',   'IDLE'),
-        ('sync_reply_sent',     'WRITE_SYNC_REPLY', 'IDLE'),
-
-        ('sync_r_strobe_read',  'SENDING_SYNC',     'READ_SYNC_R_REST'),
-        ('sync_r_rest_read',    'READ_SYNC_R_REST', 'IDLE'),
-        ('unexp_sync_r_rest',   'READ_SYNC_R_REST', 'SENDING_SYNC'),
-
-        ('strobe_read',         'IDLE',             'READ_HEADER'),
-        ('strobe_read_scan',    'SCAN_STROBE',      'READ_HEADER'),
-        ('header_read',         'READ_HEADER',      'READ_PAYLOAD'),
-        ('header_error',        'READ_HEADER',      'SCAN_STROBE'),
-        ('payload_read',        'READ_PAYLOAD',     'IDLE'),
-        ('payload_error',       'READ_PAYLOAD',     'IDLE'),
-
-        ('be_primary',          'UNDEFINED',        'SENDING_SYNC'),
-        ('be_secondary',        'UNDEFINED',        'WAITING_SYNC'),
+        ('sync_strobe_1_read',  'WAITING_SYNC',       'READ_SYNC_STROBE_2'),
+        ('resync_strobe_read',  'IDLE',               'READ_SYNC_STROBE_2'),
+        ('sync_strobe_2_read',  'READ_SYNC_STROBE_2', 'READ_SYNC_STROBE_3'),
+        ('sync_strobe_3_read',  'READ_SYNC_STROBE_3', 'READ_SYNC_STROBE_4'),
+        ('sync_strobe_4_read',  'READ_SYNC_STROBE_4', 'WRITE_SYNC_REPLY'),
+        ('unexp_sync_strobe_w', ('READ_SYNC_STROBE_2', 'READ_SYNC_STROBE_3', 'READ_SYNC_STROBE_4'),
+                                'WAITING_SYNC'),
+        ('unexp_sync_strobe_i', ('READ_SYNC_STROBE_2', 'READ_SYNC_STROBE_3', 'READ_SYNC_STROBE_4'),
+                                'IDLE'),
+        ('sync_params_strobe',  'READ_SYNC_STROBE_4', 'READ_SYNC_PARAMS'),
+        ('sync_params_read',    'READ_SYNC_PARAMS',   'WRITE_SYNC_REPLY'),
+        ('sync_params_error_w', 'READ_SYNC_PARAMS',   'WAITING_SYNC'),
+        ('sync_params_error_i', 'READ_SYNC_PARAMS',   'IDLE'),
+        ('sync_reply_sent',     'WRITE_SYNC_REPLY',   'IDLE'),
+
+        ('sync_sent',           'SENDING_SYNC',       'READ_SYNC_REPLY_1'),
+        ('sync_timeout',        ('SENDING_SYNC', 'READ_SYNC_REPLY_1', 'READ_SYNC_REPLY_2',
+                                 'READ_SYNC_REPLY_3', 'READ_SYNC_REPLY_4', 'READ_SYNC_REPLY_PARAMS'),
+                                'SENDING_SYNC'),
+        ('sync_reply_1_read',   'READ_SYNC_REPLY_1',  'READ_SYNC_REPLY_2'),
+        ('reply_strobe_read',   'IDLE',               'READ_SYNC_REPLY_2'),
+        ('unexp_sync_reply_1',  'READ_SYNC_REPLY_1',  'READ_SYNC_REPLY_1'),
+        ('sync_reply_2_read',   'READ_SYNC_REPLY_2',  'READ_SYNC_REPLY_3'),
+        ('sync_reply_3_read',   'READ_SYNC_REPLY_3',  'READ_SYNC_REPLY_4'),
+        ('sync_reply_4_read',   'READ_SYNC_REPLY_4',  'IDLE'),
+        ('unexp_sync_reply_w',  ('READ_SYNC_REPLY_2', 'READ_SYNC_REPLY_3', 'READ_SYNC_REPLY_4',
+                                 'READ_SYNC_REPLY_PARAMS'),
+                                'READ_SYNC_REPLY_1'),
+        ('unexp_sync_reply_i',  ('READ_SYNC_REPLY_2', 'READ_SYNC_REPLY_3', 'READ_SYNC_REPLY_4',
+                                 'READ_SYNC_REPLY_PARAMS'),
+                                'IDLE'),
+        ('reply_params_strobe', 'READ_SYNC_REPLY_4',  'READ_SYNC_REPLY_PARAMS'),
+        ('reply_params_read',   'READ_SYNC_REPLY_PARAMS', 'IDLE'),
+        # new baud rate is confirmed by one more sync at that rate
+        ('baud_unconfirmed',    'READ_SYNC_REPLY_PARAMS', 'SENDING_SYNC'),
+
+        ('strobe_read',         'IDLE',               'READ_STROBE_2'),
+        ('strobe_2_read',       'READ_STROBE_2',      'READ_HEADER'),
+        ('unexp_strobe_2',      'READ_STROBE_2',      'IDLE'),
+        ('whole_header_read',   'IDLE',               'READ_PAYLOAD'),
+        ('header_read',         'READ_HEADER',        'READ_PAYLOAD'),
+        ('header_error',        'READ_HEADER',        'IDLE'),
+        ('ext_strobe_2_read',   'READ_STROBE_2',      'READ_EXTENDED_HEADER'),
+        ('short_strobe_2_read', 'READ_STROBE_2',      'READ_SHORT_HEADER'),
+        ('ext_header_read',     'READ_EXTENDED_HEADER', 'READ_PAYLOAD'),
+        ('ext_header_error',    'READ_EXTENDED_HEADER', 'IDLE'),
+        ('short_header_read',   'READ_SHORT_HEADER',  'READ_PAYLOAD'),
+        ('short_header_error',  'READ_SHORT_HEADER',  'IDLE'),
+        ('payload_read',        'READ_PAYLOAD',       'IDLE'),
+        ('payload_error',       'READ_PAYLOAD',       'IDLE'),
+
+        # after repeated errors at a negotiated baud rate
+        ('baud_rollback_p',     ('IDLE', 'READ_STROBE_2', 'READ_HEADER', 'READ_EXTENDED_HEADER',
+                                 'READ_SHORT_HEADER', 'READ_PAYLOAD', 'READ_SYNC_REPLY_1',
+                                 'READ_SYNC_REPLY_2', 'READ_SYNC_REPLY_3', 'READ_SYNC_REPLY_4',
+                                 'READ_SYNC_REPLY_PARAMS'),
+                                'SENDING_SYNC'),
+        ('baud_rollback_s',     ('IDLE', 'READ_STROBE_2', 'READ_HEADER', 'READ_EXTENDED_HEADER',
+                                 'READ_SHORT_HEADER', 'READ_PAYLOAD', 'READ_SYNC_STROBE_2',
+                                 'READ_SYNC_STROBE_3', 'READ_SYNC_STROBE_4', 'READ_SYNC_PARAMS'),
+                                'WAITING_SYNC'),
+
+        ('be_primary',          'UNDEFINED',          'SENDING_SYNC'),
+        ('be_secondary',        'UNDEFINED',          'WAITING_SYNC'),
     )
 
     initial_state = 'UNDEFINED'
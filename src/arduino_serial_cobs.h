@@ -0,0 +1,219 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+
+// Consistent Overhead Byte Stuffing: frame bytes are split at every zero
+// into blocks of [length + 1][non-zero bytes], blocks of 254 non-zero
+// bytes get code 0xFF and no zero after them. Encoded frame contains no
+// 0x00, so 0x00 ends it and receiver finds the next frame with memchr.
+
+// Encoded size of size frame bytes, 0x00 delimiter included. Encoder pads
+// the frame with zero bytes up to it, so the size does not depend on data.
+constexpr size_t arduino_serial_cobs_size(size_t size)
+{
+    return size + 2 + size / 254;
+}
+
+// Frame placed this far into the output buffer can be encoded in place
+constexpr size_t arduino_serial_cobs_offset(size_t size)
+{
+    return 1 + size / 254;
+}
+
+// Writes arduino_serial_cobs_size(size) bytes. Input may be separate or
+// start at output + arduino_serial_cobs_offset(size).
+inline void arduino_serial_cobs_encode(uint8_t* output, const uint8_t* input, size_t size)
+{
+    size_t code_index = 0;
+    size_t out = 1;
+    uint8_t code = 1;
+    size_t padding = size / 254;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        const uint8_t value = input[i];
+        if (value != 0)
+        {
+            output[out++] = value;
+            ++code;
+            if (code != 0xFF)
+                continue;
+            if (padding > 0)
+                --padding;
+        }
+        output[code_index] = code;
+        code_index = out++;
+        code = 1;
+    }
+
+    // every zero appended adds exactly one byte
+    for (; padding > 0; --padding)
+    {
+        output[code_index] = code;
+        code_index = out++;
+        code = 1;
+    }
+    output[code_index] = code;
+    output[out] = 0;
+}
+
+
+enum class ArduinoSerialCobsResult
+{
+    // everything used, frame continues in the next data
+    PARTIAL,
+    // frame complete up to its 0x00
+    FRAME,
+    // 0x00 without anything before it
+    EMPTY,
+    // frame ended inside a block or did not fit, it is dropped
+    ERROR
+};
+
+
+// Streaming decoder, one frame of up to Capacity decoded bytes at a time.
+// Decoded frame stays available until the next push(); current(),
+// remaining() and consume() walk through it.
+template<size_t Capacity>
+class ArduinoSerialCobsDecoder
+{
+public:
+    ArduinoSerialCobsDecoder()
+    : frame_size{0}
+    , position{0}
+    , block_left{0}
+    , block_zero{false}
+    , started{false}
+    , overflow{false}
+    , complete{false}
+    {}
+
+    // Decodes data up to and including the first 0x00, used tells how
+    // many bytes were taken
+    ArduinoSerialCobsResult push(const uint8_t* data, size_t size, size_t& used)
+    {
+        if (complete)
+            reset();
+
+        const uint8_t* delimiter = static_cast<const uint8_t*>(memchr(data, 0, size));
+        const size_t length = delimiter != nullptr ? delimiter - data : size;
+        decode(data, length);
+
+        if (delimiter == nullptr)
+        {
+            used = size;
+            return ArduinoSerialCobsResult::PARTIAL;
+        }
+
+        used = length + 1;
+        complete = true;
+        if (!started)
+            return ArduinoSerialCobsResult::EMPTY;
+        if (overflow || block_left != 0)
+        {
+            frame_size = 0;
+            return ArduinoSerialCobsResult::ERROR;
+        }
+        return ArduinoSerialCobsResult::FRAME;
+    }
+
+    void reset()
+    {
+        frame_size = 0;
+        position = 0;
+        block_left = 0;
+        block_zero = false;
+        started = false;
+        overflow = false;
+        complete = false;
+    }
+
+    const uint8_t* current() const
+    { return frame + position; }
+
+    size_t remaining() const
+    { return frame_size - position; }
+
+    void consume(size_t size)
+    { position += size; }
+
+private:
+    void decode(const uint8_t* data, size_t size)
+    {
+        size_t i = 0;
+        while (i < size)
+        {
+            if (block_left == 0)
+            {
+                // code byte, zero between blocks goes first
+                if (block_zero)
+                    append(nullptr, 1);
+                const uint8_t code = data[i++];
+                block_left = static_cast<uint8_t>(code - 1);
+                block_zero = code != 0xFF;
+                started = true;
+                continue;
+            }
+
+            size_t count = size - i;
+            if (count > block_left)
+                count = block_left;
+            append(data + i, count);
+            i += count;
+            block_left = static_cast<uint8_t>(block_left - count);
+        }
+    }
+
+    // nullptr appends zeros
+    void append(const uint8_t* data, size_t size)
+    {
+        if (overflow || Capacity - frame_size < size)
+        {
+            overflow = true;
+            return;
+        }
+        if (data != nullptr)
+            memcpy(frame + frame_size, data, size);
+        else
+            memset(frame + frame_size, 0, size);
+        frame_size += size;
+    }
+
+    size_t frame_size;
+    size_t position;
+    uint8_t block_left;
+    bool block_zero;
+    bool started;
+    bool overflow;
+    bool complete;
+    uint8_t frame[Capacity];
+
+}; // class ArduinoSerialCobsDecoder
+
+// No COBS framing, takes no space
+template<>
+class ArduinoSerialCobsDecoder<0>
+{
+public:
+    ArduinoSerialCobsResult push(const uint8_t*, size_t size, size_t& used)
+    {
+        used = size;
+        return ArduinoSerialCobsResult::PARTIAL;
+    }
+
+    void reset()
+    {}
+
+    const uint8_t* current() const
+    { return nullptr; }
+
+    size_t remaining() const
+    { return 0; }
+
+    void consume(size_t)
+    {}
+
+}; // class ArduinoSerialCobsDecoder<0>
@@ -0,0 +1,136 @@
+#include "gtest/gtest.h"
+
+#include "arduino_serial_cobs.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <vector>
+
+
+namespace
+{
+
+std::vector<uint8_t> encode(const std::vector<uint8_t>& frame)
+{
+    std::vector<uint8_t> encoded(arduino_serial_cobs_size(frame.size()));
+    arduino_serial_cobs_encode(encoded.data(), frame.data(), frame.size());
+    return encoded;
+}
+
+std::vector<uint8_t> make_random_data(size_t size, unsigned int seed)
+{
+    std::vector<uint8_t> data(size);
+    srand(seed);
+    for (auto& value : data)
+        value = static_cast<uint8_t>(rand() % 4 == 0 ? 0 : rand());
+    return data;
+}
+
+}
+
+
+TEST(ArduinoSerialCobs, Encode)
+{
+    EXPECT_EQ(std::vector<uint8_t>({0x01, 0x00}), encode({}));
+    EXPECT_EQ(std::vector<uint8_t>({0x01, 0x01, 0x00}), encode({0x00}));
+    EXPECT_EQ(std::vector<uint8_t>({0x03, 0x11, 0x22, 0x02, 0x33, 0x00}),
+              encode({0x11, 0x22, 0x00, 0x33}));
+
+    // 254 non-zero bytes take a 0xFF block, size stays the same with zeros
+    std::vector<uint8_t> full(300, 0x5A);
+    auto encoded = encode(full);
+    ASSERT_EQ(303u, encoded.size());
+    EXPECT_EQ(0xFF, encoded[0]);
+    EXPECT_EQ(47, encoded[255]);
+    EXPECT_EQ(0, encoded.back());
+
+    full[100] = 0;
+    encoded = encode(full);
+    ASSERT_EQ(303u, encoded.size());
+    EXPECT_EQ(101, encoded[0]);
+    for (size_t i = 0; i + 1 < encoded.size(); ++i)
+        ASSERT_NE(0, encoded[i]);
+}
+
+TEST(ArduinoSerialCobs, EncodeInPlace)
+{
+    const auto frame = make_random_data(700, 3);
+    std::vector<uint8_t> buffer(arduino_serial_cobs_size(frame.size()));
+    std::copy(frame.begin(), frame.end(),
+              buffer.begin() + arduino_serial_cobs_offset(frame.size()));
+    arduino_serial_cobs_encode(buffer.data(),
+                               buffer.data() + arduino_serial_cobs_offset(frame.size()),
+                               frame.size());
+    EXPECT_EQ(encode(frame), buffer);
+}
+
+TEST(ArduinoSerialCobs, RoundTrip)
+{
+    ArduinoSerialCobsDecoder<1024> decoder;
+    for (size_t size : {0u, 1u, 253u, 254u, 255u, 508u, 1000u})
+    {
+        auto frame = make_random_data(size, static_cast<unsigned int>(size));
+        if (size == 508)
+            frame.assign(size, 0x42);
+        const auto encoded = encode(frame);
+
+        size_t used = 0;
+        const auto result = decoder.push(encoded.data(), encoded.size(), used);
+        EXPECT_EQ(encoded.size(), used);
+        ASSERT_EQ(ArduinoSerialCobsResult::FRAME, result) << size;
+
+        // frame followed by zero padding
+        ASSERT_LE(size, decoder.remaining());
+        EXPECT_TRUE(std::equal(frame.begin(), frame.end(), decoder.current())) << size;
+        for (size_t i = size; i < decoder.remaining(); ++i)
+            EXPECT_EQ(0, decoder.current()[i]);
+    }
+}
+
+TEST(ArduinoSerialCobs, DecodeSplit)
+{
+    const auto frame = make_random_data(300, 7);
+    auto stream = encode(frame);
+    const auto second = encode({0x01, 0x02});
+    stream.insert(stream.end(), second.begin(), second.end());
+
+    ArduinoSerialCobsDecoder<512> decoder;
+    std::vector<std::vector<uint8_t>> frames;
+    size_t offset = 0;
+    while (offset < stream.size())
+    {
+        const size_t chunk = std::min<size_t>(7, stream.size() - offset);
+        size_t used = 0;
+        if (decoder.push(stream.data() + offset, chunk, used) == ArduinoSerialCobsResult::FRAME)
+            frames.emplace_back(decoder.current(), decoder.current() + decoder.remaining());
+        offset += used;
+    }
+
+    ASSERT_EQ(2u, frames.size());
+    EXPECT_TRUE(std::equal(frame.begin(), frame.end(), frames[0].begin()));
+    EXPECT_EQ(std::vector<uint8_t>({0x01, 0x02}), frames[1]);
+}
+
+TEST(ArduinoSerialCobs, DecodeErrors)
+{
+    ArduinoSerialCobsDecoder<8> decoder;
+    size_t used = 0;
+
+    const uint8_t empty[] = {0x00, 0x00};
+    EXPECT_EQ(ArduinoSerialCobsResult::EMPTY, decoder.push(empty, sizeof(empty), used));
+    EXPECT_EQ(1u, used);
+
+    // block promises more bytes than came before 0x00
+    const uint8_t cut[] = {0x05, 0x11, 0x22, 0x00, 0x02, 0x33, 0x00};
+    EXPECT_EQ(ArduinoSerialCobsResult::ERROR, decoder.push(cut, sizeof(cut), used));
+    EXPECT_EQ(4u, used);
+    EXPECT_EQ(ArduinoSerialCobsResult::FRAME, decoder.push(cut + 4, sizeof(cut) - 4, used));
+    EXPECT_EQ(std::vector<uint8_t>({0x33}),
+              std::vector<uint8_t>(decoder.current(), decoder.current() + decoder.remaining()));
+
+    // too big, dropped as a whole
+    const auto big = encode(std::vector<uint8_t>(9, 0x44));
+    EXPECT_EQ(ArduinoSerialCobsResult::PARTIAL, decoder.push(big.data(), 4, used));
+    EXPECT_EQ(ArduinoSerialCobsResult::ERROR, decoder.push(big.data() + 4, big.size() - 4, used));
+    EXPECT_EQ(0u, decoder.remaining());
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+// Settings that change the layout of protocol objects, as a CMake host build
+// of the library generated them. Without that header the defaults of
+// arduino_serial_latency.h and arduino_serial_stats.h apply.
+#if !defined(ARDUINO) && defined(__has_include)
+    #if __has_include("arduino_serial_build_config.h")
+        #include "arduino_serial_build_config.h"
+    #endif
+#endif
@@ -0,0 +1,390 @@
+#include "arduino_serial_crc.h"
+
+#include <string.h>
+
+
+// Table generators; AVR uses only the per-bit CRC-32 shift
+namespace
+{
+
+template<size_t... I>
+struct index_list
+{};
+
+template<size_t N, size_t... I>
+struct make_index_list : make_index_list<N - 1, N - 1, I...>
+{};
+
+template<size_t... I>
+struct make_index_list<0, I...>
+{
+    using type = index_list<I...>;
+};
+
+constexpr uint8_t crc8_shift(uint8_t crc, size_t bits)
+{
+    return bits == 0
+           ? crc
+           : crc8_shift((crc & 0x80) != 0
+                        ? static_cast<uint8_t>((crc << 1) ^ 0x07)
+                        : static_cast<uint8_t>(crc << 1),
+                        bits - 1);
+}
+
+constexpr uint16_t crc16_shift(uint16_t crc, size_t bits)
+{
+    return bits == 0
+           ? crc
+           : crc16_shift((crc & 0x8000) != 0
+                         ? static_cast<uint16_t>((crc << 1) ^ 0x1021)
+                         : static_cast<uint16_t>(crc << 1),
+                         bits - 1);
+}
+
+constexpr uint32_t crc32_shift(uint32_t crc, size_t bits)
+{
+    return bits == 0
+           ? crc
+           : crc32_shift((crc & 1) != 0 ? (crc >> 1) ^ 0xEDB88320u : crc >> 1,
+                         bits - 1);
+}
+
+constexpr uint16_t crc16_byte(size_t value)
+{
+    return crc16_shift(static_cast<uint16_t>(value << 8), 8);
+}
+
+// CRC of value followed by `zeros` zero bytes
+constexpr uint16_t crc16_zeros(uint16_t crc, size_t zeros)
+{
+    return zeros == 0
+           ? crc
+           : crc16_zeros(static_cast<uint16_t>((crc << 8) ^ crc16_byte(crc >> 8)),
+                         zeros - 1);
+}
+
+struct Crc8Table
+{
+    uint8_t value[256];
+};
+
+template<size_t... I>
+constexpr Crc8Table make_crc8_table(index_list<I...>)
+{
+    return Crc8Table{{crc8_shift(static_cast<uint8_t>(I), 8)...}};
+}
+
+static_assert(crc8_shift(1, 8) == 0x07 && crc16_byte(1) == 0x1021
+              && crc32_shift(1, 8) == 0x77073096u,
+              "CRC table generator broken");
+
+}
+
+
+#ifndef ARDUINO
+
+namespace
+{
+
+struct Crc16Tables
+{
+    uint16_t value[8][256];
+};
+
+struct Crc32Table
+{
+    uint32_t value[256];
+};
+
+template<size_t... I>
+constexpr Crc32Table make_crc32_table(index_list<I...>)
+{
+    return Crc32Table{{crc32_shift(static_cast<uint32_t>(I), 8)...}};
+}
+
+template<size_t... I>
+constexpr Crc16Tables make_crc16_tables(index_list<I...>)
+{
+    return Crc16Tables{{
+            {crc16_zeros(crc16_byte(I), 0)...},
+            {crc16_zeros(crc16_byte(I), 1)...},
+            {crc16_zeros(crc16_byte(I), 2)...},
+            {crc16_zeros(crc16_byte(I), 3)...},
+            {crc16_zeros(crc16_byte(I), 4)...},
+            {crc16_zeros(crc16_byte(I), 5)...},
+            {crc16_zeros(crc16_byte(I), 6)...},
+            {crc16_zeros(crc16_byte(I), 7)...}}};
+}
+
+constexpr const Crc8Table crc8_table =
+        make_crc8_table(make_index_list<256>::type{});
+
+constexpr const Crc16Tables crc16_tables =
+        make_crc16_tables(make_index_list<256>::type{});
+
+constexpr const Crc32Table crc32_table =
+        make_crc32_table(make_index_list<256>::type{});
+
+uint16_t crc16_table_update(uint16_t crc, uint8_t data)
+{
+    return static_cast<uint16_t>(
+            (crc << 8) ^ crc16_tables.value[0][(crc >> 8) ^ data]);
+}
+
+}
+
+/* CRC-8-CCITT
+ * crc8 calculation ported from AVR_LIBC
+ * https://www.nongnu.org/avr-libc/user-manual/group__util__crc.html
+ * Copyright Jack Crenshaw
+ * Copyright (c) 2002, 2003, 2004  Marek Michalkiewicz
+ * Copyright (c) 2005, 2007 Joerg Wunsch
+ * Copyright (c) 2013 Dave Hylands
+ * Copyright (c) 2013 Frederic Nadeau
+ */
+uint8_t
+_crc8_ccitt_update(uint8_t inCrc, uint8_t inData)
+{
+    uint8_t   i;
+    uint8_t   data;
+
+    data = inCrc ^ inData;
+
+    for ( i = 0; i < 8; i++ )
+    {
+        if (( data & 0x80 ) != 0 )
+        {
+            data <<= 1;
+            data ^= 0x07;
+        }
+        else
+        {
+            data <<= 1;
+        }
+    }
+    return data;
+}
+
+/* CRC-CCITT/FALSE
+ * crc16 calculation ported from AVR_LIBC
+ * https://www.nongnu.org/avr-libc/user-manual/group__util__crc.html
+ * Copyright Jack Crenshaw
+ * Copyright (c) 2002, 2003, 2004  Marek Michalkiewicz
+ * Copyright (c) 2005, 2007 Joerg Wunsch
+ * Copyright (c) 2013 Dave Hylands
+ * Copyright (c) 2013 Frederic Nadeau
+ */
+uint16_t
+_crc_ccitt_update(uint16_t crc, uint8_t data)
+{
+    crc = crc ^ (int) data << 8;
+    size_t i = 8;
+    do
+    {
+        if (crc & 0x8000)
+            crc = crc << 1 ^ 0x1021;
+        else
+            crc = crc << 1;
+    } while(--i);
+
+    return crc;
+}
+
+uint8_t arduino_serial_crc8_bitwise(uint8_t crc, const void* _data, size_t size)
+{
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    for (size_t i = 0; i < size; ++i)
+        crc = _crc8_ccitt_update(crc, data[i]);
+    return crc;
+}
+
+uint8_t arduino_serial_crc8_table(uint8_t crc, const void* _data, size_t size)
+{
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    for (size_t i = 0; i < size; ++i)
+        crc = crc8_table.value[crc ^ data[i]];
+    return crc;
+}
+
+uint16_t arduino_serial_crc16_bitwise(uint16_t crc, const void* _data, size_t size)
+{
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    for (size_t i = 0; i < size; ++i)
+        crc = _crc_ccitt_update(crc, data[i]);
+    return crc;
+}
+
+uint16_t arduino_serial_crc16_table(uint16_t crc, const void* _data, size_t size)
+{
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    for (size_t i = 0; i < size; ++i)
+        crc = crc16_table_update(crc, data[i]);
+    return crc;
+}
+
+uint16_t arduino_serial_crc16_slice4(uint16_t crc, const void* _data, size_t size)
+{
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    const uint16_t (&t)[8][256] = crc16_tables.value;
+
+    for (; size >= 4; size -= 4, data += 4)
+    {
+        crc = t[3][data[0] ^ (crc >> 8)]
+              ^ t[2][data[1] ^ (crc & 0xFF)]
+              ^ t[1][data[2]]
+              ^ t[0][data[3]];
+    }
+    for (; size > 0; --size, ++data)
+        crc = crc16_table_update(crc, *data);
+    return crc;
+}
+
+uint16_t arduino_serial_crc16_slice8(uint16_t crc, const void* _data, size_t size)
+{
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    const uint16_t (&t)[8][256] = crc16_tables.value;
+
+    for (; size >= 8; size -= 8, data += 8)
+    {
+        crc = t[7][data[0] ^ (crc >> 8)]
+              ^ t[6][data[1] ^ (crc & 0xFF)]
+              ^ t[5][data[2]]
+              ^ t[4][data[3]]
+              ^ t[3][data[4]]
+              ^ t[2][data[5]]
+              ^ t[1][data[6]]
+              ^ t[0][data[7]];
+    }
+    return arduino_serial_crc16_slice4(crc, data, size);
+}
+
+uint16_t arduino_serial_crc16_slice8_copy(uint16_t crc, void* _dst,
+                                          const void* _src, size_t size)
+{
+    uint8_t* dst = static_cast<uint8_t*>(_dst);
+    const uint8_t* src = static_cast<const uint8_t*>(_src);
+    const uint16_t (&t)[8][256] = crc16_tables.value;
+
+    for (; size >= 8; size -= 8, src += 8, dst += 8)
+    {
+        uint8_t block[8];
+        memcpy(block, src, 8);
+        const uint16_t value = t[7][block[0] ^ (crc >> 8)]
+                               ^ t[6][block[1] ^ (crc & 0xFF)]
+                               ^ t[5][block[2]]
+                               ^ t[4][block[3]]
+                               ^ t[3][block[4]]
+                               ^ t[2][block[5]]
+                               ^ t[1][block[6]]
+                               ^ t[0][block[7]];
+        memcpy(dst, block, 8);
+        crc = value;
+    }
+    for (; size > 0; --size, ++src, ++dst)
+    {
+        *dst = *src;
+        crc = crc16_table_update(crc, *src);
+    }
+    return crc;
+}
+
+uint32_t arduino_serial_crc32_bitwise(uint32_t crc, const void* _data, size_t size)
+{
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    for (size_t i = 0; i < size; ++i)
+        crc = crc32_shift(crc ^ data[i], 8);
+    return crc;
+}
+
+uint32_t arduino_serial_crc32_table(uint32_t crc, const void* _data, size_t size)
+{
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    for (size_t i = 0; i < size; ++i)
+        crc = (crc >> 8) ^ crc32_table.value[(crc ^ data[i]) & 0xFF];
+    return crc;
+}
+
+uint8_t arduino_serial_crc8(uint8_t crc, const void* data, size_t size)
+{
+#if ARDUINO_SERIAL_CRC == ARDUINO_SERIAL_CRC_BITWISE
+    return arduino_serial_crc8_bitwise(crc, data, size);
+#else
+    return arduino_serial_crc8_table(crc, data, size);
+#endif
+}
+
+uint16_t arduino_serial_crc16(uint16_t crc, const void* data, size_t size)
+{
+#if ARDUINO_SERIAL_CRC == ARDUINO_SERIAL_CRC_BITWISE
+    return arduino_serial_crc16_bitwise(crc, data, size);
+#elif ARDUINO_SERIAL_CRC == ARDUINO_SERIAL_CRC_TABLE
+    return arduino_serial_crc16_table(crc, data, size);
+#elif ARDUINO_SERIAL_CRC == ARDUINO_SERIAL_CRC_SLICE_BY_4
+    return arduino_serial_crc16_slice4(crc, data, size);
+#else
+    return arduino_serial_crc16_slice8(crc, data, size);
+#endif
+}
+
+uint16_t arduino_serial_crc16_copy(uint16_t crc, void* dst,
+                                   const void* src, size_t size)
+{
+#if ARDUINO_SERIAL_CRC == ARDUINO_SERIAL_CRC_SLICE_BY_8
+    return arduino_serial_crc16_slice8_copy(crc, dst, src, size);
+#else
+    memcpy(dst, src, size);
+    return arduino_serial_crc16(crc, src, size);
+#endif
+}
+
+uint32_t arduino_serial_crc32(uint32_t crc, const void* data, size_t size)
+{
+#if ARDUINO_SERIAL_CRC == ARDUINO_SERIAL_CRC_BITWISE
+    return arduino_serial_crc32_bitwise(crc, data, size);
+#else
+    return arduino_serial_crc32_table(crc, data, size);
+#endif
+}
+
+#else
+    #include <util/crc16.h>
+
+uint8_t arduino_serial_crc8(uint8_t crc, const void* _data, size_t size)
+{
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    for (size_t i = 0; i < size; ++i)
+        crc = _crc8_ccitt_update(crc, data[i]);
+    return crc;
+}
+
+uint16_t arduino_serial_crc16(uint16_t crc, const void* _data, size_t size)
+{
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    for (size_t i = 0; i < size; ++i)
+        crc = _crc_ccitt_update(crc, data[i]);
+    return crc;
+}
+
+uint16_t arduino_serial_crc16_copy(uint16_t crc, void* _dst,
+                                   const void* _src, size_t size)
+{
+    uint8_t* dst = static_cast<uint8_t*>(_dst);
+    const uint8_t* src = static_cast<const uint8_t*>(_src);
+    for (size_t i = 0; i < size; ++i)
+    {
+        dst[i] = src[i];
+        crc = _crc_ccitt_update(crc, src[i]);
+    }
+    return crc;
+}
+
+// Extended frames are off on AVR by default, no table for it
+uint32_t arduino_serial_crc32(uint32_t crc, const void* _data, size_t size)
+{
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    for (size_t i = 0; i < size; ++i)
+        crc = crc32_shift(crc ^ data[i], 8);
+    return crc;
+}
+
+#endif
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define ARDUINO_SERIAL_CRC_BITWISE 1
+#define ARDUINO_SERIAL_CRC_TABLE 2
+#define ARDUINO_SERIAL_CRC_SLICE_BY_4 3
+#define ARDUINO_SERIAL_CRC_SLICE_BY_8 4
+
+// CRC engine used by the protocol, chosen at compile time.
+// AVR build always uses per-bit avr-libc routines.
+#ifndef ARDUINO_SERIAL_CRC
+    #ifdef ARDUINO
+        #define ARDUINO_SERIAL_CRC ARDUINO_SERIAL_CRC_BITWISE
+    #else
+        #define ARDUINO_SERIAL_CRC ARDUINO_SERIAL_CRC_SLICE_BY_8
+    #endif
+#endif
+
+// an undefined engine name evaluates to 0 here
+#if ARDUINO_SERIAL_CRC != ARDUINO_SERIAL_CRC_BITWISE \
+    && ARDUINO_SERIAL_CRC != ARDUINO_SERIAL_CRC_TABLE \
+    && ARDUINO_SERIAL_CRC != ARDUINO_SERIAL_CRC_SLICE_BY_4 \
+    && ARDUINO_SERIAL_CRC != ARDUINO_SERIAL_CRC_SLICE_BY_8
+    #error "Unknown ARDUINO_SERIAL_CRC engine"
+#endif
+
+
+// CRC-8-CCITT (poly 0x07) over a buffer, continuing from crc
+uint8_t arduino_serial_crc8(uint8_t crc, const void* data, size_t size);
+
+// CRC-CCITT/FALSE (poly 0x1021) over a buffer, continuing from crc
+uint16_t arduino_serial_crc16(uint16_t crc, const void* data, size_t size);
+
+// Same as arduino_serial_crc16 over src, copying src to dst in the same pass
+uint16_t arduino_serial_crc16_copy(uint16_t crc, void* dst,
+                                   const void* src, size_t size);
+
+// CRC-32 (IEEE 802.3, reflected poly 0xEDB88320) over a buffer, continuing
+// from crc; no final inversion, so the usual check value is ~result
+// of a 0xFFFFFFFF seed
+uint32_t arduino_serial_crc32(uint32_t crc, const void* data, size_t size);
+
+
+#ifndef ARDUINO
+    uint8_t _crc8_ccitt_update(uint8_t inCrc, uint8_t inData);
+    uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data);
+
+    // All host kernels are always built, so they can be checked
+    // against each other regardless of ARDUINO_SERIAL_CRC.
+    uint8_t arduino_serial_crc8_bitwise(uint8_t crc, const void* data, size_t size);
+    uint8_t arduino_serial_crc8_table(uint8_t crc, const void* data, size_t size);
+
+    uint16_t arduino_serial_crc16_bitwise(uint16_t crc, const void* data, size_t size);
+    uint16_t arduino_serial_crc16_table(uint16_t crc, const void* data, size_t size);
+    uint16_t arduino_serial_crc16_slice4(uint16_t crc, const void* data, size_t size);
+    uint16_t arduino_serial_crc16_slice8(uint16_t crc, const void* data, size_t size);
+    uint16_t arduino_serial_crc16_slice8_copy(uint16_t crc, void* dst,
+                                              const void* src, size_t size);
+
+    uint32_t arduino_serial_crc32_bitwise(uint32_t crc, const void* data, size_t size);
+    uint32_t arduino_serial_crc32_table(uint32_t crc, const void* data, size_t size);
+#endif
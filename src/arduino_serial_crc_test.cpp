@@ -0,0 +1,122 @@
+#include "gtest/gtest.h"
+
+#include "arduino_serial_crc.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <vector>
+
+
+namespace
+{
+
+const char CHECK_STRING[] = "123456789";
+
+std::vector<uint8_t> make_random_data(size_t size, unsigned int seed)
+{
+    std::vector<uint8_t> data(size);
+    srand(seed);
+    for (auto& value : data)
+        value = static_cast<uint8_t>(rand());
+    return data;
+}
+
+}
+
+
+TEST(ArduinoSerialCrc, CheckValues)
+{
+    EXPECT_EQ(0xF4, arduino_serial_crc8(0, CHECK_STRING, 9));
+    EXPECT_EQ(0x29B1, arduino_serial_crc16(0xFFFF, CHECK_STRING, 9));
+
+    EXPECT_EQ(0xF4, arduino_serial_crc8_bitwise(0, CHECK_STRING, 9));
+    EXPECT_EQ(0x29B1, arduino_serial_crc16_bitwise(0xFFFF, CHECK_STRING, 9));
+
+    EXPECT_EQ(0xCBF43926u, ~arduino_serial_crc32(0xFFFFFFFFu, CHECK_STRING, 9));
+    EXPECT_EQ(0xCBF43926u, ~arduino_serial_crc32_bitwise(0xFFFFFFFFu, CHECK_STRING, 9));
+}
+
+TEST(ArduinoSerialCrc, Crc32MatchesBitwise)
+{
+    const auto data = make_random_data(300, 4);
+    for (size_t offset = 0; offset < 8; ++offset)
+    {
+        for (size_t size = 0; size + offset <= data.size(); size += 7)
+        {
+            const uint32_t expected = arduino_serial_crc32_bitwise(
+                    0xFFFFFFFFu, data.data() + offset, size);
+            ASSERT_EQ(expected, arduino_serial_crc32_table(
+                    0xFFFFFFFFu, data.data() + offset, size));
+        }
+    }
+}
+
+TEST(ArduinoSerialCrc, Crc8MatchesBitwise)
+{
+    const auto data = make_random_data(300, 1);
+    for (size_t offset = 0; offset < 8; ++offset)
+    {
+        for (size_t size = 0; size + offset <= data.size(); size += 7)
+        {
+            for (uint8_t crc : {0x00, 0x5A, 0xFF})
+            {
+                const uint8_t expected = arduino_serial_crc8_bitwise(
+                        crc, data.data() + offset, size);
+                ASSERT_EQ(expected, arduino_serial_crc8_table(
+                        crc, data.data() + offset, size));
+                ASSERT_EQ(expected, arduino_serial_crc8(
+                        crc, data.data() + offset, size));
+            }
+        }
+    }
+}
+
+TEST(ArduinoSerialCrc, Crc16MatchesBitwise)
+{
+    const auto data = make_random_data(300, 2);
+    for (size_t offset = 0; offset < 8; ++offset)
+    {
+        for (size_t size = 0; size + offset <= data.size(); ++size)
+        {
+            for (uint16_t crc : {0x0000, 0x1D0F, 0xFFFF})
+            {
+                const uint16_t expected = arduino_serial_crc16_bitwise(
+                        crc, data.data() + offset, size);
+                ASSERT_EQ(expected, arduino_serial_crc16_table(
+                        crc, data.data() + offset, size));
+                ASSERT_EQ(expected, arduino_serial_crc16_slice4(
+                        crc, data.data() + offset, size));
+                ASSERT_EQ(expected, arduino_serial_crc16_slice8(
+                        crc, data.data() + offset, size));
+                ASSERT_EQ(expected, arduino_serial_crc16(
+                        crc, data.data() + offset, size));
+            }
+        }
+    }
+}
+
+TEST(ArduinoSerialCrc, Crc16CopyMatches)
+{
+    const auto data = make_random_data(300, 3);
+    for (size_t offset = 0; offset < 8; ++offset)
+    {
+        for (size_t size = 0; size + offset <= data.size(); ++size)
+        {
+            const uint16_t expected = arduino_serial_crc16_bitwise(
+                    0xFFFF, data.data() + offset, size);
+
+            std::vector<uint8_t> copy(size + 1, 0xEE);
+            ASSERT_EQ(expected, arduino_serial_crc16_slice8_copy(
+                    0xFFFF, copy.data(), data.data() + offset, size));
+            ASSERT_TRUE(std::equal(copy.begin(), copy.begin() + size,
+                                   data.begin() + offset));
+            ASSERT_EQ(0xEE, copy[size]);
+
+            std::vector<uint8_t> copy2(size);
+            ASSERT_EQ(expected, arduino_serial_crc16_copy(
+                    0xFFFF, copy2.data(), data.data() + offset, size));
+            ASSERT_TRUE(std::equal(copy2.begin(), copy2.end(),
+                                   data.begin() + offset));
+        }
+    }
+}
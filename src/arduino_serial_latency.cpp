@@ -0,0 +1,107 @@
+#include "arduino_serial_latency.h"
+
+#ifndef ARDUINO
+
+#include <time.h>
+
+
+constexpr const unsigned int ArduinoSerialLatencyHistogram::SUB_BUCKET_BITS;
+constexpr const size_t ArduinoSerialLatencyHistogram::SUB_BUCKETS;
+constexpr const size_t ArduinoSerialLatencyHistogram::BUCKET_COUNT;
+
+
+namespace
+{
+
+uint64_t monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000u + now.tv_nsec;
+}
+
+double calibrate_ticks_per_ns()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    const uint64_t start_ns = monotonic_ns();
+    const uint64_t start_ticks = arduino_serial_now_ticks();
+    uint64_t end_ns = start_ns;
+    while (end_ns - start_ns < 5000000)
+        end_ns = monotonic_ns();
+    const uint64_t end_ticks = arduino_serial_now_ticks();
+    return static_cast<double>(end_ticks - start_ticks) / (end_ns - start_ns);
+#else
+    return 1.0;
+#endif
+}
+
+}
+
+
+double arduino_serial_ticks_per_ns()
+{
+    static const double ticks_per_ns = calibrate_ticks_per_ns();
+    return ticks_per_ns;
+}
+
+ArduinoSerialLatencyHistogram::ArduinoSerialLatencyHistogram()
+{
+    for (size_t i = 0; i < BUCKET_COUNT; ++i)
+        buckets[i].store(0, std::memory_order_relaxed);
+    max_ticks.store(0, std::memory_order_relaxed);
+}
+
+ArduinoSerialLatencyHistogram::ArduinoSerialLatencyHistogram(
+        ArduinoSerialLatencyHistogram&& other)
+{
+    for (size_t i = 0; i < BUCKET_COUNT; ++i)
+        buckets[i].store(other.buckets[i].load(std::memory_order_relaxed),
+                         std::memory_order_relaxed);
+    max_ticks.store(other.maxTicks(), std::memory_order_relaxed);
+}
+
+uint64_t ArduinoSerialLatencyHistogram::count() const
+{
+    uint64_t result = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i)
+        result += buckets[i].load(std::memory_order_relaxed);
+    return result;
+}
+
+uint64_t ArduinoSerialLatencyHistogram::percentileTicks(double percentile) const
+{
+    const uint64_t total = count();
+    if (total == 0)
+        return 0;
+
+    uint64_t target = static_cast<uint64_t>(percentile / 100.0 * total + 0.5);
+    if (target == 0)
+        target = 1;
+    if (target > total)
+        target = total;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i)
+    {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= target)
+        {
+            const uint64_t highest = bucketHighestValue(i);
+            const uint64_t max = maxTicks();
+            return highest < max ? highest : max;
+        }
+    }
+    return maxTicks();
+}
+
+uint64_t ArduinoSerialLatencyHistogram::bucketHighestValue(size_t index)
+{
+    if (index < SUB_BUCKETS)
+        return index;
+
+    const unsigned int shift = static_cast<unsigned int>(index >> (SUB_BUCKET_BITS - 1)) - 1;
+    const uint64_t mantissa = index - (static_cast<uint64_t>(shift) << (SUB_BUCKET_BITS - 1));
+    return ((mantissa + 1) << shift) - 1;
+}
+
+#endif // ARDUINO
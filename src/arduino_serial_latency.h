@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arduino_serial_config.h"
+
+// Packet latency histogram kept by every protocol, host only. Packets are
+// timed from the arrival time the transport reports, so decoding costs one
+// clock read per validated packet and nothing without a reported arrival.
+#ifndef ARDUINO_SERIAL_LATENCY
+    #ifdef ARDUINO
+        #define ARDUINO_SERIAL_LATENCY 0
+    #else
+        #define ARDUINO_SERIAL_LATENCY 1
+    #endif
+#endif
+
+#if ARDUINO_SERIAL_LATENCY && defined(ARDUINO)
+    #error "ARDUINO_SERIAL_LATENCY is host only"
+#endif
+
+#ifndef ARDUINO
+
+#include <atomic>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+#else
+    #include <time.h>
+#endif
+
+
+// Cheapest monotonic clock: TSC on x86 (assumed invariant), otherwise
+// CLOCK_MONOTONIC through vDSO in nanoseconds
+inline uint64_t arduino_serial_now_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000u + now.tv_nsec;
+#endif
+}
+
+// Calibrated once on first use, takes a few milliseconds
+double arduino_serial_ticks_per_ns();
+
+
+// HDR-style log-linear histogram of durations in ticks: values below
+// SUB_BUCKETS are exact, every power of two above is split into
+// SUB_BUCKETS / 2 linear buckets, so any value is kept within
+// 2 / SUB_BUCKETS (1/16) relative error over the whole 64 bit range.
+//
+// Same threading rules as ArduinoSerialProtocolCounters: record() from one
+// thread, queries from any thread without blocking it.
+class ArduinoSerialLatencyHistogram
+{
+public:
+    static constexpr const unsigned int SUB_BUCKET_BITS = 5;
+    static constexpr const size_t SUB_BUCKETS = size_t{1} << SUB_BUCKET_BITS;
+    static constexpr const size_t BUCKET_COUNT =
+            (64 - SUB_BUCKET_BITS) * (SUB_BUCKETS / 2) + SUB_BUCKETS;
+
+    ArduinoSerialLatencyHistogram();
+
+    ArduinoSerialLatencyHistogram(ArduinoSerialLatencyHistogram&& other);
+
+    void record(uint64_t ticks) const
+    {
+        std::atomic<uint64_t>& bucket = buckets[bucketIndex(ticks)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_relaxed);
+        if (ticks > max_ticks.load(std::memory_order_relaxed))
+            max_ticks.store(ticks, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const;
+
+    // Highest value equivalent to the bucket holding percentile
+    // (0 < percentile <= 100), 0 while empty
+    uint64_t percentileTicks(double percentile) const;
+
+    uint64_t maxTicks() const
+    { return max_ticks.load(std::memory_order_relaxed); }
+
+    double percentileNs(double percentile) const
+    { return percentileTicks(percentile) / arduino_serial_ticks_per_ns(); }
+
+    static size_t bucketIndex(uint64_t value)
+    {
+        if (value < SUB_BUCKETS)
+            return static_cast<size_t>(value);
+        const unsigned int shift = 64 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+        return (shift << (SUB_BUCKET_BITS - 1)) + static_cast<size_t>(value >> shift);
+    }
+
+    static uint64_t bucketHighestValue(size_t index);
+
+private:
+    // written from const protocol methods too
+    mutable std::atomic<uint64_t> buckets[BUCKET_COUNT];
+    mutable std::atomic<uint64_t> max_ticks;
+
+}; // class ArduinoSerialLatencyHistogram
+
+#endif // ARDUINO
@@ -0,0 +1,149 @@
+#include "gtest/gtest.h"
+
+#include "arduino_serial_latency.h"
+#include "arduino_serial_protocol.h"
+#include "arduino_serial_test_sync.h"
+
+#include <vector>
+
+
+TEST(ArduinoSerialLatencyHistogram, BucketBounds)
+{
+    for (uint64_t value = 0; value < 100000; value = value * 3 / 2 + 1)
+    {
+        const size_t index = ArduinoSerialLatencyHistogram::bucketIndex(value);
+        ASSERT_LT(index, ArduinoSerialLatencyHistogram::BUCKET_COUNT);
+        const uint64_t highest = ArduinoSerialLatencyHistogram::bucketHighestValue(index);
+        EXPECT_LE(value, highest);
+        EXPECT_LE(highest - value, value / (ArduinoSerialLatencyHistogram::SUB_BUCKETS / 2));
+        if (index > 0)
+        {
+            EXPECT_LT(ArduinoSerialLatencyHistogram::bucketHighestValue(index - 1), value);
+        }
+    }
+    EXPECT_EQ(ArduinoSerialLatencyHistogram::BUCKET_COUNT - 1,
+              ArduinoSerialLatencyHistogram::bucketIndex(UINT64_MAX));
+}
+
+TEST(ArduinoSerialLatencyHistogram, ErrorBound)
+{
+    const size_t per_octave = ArduinoSerialLatencyHistogram::SUB_BUCKETS / 2;
+
+    // exact below SUB_BUCKETS, SUB_BUCKETS / 2 buckets per power of two above
+    for (uint64_t value = 0; value < ArduinoSerialLatencyHistogram::SUB_BUCKETS; ++value)
+        EXPECT_EQ(value, ArduinoSerialLatencyHistogram::bucketHighestValue(
+                ArduinoSerialLatencyHistogram::bucketIndex(value)));
+    for (unsigned int bit = ArduinoSerialLatencyHistogram::SUB_BUCKET_BITS; bit < 64; ++bit)
+    {
+        const uint64_t low = uint64_t{1} << bit;
+        const uint64_t high = low + (low - 1);
+        EXPECT_EQ(per_octave, ArduinoSerialLatencyHistogram::bucketIndex(high)
+                              - ArduinoSerialLatencyHistogram::bucketIndex(low) + 1);
+    }
+
+    // worst case is the lowest value of a bucket, just under 1 / per_octave
+    double worst = 0;
+    uint64_t value = 1;
+    for (int i = 0; i < 100000; ++i)
+    {
+        value = value * 6364136223846793005u + 1442695040888963407u;
+        const uint64_t sample = value >> (value % 64);
+        if (sample == 0)
+            continue;
+        const uint64_t highest = ArduinoSerialLatencyHistogram::bucketHighestValue(
+                ArduinoSerialLatencyHistogram::bucketIndex(sample));
+        ASSERT_LE(sample, highest);
+        const double error = static_cast<double>(highest - sample) / sample;
+        worst = error > worst ? error : worst;
+    }
+    EXPECT_LT(worst, 1.0 / per_octave);
+    EXPECT_GT(worst, 1.0 / ArduinoSerialLatencyHistogram::SUB_BUCKETS);
+}
+
+TEST(ArduinoSerialLatencyHistogram, Percentiles)
+{
+    ArduinoSerialLatencyHistogram histogram;
+    EXPECT_EQ(0, histogram.count());
+    EXPECT_EQ(0, histogram.percentileTicks(50));
+
+    for (uint64_t value = 1; value <= 10000; ++value)
+        histogram.record(value);
+
+    EXPECT_EQ(10000, histogram.count());
+    EXPECT_EQ(10000, histogram.maxTicks());
+    EXPECT_NEAR(5000, histogram.percentileTicks(50), 5000 / 16);
+    EXPECT_NEAR(9900, histogram.percentileTicks(99), 9900 / 16);
+    EXPECT_NEAR(9990, histogram.percentileTicks(99.9), 9990 / 16);
+    EXPECT_EQ(10000, histogram.percentileTicks(100));
+}
+
+#if ARDUINO_SERIAL_LATENCY
+
+namespace
+{
+
+ArduinoSerialProtocol synced_secondary()
+{
+    auto secondary = ArduinoSerialProtocol::createSecondary();
+    sync(secondary);
+    return secondary;
+}
+
+std::vector<uint8_t> make_packet(ArduinoSerialProtocol& protocol)
+{
+    const uint8_t payload[] = {0x0A, 0x2B, 0x30, 0x45};
+    std::vector<uint8_t> packet(protocol.packetSize(sizeof(payload)));
+    protocol.writePacket(packet.data(), 1, payload, sizeof(payload));
+    return packet;
+}
+
+}
+
+
+TEST(ArduinoSerialLatencyHistogram, RecordedPerPacket)
+{
+    auto secondary = synced_secondary();
+    const auto packet = make_packet(secondary);
+    secondary.dataArrived(arduino_serial_now_ticks());
+
+    // byte by byte through the slow path, then whole header at once
+    for (size_t i = 0; i < packet.size();)
+        i += secondary.readBytes(packet.data() + i,
+                                 secondary.nextOperation().bytes_to_read).bytes_read;
+    for (size_t i = 0; i < packet.size();)
+        i += secondary.readBytes(packet.data() + i, packet.size() - i).bytes_read;
+
+    EXPECT_EQ(2, secondary.latency().count());
+    EXPECT_LT(0, secondary.latency().maxTicks());
+    EXPECT_LT(0.0, arduino_serial_ticks_per_ns());
+}
+
+TEST(ArduinoSerialLatencyHistogram, TimedFromArrival)
+{
+    auto secondary = synced_secondary();
+    const auto packet = make_packet(secondary);
+
+    // bytes that waited in the transport count, not just decode time
+    const uint64_t waited = 1000000000;
+    secondary.dataArrived(arduino_serial_now_ticks() - waited);
+    secondary.readBytes(packet.data(), 1);
+    secondary.dataArrived(arduino_serial_now_ticks());
+    for (size_t i = 1; i < packet.size();)
+        i += secondary.readBytes(packet.data() + i, packet.size() - i).bytes_read;
+
+    EXPECT_EQ(1, secondary.latency().count());
+    EXPECT_LE(waited, secondary.latency().maxTicks());
+}
+
+TEST(ArduinoSerialLatencyHistogram, NothingWithoutArrival)
+{
+    auto secondary = synced_secondary();
+    const auto packet = make_packet(secondary);
+
+    for (size_t i = 0; i < packet.size();)
+        i += secondary.readBytes(packet.data() + i, packet.size() - i).bytes_read;
+
+    EXPECT_EQ(0, secondary.latency().count());
+}
+
+#endif // ARDUINO_SERIAL_LATENCY
@@ -0,0 +1,546 @@
+#include "arduino_serial_link_manager.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+
+
+namespace
+{
+
+constexpr const int MAX_EVENTS = 64;
+
+struct DeferredSend
+{
+    ArduinoSerialLinkManager* manager;
+    ArduinoSerialLinkId link;
+    std::vector<uint8_t> payload;
+};
+
+// link whose packet callback runs on this thread, with its mutex held
+thread_local const ArduinoSerialLinkManager* callback_manager = nullptr;
+thread_local ArduinoSerialLinkId callback_link = 0;
+// sends to other links made from that callback
+thread_local std::vector<DeferredSend> deferred_sends;
+
+void flush_deferred_sends()
+{
+    std::vector<DeferredSend> pending;
+    pending.swap(deferred_sends);
+    for (const DeferredSend& deferred : pending)
+    {
+        deferred.manager->send(deferred.link, deferred.payload.data(),
+                               deferred.payload.size());
+    }
+}
+
+}
+
+
+struct ArduinoSerialLinkManager::Link
+{
+    Link(ArduinoSerialLinkManager& manager, ArduinoSerialLinkId id, bool primary)
+    : manager(manager)
+    , id{id}
+    , protocol{primary ? ArduinoSerialProtocol::createPrimary()
+                       : ArduinoSerialProtocol::createSecondary()}
+    , transport{protocol, &ArduinoSerialLinkManager::onPacket, this}
+    , worker{0}
+    , removed{false}
+    , load{0}
+    , result{ArduinoSerialTransportResult::OK}
+    {}
+
+    ArduinoSerialLinkManager& manager;
+    const ArduinoSerialLinkId id;
+    ArduinoSerialProtocol protocol;
+    ArduinoSerialTransport transport;
+
+    // guards protocol and transport, recursive so the packet callback
+    // may send on the link it was called for
+    std::recursive_mutex mutex;
+
+    // owner as decided by the manager, guarded by manager mutex
+    size_t worker;
+    bool removed;
+
+    // bytes received since previous rebalance()
+    std::atomic<uint64_t> load;
+    std::atomic<ArduinoSerialTransportResult> result;
+
+}; // struct ArduinoSerialLinkManager::Link
+
+
+struct ArduinoSerialLinkManager::Worker
+{
+    enum class CommandType
+    {
+        ADOPT,
+        RELEASE,
+        REMOVE,
+        STOP
+    };
+
+    struct Command
+    {
+        CommandType type;
+        Link* link;
+        size_t target;
+    };
+
+    explicit Worker(ArduinoSerialLinkManager& manager)
+    : manager(manager)
+    , epoll_fd{-1}
+    , wake_fd{-1}
+    {}
+
+    ~Worker()
+    {
+        if (epoll_fd >= 0)
+            ::close(epoll_fd);
+        if (wake_fd >= 0)
+            ::close(wake_fd);
+    }
+
+    ArduinoSerialTransportResult setup()
+    {
+        if (epoll_fd >= 0)
+            return ArduinoSerialTransportResult::OK;
+
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epoll_fd < 0 || wake_fd < 0)
+            return ArduinoSerialTransportResult::ERROR_CONFIGURE;
+
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) != 0)
+            return ArduinoSerialTransportResult::ERROR_CONFIGURE;
+        return ArduinoSerialTransportResult::OK;
+    }
+
+    void push(CommandType type, Link* link, size_t target = 0)
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        commands.push_back(Command{type, link, target});
+        if (wake_fd >= 0)
+        {
+            const uint64_t one = 1;
+            ssize_t written = write(wake_fd, &one, sizeof(one));
+            (void)written;
+        }
+    }
+
+    void run()
+    {
+        struct epoll_event events[MAX_EVENTS];
+        bool stopping = handleCommands();
+
+        while (!stopping)
+        {
+            // sync retries and rate switches are timer driven, nothing
+            // wakes the loop for them but the nearest deadline
+            const int count = epoll_wait(epoll_fd, events, MAX_EVENTS, timerTimeout());
+            for (int i = 0; i < count; ++i)
+            {
+                if (events[i].data.ptr == nullptr)
+                    stopping = handleCommands() || stopping;
+                else
+                    pollLink(static_cast<Link*>(events[i].data.ptr));
+            }
+
+            for (size_t i = 0; i < links.size();)
+            {
+                Link* link = links[i];
+                bool idle;
+                {
+                    std::lock_guard<std::recursive_mutex> lock{link->mutex};
+                    idle = !link->transport.timerPending();
+                }
+                if (idle || pollLink(link))
+                    ++i;
+            }
+        }
+    }
+
+    // Nearest timer of all links, -1 when none is pending
+    int timerTimeout()
+    {
+        int timeout = -1;
+        for (Link* link : links)
+        {
+            std::lock_guard<std::recursive_mutex> lock{link->mutex};
+            const int link_timeout = link->transport.timerTimeout();
+            if (link_timeout >= 0 && (timeout < 0 || link_timeout < timeout))
+                timeout = link_timeout;
+        }
+        return timeout;
+    }
+
+    // Returns true when STOP was among commands
+    bool handleCommands()
+    {
+        uint64_t value;
+        ssize_t drained = read(wake_fd, &value, sizeof(value));
+        (void)drained;
+
+        std::vector<Command> pending;
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            pending.swap(commands);
+        }
+
+        bool stopping = false;
+        for (const Command& command : pending)
+        {
+            switch (command.type)
+            {
+                case CommandType::ADOPT:
+                    adopt(command.link);
+                    break;
+                case CommandType::RELEASE:
+                    detach(command.link);
+                    manager.workers[command.target]->push(CommandType::ADOPT,
+                                                          command.link);
+                    break;
+                case CommandType::REMOVE:
+                {
+                    detach(command.link);
+                    std::lock_guard<std::recursive_mutex> lock{command.link->mutex};
+                    command.link->transport.close();
+                    command.link->result = ArduinoSerialTransportResult::ERROR_NOT_OPEN;
+                    break;
+                }
+                case CommandType::STOP:
+                    stopping = true;
+                    break;
+            }
+        }
+        return stopping;
+    }
+
+    void adopt(Link* link)
+    {
+        if (link->result != ArduinoSerialTransportResult::OK)
+            return;
+
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = link;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, link->transport.pollFd(), &event) != 0)
+        {
+            link->result = ArduinoSerialTransportResult::ERROR_CONFIGURE;
+            return;
+        }
+        links.push_back(link);
+
+        // data may have arrived while link was in flight between workers
+        pollLink(link);
+    }
+
+    void detach(Link* link)
+    {
+        const auto position = std::find(links.begin(), links.end(), link);
+        if (position == links.end())
+            return;
+        links.erase(position);
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, link->transport.pollFd(), nullptr);
+    }
+
+    // Returns false when link failed and was dropped
+    bool pollLink(Link* link)
+    {
+        ArduinoSerialTransportResult result;
+        {
+            std::lock_guard<std::recursive_mutex> lock{link->mutex};
+            result = link->transport.poll(0);
+            if (result != ArduinoSerialTransportResult::OK)
+            {
+                detach(link);
+                link->transport.close();
+                link->result = result;
+            }
+        }
+
+        flush_deferred_sends();
+        return result == ArduinoSerialTransportResult::OK;
+    }
+
+    ArduinoSerialLinkManager& manager;
+    int epoll_fd;
+    int wake_fd;
+    std::thread thread;
+
+    std::mutex mutex;
+    std::vector<Command> commands;
+
+    // touched only by the worker thread
+    std::vector<Link*> links;
+
+}; // struct ArduinoSerialLinkManager::Worker
+
+
+ArduinoSerialLinkManagerConfig arduino_serial_default_link_manager_config()
+{
+    ArduinoSerialLinkManagerConfig config;
+    config.worker_count = 0;
+    config.transport = arduino_serial_default_transport_config();
+    return config;
+}
+
+ArduinoSerialLinkManager::ArduinoSerialLinkManager(
+        const ArduinoSerialLinkManagerConfig& config,
+        ArduinoSerialLinkPacketCallback callback, void* context)
+: config(config)
+, callback{callback}
+, context{context}
+, started{false}
+{
+    size_t worker_count = config.worker_count;
+    if (worker_count == 0)
+    {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = cpus > 0 ? static_cast<size_t>(cpus) : 1;
+    }
+    for (size_t i = 0; i < worker_count; ++i)
+        workers.emplace_back(new Worker{*this});
+}
+
+ArduinoSerialLinkManager::~ArduinoSerialLinkManager()
+{
+    stop();
+}
+
+ArduinoSerialTransportResult ArduinoSerialLinkManager::start()
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    if (started)
+        return ArduinoSerialTransportResult::OK;
+
+    for (auto& worker : workers)
+    {
+        const ArduinoSerialTransportResult result = worker->setup();
+        if (result != ArduinoSerialTransportResult::OK)
+            return result;
+    }
+    for (auto& worker : workers)
+    {
+        Worker* raw = worker.get();
+        worker->thread = std::thread{[raw]() { raw->run(); }};
+    }
+    started = true;
+    return ArduinoSerialTransportResult::OK;
+}
+
+void ArduinoSerialLinkManager::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        if (!started)
+            return;
+        started = false;
+        for (auto& worker : workers)
+            worker->push(Worker::CommandType::STOP, nullptr);
+    }
+
+    // joined unlocked, packet callbacks may still call send()
+    for (auto& worker : workers)
+        worker->thread.join();
+}
+
+ArduinoSerialTransportResult
+ArduinoSerialLinkManager::open(const char* path, bool primary,
+                               ArduinoSerialLinkId& link)
+{
+    const int fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return ArduinoSerialTransportResult::ERROR_OPEN;
+    return add(fd, primary, link);
+}
+
+ArduinoSerialTransportResult
+ArduinoSerialLinkManager::attach(int fd, bool primary, ArduinoSerialLinkId& link)
+{
+    return add(fd, primary, link);
+}
+
+ArduinoSerialTransportResult
+ArduinoSerialLinkManager::add(int fd, bool primary, ArduinoSerialLinkId& link)
+{
+    std::lock_guard<std::mutex> lock{mutex};
+
+    const ArduinoSerialLinkId id = static_cast<ArduinoSerialLinkId>(links.size());
+    std::unique_ptr<Link> created{new Link{*this, id, primary}};
+    const ArduinoSerialTransportResult result =
+            created->transport.attach(fd, config.transport);
+    if (result != ArduinoSerialTransportResult::OK)
+        return result;
+
+    created->worker = leastLoadedWorker();
+    workers[created->worker]->push(Worker::CommandType::ADOPT, created.get());
+    links.push_back(std::move(created));
+    link = id;
+    return ArduinoSerialTransportResult::OK;
+}
+
+void ArduinoSerialLinkManager::remove(ArduinoSerialLinkId link)
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    if (link >= links.size() || links[link]->removed)
+        return;
+
+    links[link]->removed = true;
+    workers[links[link]->worker]->push(Worker::CommandType::REMOVE, links[link].get());
+}
+
+ArduinoSerialTransportResult
+ArduinoSerialLinkManager::send(ArduinoSerialLinkId link,
+                               const void* payload, size_t payload_size)
+{
+    Link* target = find(link);
+    if (target == nullptr)
+        return ArduinoSerialTransportResult::ERROR_NOT_OPEN;
+
+    if (callback_manager != nullptr
+        && (callback_manager != this || callback_link != link))
+    {
+        const uint8_t* data = static_cast<const uint8_t*>(payload);
+        deferred_sends.push_back(DeferredSend{this, link,
+                                              std::vector<uint8_t>(data, data + payload_size)});
+        return ArduinoSerialTransportResult::OK;
+    }
+
+    std::lock_guard<std::recursive_mutex> lock{target->mutex};
+    const ArduinoSerialTransportResult result = target->result;
+    if (result != ArduinoSerialTransportResult::OK)
+        return result;
+    return target->transport.send(payload, payload_size);
+}
+
+ArduinoSerialTransportResult
+ArduinoSerialLinkManager::linkResult(ArduinoSerialLinkId link) const
+{
+    const Link* target = find(link);
+    if (target == nullptr)
+        return ArduinoSerialTransportResult::ERROR_NOT_OPEN;
+    return target->result;
+}
+
+bool ArduinoSerialLinkManager::isSynced(ArduinoSerialLinkId link) const
+{
+    Link* target = find(link);
+    if (target == nullptr)
+        return false;
+
+    std::lock_guard<std::recursive_mutex> lock{target->mutex};
+    return target->protocol.isSynced();
+}
+
+size_t ArduinoSerialLinkManager::linkCount() const
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    size_t count = 0;
+    for (const auto& link : links)
+        count += link->removed ? 0 : 1;
+    return count;
+}
+
+size_t ArduinoSerialLinkManager::workerOf(ArduinoSerialLinkId link) const
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    return link < links.size() ? links[link]->worker : workers.size();
+}
+
+size_t ArduinoSerialLinkManager::rebalance()
+{
+    std::lock_guard<std::mutex> lock{mutex};
+
+    std::vector<uint64_t> link_load(links.size(), 0);
+    std::vector<uint64_t> worker_load(workers.size(), 0);
+    for (const auto& link : links)
+    {
+        link_load[link->id] = link->load.exchange(0);
+        if (!link->removed && link->result == ArduinoSerialTransportResult::OK)
+            worker_load[link->worker] += link_load[link->id];
+    }
+
+    // greedy: move the link from busiest to idlest worker that narrows
+    // the gap the most, until no move narrows it
+    size_t moved = 0;
+    while (moved < links.size())
+    {
+        const auto busiest = std::max_element(worker_load.begin(), worker_load.end())
+                             - worker_load.begin();
+        const auto idlest = std::min_element(worker_load.begin(), worker_load.end())
+                            - worker_load.begin();
+        const uint64_t gap = worker_load[busiest] - worker_load[idlest];
+
+        Link* candidate = nullptr;
+        uint64_t best_gap = gap;
+        for (const auto& link : links)
+        {
+            const uint64_t load = link_load[link->id];
+            if (link->removed || link->worker != static_cast<size_t>(busiest)
+                || load == 0 || load >= gap)
+                continue;
+            const uint64_t new_gap = gap > 2 * load ? gap - 2 * load : 2 * load - gap;
+            if (new_gap < best_gap)
+            {
+                best_gap = new_gap;
+                candidate = link.get();
+            }
+        }
+        if (candidate == nullptr)
+            break;
+
+        worker_load[busiest] -= link_load[candidate->id];
+        worker_load[idlest] += link_load[candidate->id];
+        moveLink(*candidate, idlest);
+        ++moved;
+    }
+    return moved;
+}
+
+ArduinoSerialLinkManager::Link*
+ArduinoSerialLinkManager::find(ArduinoSerialLinkId link) const
+{
+    std::lock_guard<std::mutex> lock{mutex};
+    return link < links.size() ? links[link].get() : nullptr;
+}
+
+size_t ArduinoSerialLinkManager::leastLoadedWorker() const
+{
+    std::vector<size_t> counts(workers.size(), 0);
+    for (const auto& link : links)
+    {
+        if (!link->removed)
+            ++counts[link->worker];
+    }
+    return std::min_element(counts.begin(), counts.end()) - counts.begin();
+}
+
+void ArduinoSerialLinkManager::moveLink(Link& link, size_t target)
+{
+    workers[link.worker]->push(Worker::CommandType::RELEASE, &link, target);
+    link.worker = target;
+}
+
+void ArduinoSerialLinkManager::onPacket(void* context, ArduinoSerialProtocolID id,
+                                        const void* payload, size_t payload_size)
+{
+    Link* link = static_cast<Link*>(context);
+    link->load += link->protocol.packetSize(payload_size, id);
+
+    const ArduinoSerialLinkManager* outer_manager = callback_manager;
+    const ArduinoSerialLinkId outer_link = callback_link;
+    callback_manager = &link->manager;
+    callback_link = link->id;
+    link->manager.callback(link->manager.context, link->id, id, payload, payload_size);
+    callback_manager = outer_manager;
+    callback_link = outer_link;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "arduino_serial_protocol.h"
+#include "arduino_serial_transport.h"
+
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+
+using ArduinoSerialLinkId = uint32_t;
+
+// Called from worker threads, concurrently for links on different workers
+using ArduinoSerialLinkPacketCallback = void(*)(void* context,
+                                                ArduinoSerialLinkId link,
+                                                ArduinoSerialProtocolID id,
+                                                const void* payload,
+                                                size_t payload_size);
+
+struct ArduinoSerialLinkManagerConfig
+{
+    // event loops, one thread each; 0 means one per online cpu
+    size_t worker_count;
+    ArduinoSerialTransportConfig transport;
+};
+
+ArduinoSerialLinkManagerConfig arduino_serial_default_link_manager_config();
+
+
+// Host-only owner of many serial links, each an ArduinoSerialProtocol with
+// its ArduinoSerialTransport. Links are sharded across worker threads, every
+// worker runs one epoll loop over the transports it owns. Decoded packets of
+// all links go to a single callback tagged with the link id.
+//
+// rebalance() moves links between workers by the traffic they carried since
+// the previous call, so busy links do not pile up on one core.
+class ArduinoSerialLinkManager
+{
+public:
+    ArduinoSerialLinkManager(const ArduinoSerialLinkManagerConfig& config,
+                             ArduinoSerialLinkPacketCallback callback,
+                             void* context);
+
+    ArduinoSerialLinkManager(const ArduinoSerialLinkManager&) = delete;
+    ArduinoSerialLinkManager& operator=(const ArduinoSerialLinkManager&) = delete;
+
+    ~ArduinoSerialLinkManager();
+
+    // Spawns workers, links can be added before or after
+    ArduinoSerialTransportResult start();
+
+    void stop();
+
+    ArduinoSerialTransportResult open(const char* path, bool primary,
+                                      ArduinoSerialLinkId& link);
+
+    // Takes ownership of an already open tty (e.g. openpty() slave)
+    ArduinoSerialTransportResult attach(int fd, bool primary,
+                                        ArduinoSerialLinkId& link);
+
+    // Closes link, its id is not reused
+    void remove(ArduinoSerialLinkId link);
+
+    // Safe from any thread. From the packet callback a send on the
+    // callback's own link goes out directly; sends on other links are
+    // queued and done once that link is unlocked (so two callbacks
+    // sending to each other's links cannot deadlock); those return OK
+    // and a failure when they are done is not reported.
+    ArduinoSerialTransportResult send(ArduinoSerialLinkId link,
+                                      const void* payload, size_t payload_size);
+
+    // Last error of the link, OK while it is alive
+    ArduinoSerialTransportResult linkResult(ArduinoSerialLinkId link) const;
+
+    bool isSynced(ArduinoSerialLinkId link) const;
+
+    size_t workerCount() const
+    { return workers.size(); }
+
+    size_t linkCount() const;
+
+    size_t workerOf(ArduinoSerialLinkId link) const;
+
+    // Returns number of links moved
+    size_t rebalance();
+
+private:
+    struct Link;
+    struct Worker;
+
+    ArduinoSerialTransportResult add(int fd, bool primary, ArduinoSerialLinkId& link);
+    Link* find(ArduinoSerialLinkId link) const;
+    size_t leastLoadedWorker() const;
+    void moveLink(Link& link, size_t target);
+
+    static void onPacket(void* context, ArduinoSerialProtocolID id,
+                         const void* payload, size_t payload_size);
+
+    ArduinoSerialLinkManagerConfig config;
+    ArduinoSerialLinkPacketCallback callback;
+    void* context;
+
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::unique_ptr<Link>> links;
+    bool started;
+
+}; // class ArduinoSerialLinkManager
@@ -0,0 +1,309 @@
+#include "gtest/gtest.h"
+
+#include "arduino_serial_link_manager.h"
+#include "arduino_serial_protocol.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <poll.h>
+#include <pty.h>
+#include <unistd.h>
+#include <vector>
+
+
+namespace
+{
+
+const uint8_t SYNC_REQUEST[] = {0xD3, 0x74, 0xE5, 0x52};
+
+struct LinkPacket
+{
+    ArduinoSerialLinkId link;
+    ArduinoSerialProtocolID id;
+    std::vector<uint8_t> payload;
+};
+
+struct Collector
+{
+    std::mutex mutex;
+    std::condition_variable arrived;
+    std::vector<LinkPacket> packets;
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        return packets.size();
+    }
+};
+
+void collect_packet(void* context, ArduinoSerialLinkId link, ArduinoSerialProtocolID id,
+                    const void* payload, size_t payload_size)
+{
+    Collector* collector = static_cast<Collector*>(context);
+    const uint8_t* data = static_cast<const uint8_t*>(payload);
+    std::lock_guard<std::mutex> lock{collector->mutex};
+    collector->packets.push_back(LinkPacket{link, id,
+                                            std::vector<uint8_t>(data, data + payload_size)});
+    collector->arrived.notify_all();
+}
+
+// sends every packet on to the other link of the pair
+struct Forwarder
+{
+    ArduinoSerialLinkManager* manager;
+    Collector collector;
+};
+
+void forward_packet(void* context, ArduinoSerialLinkId link, ArduinoSerialProtocolID id,
+                    const void* payload, size_t payload_size)
+{
+    Forwarder* forwarder = static_cast<Forwarder*>(context);
+    EXPECT_EQ(ArduinoSerialTransportResult::OK,
+              forwarder->manager->send(link ^ 1, payload, payload_size));
+    collect_packet(&forwarder->collector, link, id, payload, payload_size);
+}
+
+// sync request followed by count packets of payload
+std::vector<uint8_t> make_burst(size_t count, uint8_t payload, bool with_sync)
+{
+    auto sender = ArduinoSerialProtocol::createPrimary();
+    sender.syncSent();
+    std::vector<uint8_t> data;
+    if (with_sync)
+        data.assign(SYNC_REQUEST, SYNC_REQUEST + sizeof(SYNC_REQUEST));
+    for (size_t i = 0; i < count; ++i)
+    {
+        const size_t offset = data.size();
+        data.resize(offset + sender.packetSize(1));
+        sender.writePacket(data.data() + offset, sender.createNextPacketId(), &payload, 1);
+    }
+    return data;
+}
+
+void write_fd(int fd, const std::vector<uint8_t>& data)
+{
+    ASSERT_EQ(static_cast<ssize_t>(data.size()), write(fd, data.data(), data.size()));
+}
+
+void read_fd(int fd, std::vector<uint8_t>& data)
+{
+    size_t received = 0;
+    while (received < data.size())
+    {
+        struct pollfd poll_fd = {fd, POLLIN, 0};
+        ASSERT_LT(0, ::poll(&poll_fd, 1, 2000));
+        const ssize_t count = read(fd, data.data() + received, data.size() - received);
+        ASSERT_LT(0, count);
+        received += count;
+    }
+}
+
+}
+
+
+class FArduinoSerialLinkManager : public ::testing::Test
+{
+public:
+    void SetUp() override
+    {
+        config = arduino_serial_default_link_manager_config();
+        config.worker_count = 2;
+        config.transport.read_buffer_size = 256;
+        config.transport.sync_retry_ms = 50;
+    }
+
+    void TearDown() override
+    {
+        for (int fd : master_fds)
+            close(fd);
+    }
+
+    int openLink(ArduinoSerialLinkManager& manager, bool primary,
+                 ArduinoSerialLinkId& link)
+    {
+        int master_fd = -1;
+        int slave_fd = -1;
+        EXPECT_EQ(0, openpty(&master_fd, &slave_fd, nullptr, nullptr, nullptr));
+        struct termios tty;
+        tcgetattr(master_fd, &tty);
+        cfmakeraw(&tty);
+        tcsetattr(master_fd, TCSANOW, &tty);
+        master_fds.push_back(master_fd);
+        EXPECT_EQ(ArduinoSerialTransportResult::OK,
+                  manager.attach(slave_fd, primary, link));
+        return master_fd;
+    }
+
+    testing::AssertionResult waitPackets(size_t count)
+    {
+        return waitPackets(collector, count);
+    }
+
+    testing::AssertionResult waitPackets(Collector& target, size_t count)
+    {
+        std::unique_lock<std::mutex> lock{target.mutex};
+        target.arrived.wait_for(lock, std::chrono::seconds(2),
+                                [&]() { return target.packets.size() >= count; });
+        if (target.packets.size() != count)
+            return testing::AssertionFailure() << "received " << target.packets.size()
+                                               << " packets";
+        return testing::AssertionSuccess();
+    }
+
+protected:
+    ArduinoSerialLinkManagerConfig config;
+    Collector collector;
+    std::vector<int> master_fds;
+
+};
+
+
+TEST_F(FArduinoSerialLinkManager, DeliversPacketsTaggedWithLink)
+{
+    ArduinoSerialLinkManager manager{config, &collect_packet, &collector};
+    ASSERT_EQ(2u, manager.workerCount());
+
+    std::vector<int> masters;
+    for (uint8_t i = 0; i < 4; ++i)
+    {
+        ArduinoSerialLinkId link;
+        masters.push_back(openLink(manager, false, link));
+        EXPECT_EQ(i, link);
+    }
+    EXPECT_EQ(4u, manager.linkCount());
+    EXPECT_EQ(0u, manager.workerOf(0));
+    EXPECT_EQ(1u, manager.workerOf(1));
+    EXPECT_EQ(0u, manager.workerOf(2));
+    EXPECT_EQ(1u, manager.workerOf(3));
+
+    ASSERT_EQ(ArduinoSerialTransportResult::OK, manager.start());
+    for (uint8_t i = 0; i < 4; ++i)
+        write_fd(masters[i], make_burst(1, 0x10 + i, true));
+
+    ASSERT_TRUE(waitPackets(4));
+    manager.stop();
+
+    for (const auto& packet : collector.packets)
+    {
+        EXPECT_EQ(1, packet.id);
+        EXPECT_EQ(std::vector<uint8_t>{static_cast<uint8_t>(0x10 + packet.link)},
+                  packet.payload);
+        EXPECT_TRUE(manager.isSynced(packet.link));
+    }
+}
+
+TEST_F(FArduinoSerialLinkManager, PrimarySendsFromCaller)
+{
+    ArduinoSerialLinkManager manager{config, &collect_packet, &collector};
+    ASSERT_EQ(ArduinoSerialTransportResult::OK, manager.start());
+
+    ArduinoSerialLinkId link;
+    const int master_fd = openLink(manager, true, link);
+    const uint8_t payload = 0x5A;
+    ASSERT_EQ(ArduinoSerialTransportResult::OK, manager.send(link, &payload, 1));
+
+    const auto protocol = ArduinoSerialProtocol::createPrimary();
+    std::vector<uint8_t> sent(sizeof(SYNC_REQUEST) + protocol.packetSize(1));
+    read_fd(master_fd, sent);
+    EXPECT_TRUE(std::equal(SYNC_REQUEST, SYNC_REQUEST + sizeof(SYNC_REQUEST), sent.begin()));
+}
+
+TEST_F(FArduinoSerialLinkManager, PrimaryRetriesSyncWhileIdle)
+{
+    ArduinoSerialLinkManager manager{config, &collect_packet, &collector};
+    ASSERT_EQ(ArduinoSerialTransportResult::OK, manager.start());
+
+    // nothing but the retry deadline wakes the worker
+    ArduinoSerialLinkId link;
+    const int master_fd = openLink(manager, true, link);
+    for (int i = 0; i < 3; ++i)
+    {
+        std::vector<uint8_t> sent(sizeof(SYNC_REQUEST));
+        read_fd(master_fd, sent);
+        EXPECT_TRUE(std::equal(SYNC_REQUEST, SYNC_REQUEST + sizeof(SYNC_REQUEST),
+                               sent.begin()));
+    }
+    EXPECT_FALSE(manager.isSynced(link));
+}
+
+TEST_F(FArduinoSerialLinkManager, RebalanceSplitsBusyLinks)
+{
+    ArduinoSerialLinkManager manager{config, &collect_packet, &collector};
+    std::vector<int> masters;
+    for (int i = 0; i < 4; ++i)
+    {
+        ArduinoSerialLinkId link;
+        masters.push_back(openLink(manager, false, link));
+    }
+    ASSERT_EQ(ArduinoSerialTransportResult::OK, manager.start());
+
+    // links 0 and 2 share worker 0 and carry all the traffic
+    write_fd(masters[0], make_burst(20, 0x01, true));
+    write_fd(masters[2], make_burst(20, 0x02, true));
+    ASSERT_TRUE(waitPackets(40));
+
+    EXPECT_EQ(1u, manager.rebalance());
+    EXPECT_NE(manager.workerOf(0), manager.workerOf(2));
+
+    // nothing more to balance without new traffic
+    EXPECT_EQ(0u, manager.rebalance());
+
+    // moved link keeps working on its new worker
+    write_fd(masters[0], make_burst(1, 0x01, false));
+    write_fd(masters[2], make_burst(1, 0x02, false));
+    ASSERT_TRUE(waitPackets(42));
+}
+
+TEST_F(FArduinoSerialLinkManager, RemoveClosesLink)
+{
+    ArduinoSerialLinkManager manager{config, &collect_packet, &collector};
+    ASSERT_EQ(ArduinoSerialTransportResult::OK, manager.start());
+
+    ArduinoSerialLinkId link;
+    openLink(manager, false, link);
+    EXPECT_EQ(ArduinoSerialTransportResult::OK, manager.linkResult(link));
+
+    manager.remove(link);
+    EXPECT_EQ(0u, manager.linkCount());
+    // workers finish queued commands before stopping
+    manager.stop();
+    EXPECT_EQ(ArduinoSerialTransportResult::ERROR_NOT_OPEN, manager.linkResult(link));
+
+    const uint8_t payload = 0x01;
+    EXPECT_EQ(ArduinoSerialTransportResult::ERROR_NOT_OPEN, manager.send(link, &payload, 1));
+    EXPECT_EQ(ArduinoSerialTransportResult::ERROR_NOT_OPEN, manager.send(42, &payload, 1));
+}
+
+TEST_F(FArduinoSerialLinkManager, CallbacksSendToEachOthersLinks)
+{
+    Forwarder forwarder;
+    ArduinoSerialLinkManager manager{config, &forward_packet, &forwarder};
+    forwarder.manager = &manager;
+
+    ArduinoSerialLinkId link;
+    const int master_0 = openLink(manager, false, link);
+    const int master_1 = openLink(manager, false, link);
+    ASSERT_NE(manager.workerOf(0), manager.workerOf(1));
+    ASSERT_EQ(ArduinoSerialTransportResult::OK, manager.start());
+
+    // both links synced before anything is forwarded to them
+    const auto secondary = ArduinoSerialProtocol::createSecondary();
+    std::vector<uint8_t> sync_reply(secondary.syncReplyHeaderSize());
+    write_fd(master_0, make_burst(0, 0, true));
+    write_fd(master_1, make_burst(0, 0, true));
+    read_fd(master_0, sync_reply);
+    read_fd(master_1, sync_reply);
+
+    // both workers forward at the same time, each holding its own link
+    const size_t count = 200;
+    write_fd(master_0, make_burst(count, 0x01, false));
+    write_fd(master_1, make_burst(count, 0x02, false));
+    ASSERT_TRUE(waitPackets(forwarder.collector, 2 * count));
+
+    std::vector<uint8_t> forwarded(count * secondary.packetSize(1));
+    read_fd(master_0, forwarded);
+    EXPECT_EQ(0x02, forwarded.back());
+    read_fd(master_1, forwarded);
+    EXPECT_EQ(0x01, forwarded.back());
+}
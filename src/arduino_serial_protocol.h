@@ -1,14 +1,32 @@
 #pragma once
 
+#include "arduino_serial_cobs.h"
+#include "arduino_serial_latency.h"
+#include "arduino_serial_stats.h"
+
 #include <stddef.h>
 #include <stdint.h>
 
+#ifndef ARDUINO
+    #include <sys/uio.h>
+#endif
+
+// Largest payload of an extended frame, 0 builds without them
+#ifndef ARDUINO_SERIAL_MAX_EXTENDED_PAYLOAD
+    #ifdef ARDUINO
+        #define ARDUINO_SERIAL_MAX_EXTENDED_PAYLOAD 0
+    #else
+        #define ARDUINO_SERIAL_MAX_EXTENDED_PAYLOAD 4096
+    #endif
+#endif
+
 enum class ArduinoSerialGeneralResult
 {
     OK,
     ERROR_WRONG_STATE,
     ERROR_NOT_SYNCED,
     ERROR_PAYLOAD_SIZE_TOO_BIG,
+    ERROR_BUFFER_TOO_SMALL,
     ERROR_UNDEFINED
 };
 
@@ -17,7 +35,8 @@ enum class ArduinoSerialOperation
     NOPE,
     READ_HEADER,
     READ_PAYLOAD,
-    SEND_SYNC_REPLY
+    SEND_SYNC_REPLY,
+    SEND_SYNC
 };
 
 enum class ArduinoSerialReadResult
@@ -26,7 +45,9 @@ enum class ArduinoSerialReadResult
     OK,
     ERROR_UNEXPECTED_DATA,
     ERROR_CHECKSUM,
-    ERROR_INSUFFICIENT_DATA_LENGTH
+    ERROR_INSUFFICIENT_DATA_LENGTH,
+    // reader's buffer cannot ever hold the bytes nextOperation() asks for
+    ERROR_BUFFER_TOO_SMALL
 };
 
 using ArduinoSerialProtocolID = uint16_t;
@@ -42,37 +63,380 @@ struct ArduinoSerialReceiveResult
 {
     ArduinoSerialReadResult read_result;
     size_t bytes_read;
+    // Validated payload inside the buffer passed to readBytes, valid as long
+    // as that buffer is; set only when a payload was read OK
+    const void* payload;
+    size_t payload_size;
+    ArduinoSerialProtocolID packet_id;
+};
+
+struct ArduinoSerialPayload
+{
+    const void* data;
+    size_t size;
+};
+
+struct ArduinoSerialBatchResult
+{
+    ArduinoSerialGeneralResult result;
+    size_t packets_written;
+    size_t bytes_written;
+    ArduinoSerialProtocolID first_id;
+};
+
+
+enum class ArduinoSerialProtocolState : char
+{
+    UNDEFINED,
+    WAITING_SYNC,
+    IDLE,
+    READ_STROBE_2,
+    READ_SYNC_STROBE_2,
+    READ_SYNC_STROBE_3,
+    READ_SYNC_STROBE_4,
+    WRITE_SYNC_REPLY,
+    READ_HEADER,
+    READ_PAYLOAD,
+    SENDING_SYNC,
+    READ_SYNC_REPLY_1,
+    READ_SYNC_REPLY_2,
+    READ_SYNC_REPLY_3,
+    READ_SYNC_REPLY_4,
+    READ_SYNC_PARAMS,
+    READ_SYNC_REPLY_PARAMS,
+    READ_EXTENDED_HEADER,
+    READ_SHORT_HEADER
+};
+
+enum class ArduinoSerialFrame : uint8_t
+{
+    CLASSIC,
+    EXTENDED,
+    SHORT
+};
+
+struct ArduinoSerialPayloadState
+{
+    size_t payload_len;
+    uint16_t packet_id;
+    ArduinoSerialFrame frame;
+    // CRC-16 (or CRC-8) of classic and short frames, CRC-32 of extended
+    uint32_t checksum;
+    uint32_t checksum_header;
 };
 
 
-class ArduinoSerialProtocol
+// Link features negotiated in the sync handshake (setFeatures)
+
+// Payloads over MAX_PAYLOAD_SIZE, up to ARDUINO_SERIAL_MAX_EXTENDED_PAYLOAD
+constexpr const uint8_t ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES = 0x01;
+// Short header for payloads up to SHORT_MAX_PAYLOAD_SIZE
+constexpr const uint8_t ARDUINO_SERIAL_FEATURE_SHORT_FRAMES = 0x02;
+
+// Link rates negotiated in the sync handshake (setBaudRates), a higher
+// bit is a faster rate
+constexpr const uint8_t ARDUINO_SERIAL_BAUD_230400 = 0x01;
+constexpr const uint8_t ARDUINO_SERIAL_BAUD_250000 = 0x02;
+constexpr const uint8_t ARDUINO_SERIAL_BAUD_460800 = 0x04;
+constexpr const uint8_t ARDUINO_SERIAL_BAUD_500000 = 0x08;
+constexpr const uint8_t ARDUINO_SERIAL_BAUD_921600 = 0x10;
+constexpr const uint8_t ARDUINO_SERIAL_BAUD_1000000 = 0x20;
+constexpr const uint8_t ARDUINO_SERIAL_BAUD_1500000 = 0x40;
+constexpr const uint8_t ARDUINO_SERIAL_BAUD_2000000 = 0x80;
+
+// Rate of one ARDUINO_SERIAL_BAUD_* bit, 0 for none
+inline uint32_t arduino_serial_baud_rate(uint8_t rate)
+{
+    switch (rate)
+    {
+        case ARDUINO_SERIAL_BAUD_230400:
+            return 230400;
+        case ARDUINO_SERIAL_BAUD_250000:
+            return 250000;
+        case ARDUINO_SERIAL_BAUD_460800:
+            return 460800;
+        case ARDUINO_SERIAL_BAUD_500000:
+            return 500000;
+        case ARDUINO_SERIAL_BAUD_921600:
+            return 921600;
+        case ARDUINO_SERIAL_BAUD_1000000:
+            return 1000000;
+        case ARDUINO_SERIAL_BAUD_1500000:
+            return 1500000;
+        case ARDUINO_SERIAL_BAUD_2000000:
+            return 2000000;
+        default:
+            break;
+    }
+    return 0;
+}
+
+
+// Default hook policy: every hook is empty and inlined away. Own policies
+// derive from it and hide only the hooks they need.
+//
+// onTransition is called once per readBytes()/sync call that changed state,
+// with the states at its start and end (the whole-header fast path goes
+// from IDLE straight to READ_PAYLOAD).
+struct ArduinoSerialNoHooks
+{
+    void onTransition(ArduinoSerialProtocolState, ArduinoSerialProtocolState)
+    {}
+
+    void onPacket(ArduinoSerialProtocolID, const void*, size_t)
+    {}
+
+    void onError(ArduinoSerialProtocolState, ArduinoSerialReadResult)
+    {}
+};
+
+
+enum class ArduinoSerialChecksum : uint8_t
+{
+    CRC16,
+    CRC8
+};
+
+enum class ArduinoSerialFraming : uint8_t
+{
+    // frames found by their strobes
+    STROBES,
+    // every frame COBS encoded and ended by 0x00
+    COBS
+};
+
+// Wire format and hook policy of a protocol, fixed at compile time. Own
+// configs derive from it and hide only what they change; both ends of
+// a link have to use the same framing.
+//
+// Header is [STROBE_1][STROBE_2][ID][LEN][CRC-8][CHECKSUM], ID is
+// ID_SIZE bytes big endian, CHECKSUM covers header and payload.
+// Extended frame is [STROBE_1][EXTENDED_STROBE_2][ID][LEN 16 bit][CRC-8]
+// [CRC-32], used only for payloads over MAX_PAYLOAD_SIZE.
+// Short frame is [STROBE_1][SHORT_STROBE_2][ID low byte][LEN][CHECKSUM],
+// CHECKSUM covers full ID, LEN and payload. Receiver takes the ID
+// nearest to the last one it got, so IDs of consecutive packets have
+// to stay less than 128 apart. ID 0 always goes in a classic frame.
+//
+// Sync request and reply with parameters end in SYNC_STROBE_4_PARAMS
+// and SYNC_STROBE_REPLY_PARAMS, followed by [FEATURES][RATES][0][CRC-8].
+// RATES of a request are all rates offered, of a reply the one chosen.
+//
+// FRAMING COBS wraps each of these frames, sync ones too, in COBS with a
+// 0x00 delimiter (arduino_serial_cobs.h). Receiver decodes a frame into
+// the protocol before parsing it, so after any error the next frame
+// starts right after the next 0x00; payloads point into the protocol
+// and writeHeader() is not available.
+struct ArduinoSerialDefaultConfig
+{
+    using Hooks = ArduinoSerialNoHooks;
+
+    static constexpr const uint8_t STROBE_1 = 0xA5;
+    static constexpr const uint8_t STROBE_2 = 0x63;
+    static constexpr const uint8_t EXTENDED_STROBE_2 = 0x9C;
+    static constexpr const uint8_t SHORT_STROBE_2 = 0xC6;
+
+    static constexpr const uint8_t SYNC_STROBE_1 = 0xD3;
+    static constexpr const uint8_t SYNC_STROBE_2 = 0x74;
+    static constexpr const uint8_t SYNC_STROBE_3 = 0xE5;
+    static constexpr const uint8_t SYNC_STROBE_4 = 0x52;
+    static constexpr const uint8_t SYNC_STROBE_REPLY = 0x25;
+    static constexpr const uint8_t SYNC_STROBE_4_PARAMS = 0xAD;
+    static constexpr const uint8_t SYNC_STROBE_REPLY_PARAMS = 0xDA;
+
+    // 1 or 2, IDs wrap at 255 with 1 byte
+    static constexpr const size_t ID_SIZE = 2;
+    // up to 255
+    static constexpr const size_t MAX_PAYLOAD_SIZE = 255;
+    static constexpr const size_t SHORT_MAX_PAYLOAD_SIZE = 16;
+    static constexpr const ArduinoSerialChecksum CHECKSUM = ArduinoSerialChecksum::CRC16;
+    static constexpr const ArduinoSerialFraming FRAMING = ArduinoSerialFraming::STROBES;
+};
+
+// Config with own hook policy on top of another config
+template<typename HooksT, typename Base = ArduinoSerialDefaultConfig>
+struct ArduinoSerialHooksConfig : Base
+{
+    using Hooks = HooksT;
+};
+
+
+// Largest decoded COBS frame of Config, padding included; 0 for strobes
+template<typename Config>
+constexpr size_t arduino_serial_cobs_capacity()
+{
+    return Config::FRAMING != ArduinoSerialFraming::COBS ? 0
+           : ARDUINO_SERIAL_MAX_EXTENDED_PAYLOAD > Config::MAX_PAYLOAD_SIZE
+             ? (9 + Config::ID_SIZE + ARDUINO_SERIAL_MAX_EXTENDED_PAYLOAD) * 255 / 254 + 1
+             : (6 + Config::ID_SIZE + Config::MAX_PAYLOAD_SIZE) * 255 / 254 + 1;
+}
+
+
+// Counters, hooks and COBS decoder are private bases, so when empty they
+// take no space.
+//
+// Implementation lives in arduino_serial_protocol_impl.h, the library
+// instantiates only ArduinoSerialProtocol (default config); include the
+// impl header in one translation unit to instantiate other configs.
+template<typename Config = ArduinoSerialDefaultConfig>
+class ArduinoSerialProtocolT : private ArduinoSerialProtocolCounters,
+                               private Config::Hooks,
+                               private ArduinoSerialCobsDecoder<
+                                       arduino_serial_cobs_capacity<Config>()>
 {
 public:
-    static ArduinoSerialProtocol createSecondary();
+    using Hooks = typename Config::Hooks;
+
+    static constexpr const bool COBS_FRAMING =
+            Config::FRAMING == ArduinoSerialFraming::COBS;
+
+    static constexpr const size_t CHECKSUM_SIZE =
+            Config::CHECKSUM == ArduinoSerialChecksum::CRC16 ? 2 : 1;
+    static constexpr const size_t HEADER_SIZE = 4 + Config::ID_SIZE + CHECKSUM_SIZE;
+    static constexpr const size_t MAX_PAYLOAD_SIZE = Config::MAX_PAYLOAD_SIZE;
+    static constexpr const size_t EXTENDED_HEADER_SIZE = 2 + Config::ID_SIZE + 2 + 1 + 4;
+    static constexpr const size_t SHORT_HEADER_SIZE = 4 + CHECKSUM_SIZE;
+    static constexpr const size_t SYNC_PARAMS_SIZE = 4;
+    // buffer size for writeSyncHeader()/writeSyncReplyHeader()
+    static constexpr const size_t MAX_SYNC_HEADER_SIZE =
+            4 + SYNC_PARAMS_SIZE + (COBS_FRAMING ? 2 : 0);
+    // errors in a row that make an unconfirmed rate fall back to the
+    // initial one
+    static constexpr const uint8_t BAUD_ROLLBACK_ERRORS = 4;
 
-    ArduinoSerialProtocol(const ArduinoSerialProtocol&) = delete;
-    ArduinoSerialProtocol(ArduinoSerialProtocol&&) = default;
+    static_assert(Config::ID_SIZE == 1 || Config::ID_SIZE == 2,
+                  "ID_SIZE must be 1 or 2");
+    static_assert(Config::MAX_PAYLOAD_SIZE > 0 && Config::MAX_PAYLOAD_SIZE <= 255,
+                  "MAX_PAYLOAD_SIZE must fit the length byte");
+    static_assert(Config::STROBE_1 != Config::SYNC_STROBE_1,
+                  "packet and sync strobes must differ");
+    static_assert(Config::SHORT_MAX_PAYLOAD_SIZE <= Config::MAX_PAYLOAD_SIZE,
+                  "short frames can not be larger than classic ones");
+    static_assert(Config::STROBE_2 != Config::EXTENDED_STROBE_2
+                  && Config::STROBE_2 != Config::SHORT_STROBE_2
+                  && Config::EXTENDED_STROBE_2 != Config::SHORT_STROBE_2
+                  && Config::SYNC_STROBE_4 != Config::SYNC_STROBE_4_PARAMS
+                  && Config::SYNC_STROBE_REPLY != Config::SYNC_STROBE_REPLY_PARAMS,
+                  "parameter and extended strobes must differ from classic ones");
+    static_assert(ARDUINO_SERIAL_MAX_EXTENDED_PAYLOAD <= 0xFFFF,
+                  "extended payload length is 16 bit");
 
-    ~ArduinoSerialProtocol() = default;
+    static ArduinoSerialProtocolT createSecondary(const Hooks& hooks = Hooks{});
+
+    static ArduinoSerialProtocolT createPrimary(const Hooks& hooks = Hooks{});
+
+    ArduinoSerialProtocolT(const ArduinoSerialProtocolT&) = delete;
+    ArduinoSerialProtocolT(ArduinoSerialProtocolT&&) = default;
+
+    ~ArduinoSerialProtocolT() = default;
 
     size_t headerSize() const
-    { return 8; }
+    { return HEADER_SIZE; }
+
+    // Header of the frame writeHeader() uses for payload_size and id
+    size_t headerSize(size_t payload_size, ArduinoSerialProtocolID id) const;
+
+    // Same for data packets, any ID createNextPacketId() gives (all but 0;
+    // ID 0 never gets a short frame)
+    size_t dataHeaderSize(size_t payload_size) const
+    { return headerSize(payload_size, 1); }
 
     size_t syncHeaderSize() const
-    { return 4; }
+    { return framedSize(offersParams() ? 4 + SYNC_PARAMS_SIZE : 4); }
 
     size_t syncReplyHeaderSize() const
-    { return 4; }
+    { return framedSize(reply_params ? 4 + SYNC_PARAMS_SIZE : 4); }
 
+    // Size of a data packet, any ID createNextPacketId() gives; use the
+    // overload with ID for ID 0, which never gets a short frame
     size_t packetSize(size_t payload_size) const
-    { return headerSize() + payload_size; }
+    { return packetSize(payload_size, 1); }
+
+    size_t packetSize(size_t payload_size, ArduinoSerialProtocolID id) const
+    { return framedSize(headerSize(payload_size, id) + payload_size); }
+
+    // Largest payload writeHeader() accepts on this link right now
+    size_t maxPayloadSize() const;
+
+    // Features (ARDUINO_SERIAL_FEATURE_*) this side can use, from the
+    // next sync on. Primary offers them in every other sync request, so
+    // a peer that does not know parameters still answers the plain ones;
+    // secondary accepts what both sides support.
+    void setFeatures(uint8_t supported);
+
+    // Features agreed in the last sync handshake
+    uint8_t features() const
+    { return link_features; }
+
+    // Rates (ARDUINO_SERIAL_BAUD_*) this side can switch to, offered
+    // together with the features. Secondary picks the fastest rate both
+    // support.
+    void setBaudRates(uint8_t supported);
+
+    // Rate agreed in the last sync handshake, 0 for the rate the link was
+    // opened with. Switch the UART whenever it changes: primary right
+    // after the reply was read, secondary once the reply is completely
+    // out. Primary then syncs once more at the new rate, which confirms
+    // it, as does the first packet read at it. syncTimeout() or
+    // BAUD_ROLLBACK_ERRORS errors in a row before that go back to 0 and
+    // the rate is not offered again; later errors keep the rate.
+    uint32_t baudRate() const
+    { return arduino_serial_baud_rate(link_rate); }
 
     ArduinoSerialProtocolID createNextPacketId();
 
+    // Sync handshake completed and no new one is in progress
+    bool isSynced() const;
+
+    // Sync handshakes completed, wraps; changes whenever the peer may
+    // have started over with packet ID 1
+    uint8_t syncCount() const
+    { return sync_count; }
+
+    // ERROR_UNDEFINED with COBS framing, header can not be encoded apart
+    // from payload
     ArduinoSerialGeneralResult
     writeHeader(void* header, ArduinoSerialProtocolID id,
                 const void* payload, size_t payload_size) const;
 
+    // Writes header followed by a copy of payload (packetSize(payload_size,
+    // id) bytes), checksum is computed while copying
+    ArduinoSerialGeneralResult
+    writePacket(void* packet, ArduinoSerialProtocolID id,
+                const void* payload, size_t payload_size) const;
+
+    // Result writePacket() gives for payload_size with any valid ID, lets
+    // callers check before they take one from createNextPacketId()
+    ArduinoSerialGeneralResult checkWrite(size_t payload_size) const;
+
+    // Space writePackets() needs for all payloads
+    size_t batchSize(const ArduinoSerialPayload* payloads, size_t count) const;
+
+    // Frames payloads back to back into buffer with consecutive IDs from
+    // createNextPacketId(). Stops at the first packet that does not fit
+    // (ERROR_BUFFER_TOO_SMALL) or is too big; IDs are used only by
+    // packets actually written.
+    ArduinoSerialBatchResult
+    writePackets(void* buffer, size_t buffer_size,
+                 const ArduinoSerialPayload* payloads, size_t count);
+
+#ifndef ARDUINO
+    // Writes header and fills iov[0] with header, iov[1] with unchanged
+    // payload, ready for writev()
+    ArduinoSerialGeneralResult
+    writeHeaderIov(void* header, struct iovec* iov, ArduinoSerialProtocolID id,
+                   const void* payload, size_t payload_size) const;
+#endif
+
+    ArduinoSerialGeneralResult writeSyncHeader(void* header) const;
+
+    ArduinoSerialGeneralResult syncSent();
+
+    // Primary only: sync reply did not arrive in time, SEND_SYNC again.
+    // Packets written while sync was in flight should be sent again after
+    // the new sync request. Unconfirmed rate (see baudRate()) is dropped.
+    ArduinoSerialGeneralResult syncTimeout();
+
     ArduinoSerialGeneralResult writeSyncReplyHeader(void* header) const;
 
     ArduinoSerialGeneralResult syncReplySent();
@@ -81,23 +445,134 @@ public:
 
     ArduinoSerialReceiveResult readBytes(const void* data, size_t data_size);
 
+#if ARDUINO_SERIAL_STATS
+    // Safe to call from any thread while another one decodes
+    ArduinoSerialProtocolStats stats() const
+    { return snapshot(); }
+#endif
+
+#if ARDUINO_SERIAL_LATENCY
+    // Arrival time (arduino_serial_now_ticks()) of the bytes passed to the
+    // following readBytes() calls, reported by the transport after each read
+    void dataArrived(uint64_t ticks)
+    { arrival_ticks = ticks; }
+
+    // Time from arrival of the bytes holding STROBE_1 to payload CRC
+    // validated, empty until dataArrived() is called
+    const ArduinoSerialLatencyHistogram& latency() const
+    { return latency_histogram; }
+#endif
+
+    Hooks& hooks()
+    { return *this; }
+
+    const Hooks& hooks() const
+    { return *this; }
+
 public:
-    struct PayloadState
-    {
-        size_t payload_len;
-        uint16_t packet_id;
-        uint16_t crc16;
-        uint16_t crc16_header;
-    };
+    using PayloadState = ArduinoSerialPayloadState;
 
 private:
-    explicit ArduinoSerialProtocol();
+    using State = ArduinoSerialProtocolState;
+    using CobsDecoder = ArduinoSerialCobsDecoder<arduino_serial_cobs_capacity<Config>()>;
+
+    static size_t framedSize(size_t size)
+    { return COBS_FRAMING ? arduino_serial_cobs_size(size) : size; }
+
+    // where raw frame of size bytes is written before it is encoded
+    static size_t frameOffset(size_t size)
+    { return COBS_FRAMING ? arduino_serial_cobs_offset(size) : 0; }
+
+    static void encodeFrame(uint8_t* data, size_t size)
+    {
+        if (COBS_FRAMING)
+            arduino_serial_cobs_encode(data, data + frameOffset(size), size);
+    }
+
+    CobsDecoder& cobs()
+    { return *this; }
+
+    ArduinoSerialProtocolT(bool primary, const Hooks& hooks);
+
+    State getState() const
+    { return static_cast<State>(state); }
+
+    void setState(State value)
+    {
+        const State previous = getState();
+        state = static_cast<char>(value);
+        if (previous != value)
+            hooks().onTransition(previous, value);
+    }
+
+    ArduinoSerialReceiveResult readState(const void* data, size_t data_size);
+
+    // Header state second strobe leads to, IDLE if it starts no frame
+    // this link reads
+    State headerStateFor(uint8_t strobe_2) const;
+
+    // Rest of header after both strobes, for any of the header states
+    ArduinoSerialReceiveResult readHeader(State header_state,
+                                          const void* data, size_t data_size);
+
+    ArduinoSerialReceiveResult readSyncParams(const void* data, size_t data_size);
+
+    ArduinoSerialReceiveResult readCobs(const void* data, size_t data_size);
+
+    bool offersParams() const
+    { return (supported_features != 0 || offeredRates() != 0) && !classic_sync; }
+
+    uint8_t offeredRates() const
+    { return static_cast<uint8_t>(baud_rates & ~failed_rates); }
+
+    ArduinoSerialFrame frameFor(size_t payload_size, ArduinoSerialProtocolID id) const;
+
+    void completeSync(uint8_t features, uint8_t rate);
+
+    void checkBaud(State before, bool scanning, const ArduinoSerialReceiveResult& result);
+
+    void rollbackBaud();
 
     char state;
     bool was_synced : 1;
     bool scan_strobe : 1;
+    bool is_primary : 1;
+    bool sync_pending : 1;
+    // secondary: request had parameters, reply gets them too
+    bool reply_params : 1;
+    // primary: this sync request goes without parameters
+    bool classic_sync : 1;
+    // valid frame arrived since link_rate was agreed
+    bool baud_confirmed : 1;
+    // primary: next sync request repeats one that got no reply
+    bool sync_retry : 1;
     uint16_t seq_id;
+    uint8_t sync_count;
+
+    uint8_t supported_features;
+    uint8_t link_features;
+    // secondary: agreed in request, active once reply is sent
+    uint8_t pending_features;
+    uint8_t baud_rates;
+    // rates rolled back from, not offered again
+    uint8_t failed_rates;
+    uint8_t link_rate;
+    // secondary: agreed in request, active once reply is sent
+    uint8_t pending_rate;
+    uint8_t baud_errors;
+    // last data packet ID received, short frame IDs are expanded around it
+    ArduinoSerialProtocolID last_id;
 
     PayloadState payload_state;
 
-}; // class ArduinoSerialProtocol
+#if ARDUINO_SERIAL_LATENCY
+    uint64_t arrival_ticks;
+    uint64_t frame_start_ticks;
+    ArduinoSerialLatencyHistogram latency_histogram;
+#endif
+
+}; // class ArduinoSerialProtocolT
+
+using ArduinoSerialProtocol = ArduinoSerialProtocolT<>;
+
+extern template class ArduinoSerialProtocolT<ArduinoSerialDefaultConfig>;
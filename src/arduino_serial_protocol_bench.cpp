@@ -0,0 +1,322 @@
+#include "benchmark/benchmark.h"
+
+#include "arduino_serial_crc.h"
+#include "arduino_serial_protocol.h"
+#include "arduino_serial_stream_decoder.h"
+
+#include <algorithm>
+#include <memory.h>
+#include <vector>
+
+
+namespace
+{
+
+const uint8_t SYNC_STROBE[] = {0xD3, 0x74, 0xE5, 0x52};
+
+// Sync request from a primary offering features
+void sync(ArduinoSerialProtocol& protocol, uint8_t features = 0)
+{
+    auto primary = ArduinoSerialProtocol::createPrimary();
+    primary.setFeatures(features);
+    std::vector<uint8_t> request(primary.syncHeaderSize());
+    primary.writeSyncHeader(request.data());
+
+    protocol.setFeatures(features);
+    for (size_t offset = 0; offset < request.size();)
+        offset += protocol.readBytes(request.data() + offset,
+                                     request.size() - offset).bytes_read;
+    protocol.syncReplySent();
+}
+
+std::vector<uint8_t> make_stream(size_t packets, size_t payload_size,
+                                 uint8_t features = 0)
+{
+    auto protocol = ArduinoSerialProtocol::createSecondary();
+    sync(protocol, features);
+
+    std::vector<uint8_t> stream;
+    std::vector<uint8_t> payload(payload_size);
+    for (size_t i = 0; i < packets; ++i)
+    {
+        for (size_t j = 0; j < payload_size; ++j)
+            payload[j] = static_cast<uint8_t>(i + j);
+
+        const size_t offset = stream.size();
+        stream.resize(offset + protocol.packetSize(payload_size));
+        protocol.writeHeader(stream.data() + offset, protocol.createNextPacketId(),
+                             payload.data(), payload_size);
+        memcpy(stream.data() + offset + protocol.dataHeaderSize(payload_size),
+               payload.data(), payload_size);
+    }
+    return stream;
+}
+
+void set_counters(benchmark::State& state, size_t packets, size_t bytes)
+{
+    state.SetItemsProcessed(state.iterations() * packets);
+    state.SetBytesProcessed(state.iterations() * bytes);
+}
+
+// Deterministic noise that never contains STROBE_1, so every garbage
+// byte is really skipped rather than starting a false header
+std::vector<uint8_t> make_garbage(size_t size)
+{
+    std::vector<uint8_t> garbage(size);
+    uint32_t seed = 0x12345678;
+    for (size_t i = 0; i < size; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        garbage[i] = static_cast<uint8_t>(seed >> 16);
+        if (garbage[i] == 0xA5)
+            garbage[i] = 0x5A;
+    }
+    return garbage;
+}
+
+void count_packet(void* context, ArduinoSerialProtocolID, const void*, size_t)
+{
+    ++*static_cast<size_t*>(context);
+}
+
+}
+
+
+static void BM_WriteHeader(benchmark::State& state)
+{
+    const size_t payload_size = state.range(0);
+    auto protocol = ArduinoSerialProtocol::createSecondary();
+    sync(protocol);
+    std::vector<uint8_t> payload(payload_size, 0x5A);
+    uint8_t header[8];
+
+    for (auto _ : state)
+    {
+        protocol.writeHeader(header, 1, payload.data(), payload_size);
+        benchmark::DoNotOptimize(header);
+        benchmark::ClobberMemory();
+    }
+    set_counters(state, 1, protocol.packetSize(payload_size));
+}
+BENCHMARK(BM_WriteHeader)->Arg(0)->Arg(16)->Arg(64)->Arg(255);
+
+// Feeds exactly nextOperation().bytes_to_read on every step
+static void BM_DecodeStepwise(benchmark::State& state)
+{
+    const size_t packets = 64;
+    const auto stream = make_stream(packets, state.range(0));
+    auto protocol = ArduinoSerialProtocol::createSecondary();
+    sync(protocol);
+
+    for (auto _ : state)
+    {
+        size_t offset = 0;
+        while (offset < stream.size())
+        {
+            const auto operation = protocol.nextOperation();
+            const auto result = protocol.readBytes(stream.data() + offset,
+                                                   operation.bytes_to_read);
+            offset += result.bytes_read;
+        }
+        benchmark::DoNotOptimize(offset);
+    }
+    set_counters(state, packets, stream.size());
+}
+BENCHMARK(BM_DecodeStepwise)->Arg(2)->Arg(6)->Arg(16);
+
+// Hands the whole rest of buffer to readBytes, taking the header fast path
+static void BM_DecodeWholeHeader(benchmark::State& state)
+{
+    const size_t packets = 64;
+    const auto stream = make_stream(packets, state.range(0));
+    auto protocol = ArduinoSerialProtocol::createSecondary();
+    sync(protocol);
+
+    for (auto _ : state)
+    {
+        size_t offset = 0;
+        while (offset < stream.size())
+        {
+            const auto result = protocol.readBytes(stream.data() + offset,
+                                                   stream.size() - offset);
+            offset += result.bytes_read;
+        }
+        benchmark::DoNotOptimize(offset);
+    }
+    set_counters(state, packets, stream.size());
+}
+BENCHMARK(BM_DecodeWholeHeader)->Arg(2)->Arg(6)->Arg(16);
+
+// Stream decoder fed in chunks of range(1) bytes, 1 being a UART that
+// hands over every byte as it arrives
+static void BM_DecodeChunked(benchmark::State& state)
+{
+    const size_t packets = 64;
+    const auto stream = make_stream(packets, state.range(0));
+    const size_t chunk = state.range(1) > 0 ? state.range(1) : stream.size();
+    auto protocol = ArduinoSerialProtocol::createSecondary();
+    sync(protocol);
+    ArduinoSerialStreamDecoder decoder{protocol};
+    size_t received = 0;
+
+    for (auto _ : state)
+    {
+        for (size_t offset = 0; offset < stream.size(); offset += chunk)
+        {
+            decoder.decode(stream.data() + offset,
+                           std::min(chunk, stream.size() - offset),
+                           &count_packet, &received);
+        }
+        benchmark::DoNotOptimize(received);
+    }
+    set_counters(state, packets, stream.size());
+}
+BENCHMARK(BM_DecodeChunked)
+        ->Args({16, 1})->Args({16, 0})
+        ->Args({64, 1})->Args({64, 0})
+        ->Args({255, 1})->Args({255, 0});
+
+// Small packets with classic (range(1) 0) or short header; goodput is
+// payload bytes per second a 115200 baud 8N1 link would carry
+static void BM_SmallPacketGoodput(benchmark::State& state)
+{
+    const size_t packets = 64;
+    const uint8_t features = state.range(1) != 0 ? ARDUINO_SERIAL_FEATURE_SHORT_FRAMES : 0;
+    const auto stream = make_stream(packets, state.range(0), features);
+    auto protocol = ArduinoSerialProtocol::createSecondary();
+    sync(protocol, features);
+    ArduinoSerialStreamDecoder decoder{protocol};
+    size_t received = 0;
+
+    for (auto _ : state)
+    {
+        decoder.decode(stream.data(), stream.size(), &count_packet, &received);
+        benchmark::DoNotOptimize(received);
+    }
+    set_counters(state, packets, stream.size());
+    state.counters["goodput_115200"] =
+            11520.0 * packets * state.range(0) / stream.size();
+}
+BENCHMARK(BM_SmallPacketGoodput)
+        ->Args({2, 0})->Args({2, 1})
+        ->Args({6, 0})->Args({6, 1});
+
+// What calculate_crc16_payload runs for a payload of range(0) bytes
+static void BM_Crc16Payload(benchmark::State& state)
+{
+    const size_t size = state.range(0);
+    std::vector<uint8_t> data = make_garbage(size);
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(arduino_serial_crc16(0xFFFF, data.data(), size));
+    set_counters(state, 1, size);
+}
+BENCHMARK(BM_Crc16Payload)->Arg(16)->Arg(64)->Arg(255);
+
+template<uint16_t (*Crc16)(uint16_t, const void*, size_t)>
+void crc16_kernel(benchmark::State& state)
+{
+    const size_t size = state.range(0);
+    std::vector<uint8_t> data = make_garbage(size);
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(Crc16(0xFFFF, data.data(), size));
+    set_counters(state, 1, size);
+}
+BENCHMARK_TEMPLATE(crc16_kernel, arduino_serial_crc16_bitwise)->Arg(255);
+BENCHMARK_TEMPLATE(crc16_kernel, arduino_serial_crc16_table)->Arg(255);
+BENCHMARK_TEMPLATE(crc16_kernel, arduino_serial_crc16_slice4)->Arg(255);
+BENCHMARK_TEMPLATE(crc16_kernel, arduino_serial_crc16_slice8)->Arg(255);
+
+// Full primary/secondary sync exchange over in-memory buffers
+static void BM_SyncHandshake(benchmark::State& state)
+{
+    uint8_t request[ArduinoSerialProtocol::MAX_SYNC_HEADER_SIZE];
+    uint8_t reply[ArduinoSerialProtocol::MAX_SYNC_HEADER_SIZE];
+    size_t request_size = 0;
+    size_t reply_size = 0;
+
+    for (auto _ : state)
+    {
+        auto primary = ArduinoSerialProtocol::createPrimary();
+        auto secondary = ArduinoSerialProtocol::createSecondary();
+
+        request_size = primary.syncHeaderSize();
+        primary.writeSyncHeader(request);
+        primary.syncSent();
+        for (size_t offset = 0; offset < request_size;)
+            offset += secondary.readBytes(request + offset, request_size - offset).bytes_read;
+
+        reply_size = secondary.syncReplyHeaderSize();
+        secondary.writeSyncReplyHeader(reply);
+        secondary.syncReplySent();
+        for (size_t offset = 0; offset < reply_size;)
+            offset += primary.readBytes(reply + offset, reply_size - offset).bytes_read;
+
+        benchmark::DoNotOptimize(primary.isSynced());
+    }
+    set_counters(state, 1, request_size + reply_size);
+}
+BENCHMARK(BM_SyncHandshake);
+
+// range(0) bytes of line noise in front of 16 packets, time to get back
+// in step is the difference to the 0 garbage case
+static void BM_ResyncAfterGarbage(benchmark::State& state)
+{
+    const size_t packets = 16;
+    std::vector<uint8_t> stream = make_garbage(state.range(0));
+    const auto valid = make_stream(packets, 16);
+    stream.insert(stream.end(), valid.begin(), valid.end());
+    auto protocol = ArduinoSerialProtocol::createSecondary();
+    sync(protocol);
+    ArduinoSerialStreamDecoder decoder{protocol};
+    size_t received = 0;
+
+    for (auto _ : state)
+    {
+        decoder.decode(stream.data(), stream.size(), &count_packet, &received);
+        benchmark::DoNotOptimize(received);
+    }
+    if (received != packets * state.iterations())
+        state.SkipWithError("packets lost after garbage");
+    set_counters(state, packets, stream.size());
+}
+BENCHMARK(BM_ResyncAfterGarbage)->Arg(0)->Arg(16)->Arg(256)->Arg(4096);
+
+// writeHeader reads payload for CRC, then payload is copied behind it
+static void BM_EncodeHeaderThenCopy(benchmark::State& state)
+{
+    const size_t payload_size = state.range(0);
+    auto protocol = ArduinoSerialProtocol::createSecondary();
+    sync(protocol);
+    std::vector<uint8_t> payload(payload_size, 0x5A);
+    std::vector<uint8_t> packet(protocol.packetSize(payload_size));
+
+    for (auto _ : state)
+    {
+        protocol.writeHeader(packet.data(), 1, payload.data(), payload_size);
+        memcpy(packet.data() + protocol.headerSize(), payload.data(), payload_size);
+        benchmark::DoNotOptimize(packet.data());
+        benchmark::ClobberMemory();
+    }
+    set_counters(state, 1, packet.size());
+}
+BENCHMARK(BM_EncodeHeaderThenCopy)->Arg(16)->Arg(64)->Arg(255);
+
+static void BM_EncodeFused(benchmark::State& state)
+{
+    const size_t payload_size = state.range(0);
+    auto protocol = ArduinoSerialProtocol::createSecondary();
+    sync(protocol);
+    std::vector<uint8_t> payload(payload_size, 0x5A);
+    std::vector<uint8_t> packet(protocol.packetSize(payload_size));
+
+    for (auto _ : state)
+    {
+        protocol.writePacket(packet.data(), 1, payload.data(), payload_size);
+        benchmark::DoNotOptimize(packet.data());
+        benchmark::ClobberMemory();
+    }
+    set_counters(state, 1, packet.size());
+}
+BENCHMARK(BM_EncodeFused)->Arg(16)->Arg(64)->Arg(255);
@@ -0,0 +1,1380 @@
+#pragma once
+
+// Template implementation of ArduinoSerialProtocolT, include only where
+// a protocol with own config is instantiated.
+
+#include "arduino_serial_protocol.h"
+#include "arduino_serial_crc.h"
+#include "arduino_serial_strobe_scan.h"
+
+#include <string.h>
+
+
+namespace arduino_serial_detail
+{
+
+using State = ArduinoSerialProtocolState;
+
+constexpr const size_t HEADER_PAYLOAD_LEN_SIZE = 1;
+
+
+inline void clear(ArduinoSerialPayloadState& payload_state)
+{
+    payload_state.payload_len = 0;
+    payload_state.packet_id = 0;
+    payload_state.frame = ArduinoSerialFrame::CLASSIC;
+    payload_state.checksum = 0;
+    payload_state.checksum_header = 0xFFFF;
+}
+
+inline State get_state(char state)
+{
+    return static_cast<State>(state);
+}
+
+inline void set_state(char& state, State value)
+{
+    state = static_cast<char>(value);
+}
+
+// Big endian wire order, size is a compile time constant at every call
+inline void write_be(uint8_t* data, uint32_t value, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+        data[i] = static_cast<uint8_t>(value >> (8 * (size - 1 - i)));
+}
+
+inline uint32_t read_be(const uint8_t* data, size_t size)
+{
+    uint32_t result = 0;
+    for (size_t i = 0; i < size; ++i)
+        result = (result << 8) | data[i];
+    return result;
+}
+
+// Header starting after strobes: ID, LEN, CRC-8, checksum
+template<typename Config>
+struct Layout
+{
+    static constexpr const size_t LEN = Config::ID_SIZE;
+    static constexpr const size_t CRC8 = LEN + HEADER_PAYLOAD_LEN_SIZE;
+    static constexpr const size_t CHECKSUM = CRC8 + 1;
+    static constexpr const size_t CHECKSUM_SIZE =
+            ArduinoSerialProtocolT<Config>::CHECKSUM_SIZE;
+    static constexpr const size_t SIZE = CHECKSUM + CHECKSUM_SIZE;
+    static constexpr const bool CRC16 =
+            Config::CHECKSUM == ArduinoSerialChecksum::CRC16;
+};
+
+// Extended header starting after strobes: ID, 16 bit LEN, CRC-8, CRC-32
+template<typename Config>
+struct ExtendedLayout
+{
+    static constexpr const size_t LEN = Config::ID_SIZE;
+    static constexpr const size_t CRC8 = LEN + 2;
+    static constexpr const size_t CHECKSUM = CRC8 + 1;
+    static constexpr const size_t SIZE = CHECKSUM + 4;
+};
+
+// Short header starting after strobes: low byte of ID, LEN, checksum
+template<typename Config>
+struct ShortLayout
+{
+    static constexpr const size_t LEN = 1;
+    static constexpr const size_t CHECKSUM = LEN + 1;
+    static constexpr const size_t SIZE = CHECKSUM + Layout<Config>::CHECKSUM_SIZE;
+};
+
+template<typename Config>
+uint8_t calculate_crc8(const void* header)
+{
+    return arduino_serial_crc8(0, header, Layout<Config>::CRC8);
+}
+
+// Checksum seeded with ID, LEN and CRC-8
+template<typename Config>
+uint16_t calculate_crc16_header(const void* header)
+{
+    if (Layout<Config>::CRC16)
+        return arduino_serial_crc16(0xFFFF, header, Layout<Config>::CHECKSUM);
+    return arduino_serial_crc8(0, header, Layout<Config>::CHECKSUM);
+}
+
+template<typename Config>
+uint16_t calculate_crc16_payload(
+        uint16_t crc16, const void* payload, size_t payload_size)
+{
+    if (Layout<Config>::CRC16)
+        return arduino_serial_crc16(crc16, payload, payload_size);
+    return arduino_serial_crc8(static_cast<uint8_t>(crc16), payload, payload_size);
+}
+
+template<typename Config>
+uint16_t copy_crc16_payload(uint16_t crc16, void* destination,
+                            const void* payload, size_t payload_size)
+{
+    if (Layout<Config>::CRC16)
+        return arduino_serial_crc16_copy(crc16, destination, payload, payload_size);
+    memcpy(destination, payload, payload_size);
+    return calculate_crc16_payload<Config>(crc16, destination, payload_size);
+}
+
+inline ArduinoSerialGeneralResult
+check_write(char state, size_t payload_size, size_t max_payload_size)
+{
+    if (get_state(state) == State::UNDEFINED)
+        return ArduinoSerialGeneralResult::ERROR_UNDEFINED;
+
+    if (get_state(state) == State::WAITING_SYNC
+        || get_state(state) == State::SENDING_SYNC)
+        return ArduinoSerialGeneralResult::ERROR_NOT_SYNCED;
+
+    if (payload_size > max_payload_size)
+        return ArduinoSerialGeneralResult::ERROR_PAYLOAD_SIZE_TOO_BIG;
+
+    return ArduinoSerialGeneralResult::OK;
+}
+
+// Writes everything up to checksum, returns checksum seeded with header
+template<typename Config>
+uint16_t write_header_fields(uint8_t* data, ArduinoSerialProtocolID id,
+                             size_t payload_size)
+{
+    static_assert(HEADER_PAYLOAD_LEN_SIZE == 1,
+                  "Payload length size unexpected");
+
+    data[0] = Config::STROBE_1;
+    data[1] = Config::STROBE_2;
+    write_be(data + 2, id, Config::ID_SIZE);
+    data[2 + Layout<Config>::LEN] = static_cast<uint8_t>(payload_size);
+    data[2 + Layout<Config>::CRC8] = calculate_crc8<Config>(data + 2);
+    return calculate_crc16_header<Config>(data + 2);
+}
+
+template<typename Config>
+void write_header_crc16(uint8_t* data, uint16_t crc16)
+{
+    write_be(data + 2 + Layout<Config>::CHECKSUM, crc16, Layout<Config>::CHECKSUM_SIZE);
+}
+
+// Extended frame: CRC-32 seeded with ID, LEN and CRC-8
+template<typename Config>
+uint32_t write_extended_header_fields(uint8_t* data, ArduinoSerialProtocolID id,
+                                      size_t payload_size)
+{
+    typedef ExtendedLayout<Config> L;
+
+    data[0] = Config::STROBE_1;
+    data[1] = Config::EXTENDED_STROBE_2;
+    write_be(data + 2, id, Config::ID_SIZE);
+    write_be(data + 2 + L::LEN, static_cast<uint32_t>(payload_size), 2);
+    data[2 + L::CRC8] = arduino_serial_crc8(0, data + 2, L::CRC8);
+    return arduino_serial_crc32(0xFFFFFFFF, data + 2, L::CHECKSUM);
+}
+
+// Short frame checksum is seeded with the full ID, which is not sent
+template<typename Config>
+uint16_t short_header_seed(ArduinoSerialProtocolID id, size_t payload_size)
+{
+    uint8_t fields[Config::ID_SIZE + 1];
+    write_be(fields, id, Config::ID_SIZE);
+    fields[Config::ID_SIZE] = static_cast<uint8_t>(payload_size);
+    if (Layout<Config>::CRC16)
+        return arduino_serial_crc16(0xFFFF, fields, sizeof(fields));
+    return arduino_serial_crc8(0, fields, sizeof(fields));
+}
+
+template<typename Config>
+uint16_t write_short_header_fields(uint8_t* data, ArduinoSerialProtocolID id,
+                                   size_t payload_size)
+{
+    data[0] = Config::STROBE_1;
+    data[1] = Config::SHORT_STROBE_2;
+    data[2] = static_cast<uint8_t>(id);
+    data[2 + ShortLayout<Config>::LEN] = static_cast<uint8_t>(payload_size);
+    return short_header_seed<Config>(id, payload_size);
+}
+
+// Header up to checksum, returns checksum seeded with it
+template<typename Config>
+uint32_t write_frame_fields(ArduinoSerialFrame frame, uint8_t* data,
+                            ArduinoSerialProtocolID id, size_t payload_size)
+{
+    switch (frame)
+    {
+        case ArduinoSerialFrame::EXTENDED:
+            return write_extended_header_fields<Config>(data, id, payload_size);
+        case ArduinoSerialFrame::SHORT:
+            return write_short_header_fields<Config>(data, id, payload_size);
+        default:
+            break;
+    }
+    return write_header_fields<Config>(data, id, payload_size);
+}
+
+template<typename Config>
+uint32_t frame_checksum(ArduinoSerialFrame frame, uint32_t checksum,
+                        const void* payload, size_t payload_size)
+{
+    if (frame == ArduinoSerialFrame::EXTENDED)
+        return arduino_serial_crc32(checksum, payload, payload_size);
+    return calculate_crc16_payload<Config>(
+            static_cast<uint16_t>(checksum), payload, payload_size);
+}
+
+template<typename Config>
+uint32_t copy_frame_checksum(ArduinoSerialFrame frame, uint32_t checksum,
+                             void* destination, const void* payload,
+                             size_t payload_size)
+{
+    if (frame == ArduinoSerialFrame::EXTENDED)
+    {
+        memcpy(destination, payload, payload_size);
+        return arduino_serial_crc32(checksum, destination, payload_size);
+    }
+    return copy_crc16_payload<Config>(
+            static_cast<uint16_t>(checksum), destination, payload, payload_size);
+}
+
+template<typename Config>
+void write_frame_checksum(ArduinoSerialFrame frame, uint8_t* data, uint32_t checksum)
+{
+    switch (frame)
+    {
+        case ArduinoSerialFrame::EXTENDED:
+            write_be(data + 2 + ExtendedLayout<Config>::CHECKSUM, checksum, 4);
+            break;
+        case ArduinoSerialFrame::SHORT:
+            write_be(data + 2 + ShortLayout<Config>::CHECKSUM, checksum,
+                     Layout<Config>::CHECKSUM_SIZE);
+            break;
+        default:
+            write_header_crc16<Config>(data, static_cast<uint16_t>(checksum));
+            break;
+    }
+}
+
+// [FEATURES][RATES][0][CRC-8], the zero byte is reserved
+inline void write_sync_params(uint8_t* data, uint8_t features, uint8_t rates,
+                              size_t size)
+{
+    data[0] = features;
+    data[1] = rates;
+    for (size_t i = 2; i + 1 < size; ++i)
+        data[i] = 0;
+    data[size - 1] = arduino_serial_crc8(0, data, size - 1);
+}
+
+// Fastest of the rates, 0 for none
+inline uint8_t highest_rate(uint8_t rates)
+{
+    uint8_t result = 0x80;
+    while (result != 0 && (rates & result) == 0)
+        result >>= 1;
+    return result;
+}
+
+inline ArduinoSerialReceiveResult
+receive_result(ArduinoSerialReadResult read_result, size_t bytes_read)
+{
+    ArduinoSerialReceiveResult result;
+    result.read_result = read_result;
+    result.bytes_read = bytes_read;
+    result.payload = nullptr;
+    result.payload_size = 0;
+    result.packet_id = 0;
+    return result;
+}
+
+inline ArduinoSerialReceiveResult
+payload_result(const void* payload, size_t payload_size,
+               ArduinoSerialProtocolID packet_id)
+{
+    ArduinoSerialReceiveResult result =
+            receive_result(ArduinoSerialReadResult::OK, payload_size);
+    result.payload = payload;
+    result.payload_size = payload_size;
+    result.packet_id = packet_id;
+    return result;
+}
+
+inline ArduinoSerialNextOperation
+next_operation(ArduinoSerialOperation operation, size_t bytes_to_read,
+               ArduinoSerialProtocolID id = 0)
+{
+    ArduinoSerialNextOperation result;
+    result.read_operation = operation;
+    result.bytes_to_read = bytes_to_read;
+    result.id = id;
+    return result;
+}
+
+inline ArduinoSerialReceiveResult
+read_strobe(char& state, const void* _data, const size_t data_size,
+           const uint8_t value, const State new_state, const State initial_state)
+{
+    if (data_size < 1)
+        return receive_result(
+                ArduinoSerialReadResult::ERROR_INSUFFICIENT_DATA_LENGTH, 0);
+
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    if (data[0] != value)
+    {
+        set_state(state, initial_state);
+
+        return receive_result(
+                ArduinoSerialReadResult::ERROR_UNEXPECTED_DATA, 1);
+    }
+
+    set_state(state, new_state);
+
+    return receive_result(ArduinoSerialReadResult::OK, 1);
+}
+
+template<typename Config>
+ArduinoSerialReceiveResult
+read_strobe_or_sync(char& state, const void* _data, const size_t data_size,
+                    const State sync_state)
+{
+    if (data_size < 1)
+        return receive_result(
+                ArduinoSerialReadResult::ERROR_INSUFFICIENT_DATA_LENGTH, 0);
+
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    if (data[0] != Config::STROBE_1 && data[0] != Config::SYNC_STROBE_1)
+    {
+        set_state(state, State::IDLE);
+
+        return receive_result(
+                ArduinoSerialReadResult::ERROR_UNEXPECTED_DATA, 1);
+    }
+
+    if (data[0] == Config::STROBE_1)
+        set_state(state, State::READ_STROBE_2);
+    else
+        set_state(state, sync_state);
+
+    return receive_result(ArduinoSerialReadResult::OK, 1);
+}
+
+template<typename Config>
+ArduinoSerialReceiveResult
+read_header(char& state, ArduinoSerialPayloadState& payload_state,
+           const void* _data, const size_t data_size)
+{
+    typedef Layout<Config> L;
+
+    if (data_size < L::SIZE)
+        return receive_result(
+                ArduinoSerialReadResult::ERROR_INSUFFICIENT_DATA_LENGTH, 0);
+
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    const uint8_t crc8 = calculate_crc8<Config>(data);
+    // length over the configured maximum can only be a corrupted header
+    // (or a peer with other config), handled as one
+    if (crc8 != data[L::CRC8]
+        || (Config::MAX_PAYLOAD_SIZE < 255 && data[L::LEN] > Config::MAX_PAYLOAD_SIZE))
+    {
+        set_state(state, State::IDLE);
+
+        return receive_result(ArduinoSerialReadResult::ERROR_CHECKSUM, L::CHECKSUM);
+    }
+
+    payload_state.payload_len = data[L::LEN];
+    payload_state.packet_id = static_cast<uint16_t>(read_be(data, Config::ID_SIZE));
+    payload_state.frame = ArduinoSerialFrame::CLASSIC;
+    payload_state.checksum = read_be(data + L::CHECKSUM, L::CHECKSUM_SIZE);
+    payload_state.checksum_header = calculate_crc16_header<Config>(data);
+
+    set_state(state, State::READ_PAYLOAD);
+
+    return receive_result(ArduinoSerialReadResult::OK, L::SIZE);
+}
+
+template<typename Config>
+ArduinoSerialReceiveResult
+read_extended_header(char& state, ArduinoSerialPayloadState& payload_state,
+                     const void* _data, const size_t data_size)
+{
+    typedef ExtendedLayout<Config> L;
+
+    if (data_size < L::SIZE)
+        return receive_result(
+                ArduinoSerialReadResult::ERROR_INSUFFICIENT_DATA_LENGTH, 0);
+
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    const size_t payload_len = read_be(data + L::LEN, 2);
+    if (arduino_serial_crc8(0, data, L::CRC8) != data[L::CRC8]
+        || payload_len <= Config::MAX_PAYLOAD_SIZE
+        || payload_len > ARDUINO_SERIAL_MAX_EXTENDED_PAYLOAD)
+    {
+        set_state(state, State::IDLE);
+
+        return receive_result(ArduinoSerialReadResult::ERROR_CHECKSUM, L::CHECKSUM);
+    }
+
+    payload_state.payload_len = payload_len;
+    payload_state.packet_id = static_cast<uint16_t>(read_be(data, Config::ID_SIZE));
+    payload_state.frame = ArduinoSerialFrame::EXTENDED;
+    payload_state.checksum = read_be(data + L::CHECKSUM, 4);
+    payload_state.checksum_header = arduino_serial_crc32(0xFFFFFFFF, data, L::CHECKSUM);
+
+    set_state(state, State::READ_PAYLOAD);
+
+    return receive_result(ArduinoSerialReadResult::OK, L::SIZE);
+}
+
+// ID with the given low byte nearest to reference
+template<typename Config>
+ArduinoSerialProtocolID expand_id(ArduinoSerialProtocolID reference, uint8_t low)
+{
+    if (Config::ID_SIZE == 1)
+        return low;
+
+    ArduinoSerialProtocolID id = static_cast<ArduinoSerialProtocolID>((reference & 0xFF00) | low);
+    const uint16_t delta = static_cast<uint16_t>(id - reference);
+    if (delta >= 0x80 && delta < 0x8000)
+        id = static_cast<ArduinoSerialProtocolID>(id - 0x100);
+    else if (delta >= 0x8000 && delta < 0xFF80)
+        id = static_cast<ArduinoSerialProtocolID>(id + 0x100);
+    return id;
+}
+
+template<typename Config>
+ArduinoSerialReceiveResult
+read_short_header(char& state, ArduinoSerialPayloadState& payload_state,
+                  ArduinoSerialProtocolID last_id,
+                  const void* _data, const size_t data_size)
+{
+    typedef ShortLayout<Config> L;
+
+    if (data_size < L::SIZE)
+        return receive_result(
+                ArduinoSerialReadResult::ERROR_INSUFFICIENT_DATA_LENGTH, 0);
+
+    // nothing but the length can be checked before payload
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    if (data[L::LEN] > Config::SHORT_MAX_PAYLOAD_SIZE)
+    {
+        set_state(state, State::IDLE);
+
+        return receive_result(ArduinoSerialReadResult::ERROR_CHECKSUM, L::CHECKSUM);
+    }
+
+    payload_state.payload_len = data[L::LEN];
+    payload_state.packet_id = expand_id<Config>(last_id, data[0]);
+    payload_state.frame = ArduinoSerialFrame::SHORT;
+    payload_state.checksum = read_be(data + L::CHECKSUM, Layout<Config>::CHECKSUM_SIZE);
+    payload_state.checksum_header =
+            short_header_seed<Config>(payload_state.packet_id, payload_state.payload_len);
+
+    set_state(state, State::READ_PAYLOAD);
+
+    return receive_result(ArduinoSerialReadResult::OK, L::SIZE);
+}
+
+// Offset of the first possible strobe; the vectorised scan knows only the
+// default strobes, other configs stop at any first strobe byte
+template<typename Config>
+size_t find_strobe(const void* _data, const size_t data_size)
+{
+    typedef ArduinoSerialDefaultConfig D;
+
+    if (Config::STROBE_1 == D::STROBE_1 && Config::STROBE_2 == D::STROBE_2
+        && Config::EXTENDED_STROBE_2 == D::EXTENDED_STROBE_2
+        && Config::SHORT_STROBE_2 == D::SHORT_STROBE_2
+        && Config::SYNC_STROBE_1 == D::SYNC_STROBE_1
+        && Config::SYNC_STROBE_2 == D::SYNC_STROBE_2
+        && Config::SYNC_STROBE_3 == D::SYNC_STROBE_3
+        && Config::SYNC_STROBE_4 == D::SYNC_STROBE_4
+        && Config::SYNC_STROBE_4_PARAMS == D::SYNC_STROBE_4_PARAMS)
+        return arduino_serial_scan_strobe(_data, data_size);
+
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    size_t i = 0;
+    while (i < data_size && data[i] != Config::STROBE_1 && data[i] != Config::SYNC_STROBE_1)
+        ++i;
+    return i;
+}
+
+template<typename Config>
+ArduinoSerialReceiveResult
+read_payload(char& state, ArduinoSerialPayloadState& payload_state,
+            const void* data, const size_t data_size)
+{
+    if (data_size < payload_state.payload_len)
+        return receive_result(
+                ArduinoSerialReadResult::ERROR_INSUFFICIENT_DATA_LENGTH, 0);
+
+    const ArduinoSerialFrame frame = payload_state.frame;
+    const uint32_t checksum = frame_checksum<Config>(
+            frame, payload_state.checksum_header, data, payload_state.payload_len);
+    if (checksum != payload_state.checksum)
+    {
+        size_t p_len = payload_state.payload_len;
+        clear(payload_state);
+        set_state(state, State::IDLE);
+
+        return receive_result(
+                ArduinoSerialReadResult::ERROR_CHECKSUM, p_len);
+    }
+
+    size_t p_len = payload_state.payload_len;
+    ArduinoSerialProtocolID packet_id = payload_state.packet_id;
+    clear(payload_state);
+    set_state(state, State::IDLE);
+
+    return payload_result(data, p_len, packet_id);
+}
+
+inline void count_receive(const ArduinoSerialProtocolCounters& counters, State before,
+                   bool scanning, const ArduinoSerialReceiveResult& result)
+{
+    counters.add(ArduinoSerialCounter::BYTES_IN, result.bytes_read);
+    switch (result.read_result)
+    {
+        case ArduinoSerialReadResult::OK:
+            if (before == State::READ_PAYLOAD)
+                counters.add(ArduinoSerialCounter::PACKETS_OK, 1);
+            break;
+        case ArduinoSerialReadResult::ERROR_CHECKSUM:
+            counters.add(before == State::READ_PAYLOAD
+                         ? ArduinoSerialCounter::PAYLOAD_CRC_ERRORS
+                         : ArduinoSerialCounter::HEADER_CRC_ERRORS, 1);
+            break;
+        case ArduinoSerialReadResult::NOPE:
+            if (scanning && before == State::IDLE)
+                counters.add(ArduinoSerialCounter::BYTES_DISCARDED, result.bytes_read);
+            break;
+        default:
+            break;
+    }
+}
+
+// ERROR_INSUFFICIENT_DATA_LENGTH is not one: it only asks for more bytes
+inline bool is_error(ArduinoSerialReadResult result)
+{
+    return result == ArduinoSerialReadResult::ERROR_UNEXPECTED_DATA
+           || result == ArduinoSerialReadResult::ERROR_CHECKSUM;
+}
+
+#if ARDUINO_SERIAL_LATENCY
+// Entered from IDLE once STROBE_1 (or a whole header) was accepted
+inline bool is_packet_state(State state)
+{
+    return state == State::READ_STROBE_2
+           || state == State::READ_HEADER
+           || state == State::READ_EXTENDED_HEADER
+           || state == State::READ_SHORT_HEADER
+           || state == State::READ_PAYLOAD;
+}
+#endif
+
+// State between two frames
+inline bool is_frame_boundary(State state)
+{
+    return state == State::IDLE
+           || state == State::WAITING_SYNC
+           || state == State::WRITE_SYNC_REPLY
+           || state == State::SENDING_SYNC
+           || state == State::READ_SYNC_REPLY_1;
+}
+
+inline void count_sync(const ArduinoSerialProtocolCounters& counters, bool was_synced)
+{
+    counters.add(ArduinoSerialCounter::SYNCS, 1);
+    if (was_synced)
+        counters.add(ArduinoSerialCounter::RESYNCS, 1);
+}
+} // namespace arduino_serial_detail
+
+
+template<typename Config>
+constexpr const bool ArduinoSerialProtocolT<Config>::COBS_FRAMING;
+template<typename Config>
+constexpr const size_t ArduinoSerialProtocolT<Config>::CHECKSUM_SIZE;
+template<typename Config>
+constexpr const size_t ArduinoSerialProtocolT<Config>::HEADER_SIZE;
+template<typename Config>
+constexpr const size_t ArduinoSerialProtocolT<Config>::MAX_PAYLOAD_SIZE;
+template<typename Config>
+constexpr const size_t ArduinoSerialProtocolT<Config>::EXTENDED_HEADER_SIZE;
+template<typename Config>
+constexpr const size_t ArduinoSerialProtocolT<Config>::SHORT_HEADER_SIZE;
+template<typename Config>
+constexpr const size_t ArduinoSerialProtocolT<Config>::SYNC_PARAMS_SIZE;
+template<typename Config>
+constexpr const size_t ArduinoSerialProtocolT<Config>::MAX_SYNC_HEADER_SIZE;
+template<typename Config>
+constexpr const uint8_t ArduinoSerialProtocolT<Config>::BAUD_ROLLBACK_ERRORS;
+
+template<typename Config>
+ArduinoSerialProtocolT<Config>
+ArduinoSerialProtocolT<Config>::createSecondary(const Hooks& hooks)
+{
+    return ArduinoSerialProtocolT{false, hooks};
+}
+
+template<typename Config>
+ArduinoSerialProtocolT<Config>
+ArduinoSerialProtocolT<Config>::createPrimary(const Hooks& hooks)
+{
+    return ArduinoSerialProtocolT{true, hooks};
+}
+
+template<typename Config>
+ArduinoSerialProtocolT<Config>::ArduinoSerialProtocolT(bool primary, const Hooks& hooks)
+: ArduinoSerialProtocolCounters{}
+, Hooks(hooks)
+, state{static_cast<char>(primary ? State::SENDING_SYNC : State::WAITING_SYNC)}
+, was_synced{false}
+, scan_strobe{false}
+, is_primary{primary}
+, sync_pending{false}
+, reply_params{false}
+, classic_sync{false}
+, baud_confirmed{true}
+, sync_retry{false}
+, seq_id{0}
+, sync_count{0}
+, supported_features{0}
+, link_features{0}
+, pending_features{0}
+, baud_rates{0}
+, failed_rates{0}
+, link_rate{0}
+, pending_rate{0}
+, baud_errors{0}
+, last_id{0}
+#if ARDUINO_SERIAL_LATENCY
+, arrival_ticks{0}
+, frame_start_ticks{0}
+#endif
+{
+    arduino_serial_detail::clear(payload_state);
+}
+
+template<typename Config>
+ArduinoSerialProtocolID
+ArduinoSerialProtocolT<Config>::createNextPacketId()
+{
+    ArduinoSerialProtocolID result = ++seq_id;
+    if (Config::ID_SIZE == 1 && result > 0xFF)
+        result = seq_id = 1;
+    if (result == 0)
+        return ++seq_id;
+    return result;
+}
+
+template<typename Config>
+size_t ArduinoSerialProtocolT<Config>::maxPayloadSize() const
+{
+    if (ARDUINO_SERIAL_MAX_EXTENDED_PAYLOAD > MAX_PAYLOAD_SIZE
+        && (link_features & ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES) != 0)
+        return ARDUINO_SERIAL_MAX_EXTENDED_PAYLOAD;
+    return MAX_PAYLOAD_SIZE;
+}
+
+template<typename Config>
+size_t ArduinoSerialProtocolT<Config>::headerSize(size_t payload_size,
+                                                  ArduinoSerialProtocolID id) const
+{
+    switch (frameFor(payload_size, id))
+    {
+        case ArduinoSerialFrame::EXTENDED:
+            return EXTENDED_HEADER_SIZE;
+        case ArduinoSerialFrame::SHORT:
+            return SHORT_HEADER_SIZE;
+        default:
+            break;
+    }
+    return HEADER_SIZE;
+}
+
+template<typename Config>
+ArduinoSerialFrame ArduinoSerialProtocolT<Config>::frameFor(size_t payload_size,
+                                                           ArduinoSerialProtocolID id) const
+{
+    if (payload_size > MAX_PAYLOAD_SIZE)
+        return ArduinoSerialFrame::EXTENDED;
+    // low byte alone would not tell ID 0 from data IDs
+    if (id != 0 && payload_size <= Config::SHORT_MAX_PAYLOAD_SIZE
+        && (link_features & ARDUINO_SERIAL_FEATURE_SHORT_FRAMES) != 0)
+        return ArduinoSerialFrame::SHORT;
+    return ArduinoSerialFrame::CLASSIC;
+}
+
+template<typename Config>
+void ArduinoSerialProtocolT<Config>::setFeatures(uint8_t supported)
+{
+    if (ARDUINO_SERIAL_MAX_EXTENDED_PAYLOAD <= MAX_PAYLOAD_SIZE)
+        supported &= static_cast<uint8_t>(~ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES);
+    supported_features = supported;
+}
+
+template<typename Config>
+void ArduinoSerialProtocolT<Config>::setBaudRates(uint8_t supported)
+{
+    baud_rates = supported;
+    failed_rates = 0;
+}
+
+template<typename Config>
+bool ArduinoSerialProtocolT<Config>::isSynced() const
+{
+    return was_synced && !sync_pending
+           && getState() != State::SENDING_SYNC
+           && getState() != State::WAITING_SYNC
+           && getState() != State::UNDEFINED;
+}
+
+template<typename Config>
+ArduinoSerialGeneralResult
+ArduinoSerialProtocolT<Config>::writeHeader(
+        void* header, ArduinoSerialProtocolID id,
+        const void* payload, size_t payload_size) const
+{
+    if (COBS_FRAMING)
+        return ArduinoSerialGeneralResult::ERROR_UNDEFINED;
+
+    const ArduinoSerialGeneralResult check =
+            arduino_serial_detail::check_write(state, payload_size, maxPayloadSize());
+    if (check != ArduinoSerialGeneralResult::OK)
+        return check;
+
+    const ArduinoSerialFrame frame = frameFor(payload_size, id);
+    uint8_t* data = static_cast<uint8_t*>(header);
+    uint32_t checksum = arduino_serial_detail::write_frame_fields<Config>(
+            frame, data, id, payload_size);
+    checksum = arduino_serial_detail::frame_checksum<Config>(
+            frame, checksum, payload, payload_size);
+    arduino_serial_detail::write_frame_checksum<Config>(frame, data, checksum);
+    add(ArduinoSerialCounter::BYTES_OUT, packetSize(payload_size, id));
+    return ArduinoSerialGeneralResult::OK;
+}
+
+template<typename Config>
+ArduinoSerialGeneralResult
+ArduinoSerialProtocolT<Config>::writePacket(
+        void* packet, ArduinoSerialProtocolID id,
+        const void* payload, size_t payload_size) const
+{
+    const ArduinoSerialGeneralResult check = checkWrite(payload_size);
+    if (check != ArduinoSerialGeneralResult::OK)
+        return check;
+
+    const ArduinoSerialFrame frame = frameFor(payload_size, id);
+    const size_t header_size = headerSize(payload_size, id);
+    uint8_t* data = static_cast<uint8_t*>(packet) + frameOffset(header_size + payload_size);
+    uint32_t checksum = arduino_serial_detail::write_frame_fields<Config>(
+            frame, data, id, payload_size);
+    checksum = arduino_serial_detail::copy_frame_checksum<Config>(
+            frame, checksum, data + header_size, payload, payload_size);
+    arduino_serial_detail::write_frame_checksum<Config>(frame, data, checksum);
+    encodeFrame(static_cast<uint8_t*>(packet), header_size + payload_size);
+    add(ArduinoSerialCounter::BYTES_OUT, packetSize(payload_size, id));
+    return ArduinoSerialGeneralResult::OK;
+}
+
+template<typename Config>
+ArduinoSerialGeneralResult
+ArduinoSerialProtocolT<Config>::checkWrite(size_t payload_size) const
+{
+    return arduino_serial_detail::check_write(state, payload_size, maxPayloadSize());
+}
+
+template<typename Config>
+size_t ArduinoSerialProtocolT<Config>::batchSize(
+        const ArduinoSerialPayload* payloads, size_t count) const
+{
+    size_t result = 0;
+    for (size_t i = 0; i < count; ++i)
+        result += packetSize(payloads[i].size);
+    return result;
+}
+
+template<typename Config>
+ArduinoSerialBatchResult
+ArduinoSerialProtocolT<Config>::writePackets(
+        void* _buffer, size_t buffer_size,
+        const ArduinoSerialPayload* payloads, size_t count)
+{
+    uint8_t* buffer = static_cast<uint8_t*>(_buffer);
+    ArduinoSerialBatchResult result;
+    result.result = ArduinoSerialGeneralResult::OK;
+    result.packets_written = 0;
+    result.bytes_written = 0;
+    result.first_id = 0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const size_t packet_size = packetSize(payloads[i].size);
+        if (buffer_size - result.bytes_written < packet_size)
+        {
+            result.result = ArduinoSerialGeneralResult::ERROR_BUFFER_TOO_SMALL;
+            break;
+        }
+
+        result.result = checkWrite(payloads[i].size);
+        if (result.result != ArduinoSerialGeneralResult::OK)
+            break;
+
+        const ArduinoSerialProtocolID id = createNextPacketId();
+        if (i == 0)
+            result.first_id = id;
+
+        writePacket(buffer + result.bytes_written, id,
+                    payloads[i].data, payloads[i].size);
+        result.bytes_written += packet_size;
+        ++result.packets_written;
+    }
+    return result;
+}
+
+#ifndef ARDUINO
+template<typename Config>
+ArduinoSerialGeneralResult
+ArduinoSerialProtocolT<Config>::writeHeaderIov(
+        void* header, struct iovec* iov, ArduinoSerialProtocolID id,
+        const void* payload, size_t payload_size) const
+{
+    const ArduinoSerialGeneralResult result =
+            writeHeader(header, id, payload, payload_size);
+    if (result != ArduinoSerialGeneralResult::OK)
+        return result;
+
+    iov[0].iov_base = header;
+    iov[0].iov_len = headerSize(payload_size, id);
+    iov[1].iov_base = const_cast<void*>(payload);
+    iov[1].iov_len = payload_size;
+    return ArduinoSerialGeneralResult::OK;
+}
+#endif
+
+template<typename Config>
+ArduinoSerialGeneralResult
+ArduinoSerialProtocolT<Config>::writeSyncHeader(void* header) const
+{
+    const size_t size = offersParams() ? 4 + SYNC_PARAMS_SIZE : 4;
+    uint8_t* data = static_cast<uint8_t*>(header) + frameOffset(size);
+    data[0] = Config::SYNC_STROBE_1;
+    data[1] = Config::SYNC_STROBE_2;
+    data[2] = Config::SYNC_STROBE_3;
+    data[3] = Config::SYNC_STROBE_4;
+    if (offersParams())
+    {
+        data[3] = Config::SYNC_STROBE_4_PARAMS;
+        arduino_serial_detail::write_sync_params(data + 4, supported_features,
+                                                 offeredRates(), SYNC_PARAMS_SIZE);
+    }
+    encodeFrame(static_cast<uint8_t*>(header), size);
+    add(ArduinoSerialCounter::BYTES_OUT, syncHeaderSize());
+    return ArduinoSerialGeneralResult::OK;
+}
+
+template<typename Config>
+ArduinoSerialGeneralResult
+ArduinoSerialProtocolT<Config>::syncSent()
+{
+    if (getState() != State::SENDING_SYNC)
+        return ArduinoSerialGeneralResult::ERROR_WRONG_STATE;
+
+    // peer restarts its short frame IDs from 0 on every sync request;
+    // a retry keeps the IDs given to packets queued behind the first one
+    if (!sync_retry)
+        seq_id = 0;
+    sync_retry = false;
+
+    setState(State::READ_SYNC_REPLY_1);
+    sync_pending = true;
+    return ArduinoSerialGeneralResult::OK;
+}
+
+template<typename Config>
+ArduinoSerialGeneralResult
+ArduinoSerialProtocolT<Config>::syncTimeout()
+{
+    if (!is_primary)
+        return ArduinoSerialGeneralResult::ERROR_WRONG_STATE;
+
+    if (!sync_pending && getState() != State::SENDING_SYNC)
+        return ArduinoSerialGeneralResult::ERROR_WRONG_STATE;
+
+    // peer that agreed a rate knows parameters
+    if (!baud_confirmed)
+        rollbackBaud();
+    else if (link_rate == 0)
+        classic_sync = !classic_sync;
+
+    setState(State::SENDING_SYNC);
+    sync_pending = false;
+    sync_retry = true;
+    arduino_serial_detail::clear(payload_state);
+    return ArduinoSerialGeneralResult::OK;
+}
+
+template<typename Config>
+ArduinoSerialGeneralResult
+ArduinoSerialProtocolT<Config>::writeSyncReplyHeader(void* header) const
+{
+    const size_t size = reply_params ? 4 + SYNC_PARAMS_SIZE : 4;
+    uint8_t* data = static_cast<uint8_t*>(header) + frameOffset(size);
+    data[0] = Config::SYNC_STROBE_1;
+    data[1] = Config::SYNC_STROBE_2;
+    data[2] = Config::SYNC_STROBE_3;
+    data[3] = Config::SYNC_STROBE_REPLY;
+    if (reply_params)
+    {
+        data[3] = Config::SYNC_STROBE_REPLY_PARAMS;
+        arduino_serial_detail::write_sync_params(data + 4, pending_features,
+                                                 pending_rate, SYNC_PARAMS_SIZE);
+    }
+    encodeFrame(static_cast<uint8_t*>(header), size);
+    add(ArduinoSerialCounter::BYTES_OUT, syncReplyHeaderSize());
+    return ArduinoSerialGeneralResult::OK;
+}
+
+template<typename Config>
+ArduinoSerialGeneralResult
+ArduinoSerialProtocolT<Config>::syncReplySent()
+{
+    switch (getState())
+    {
+        case State::WRITE_SYNC_REPLY:
+            setState(State::IDLE);
+            if (reply_params)
+                completeSync(pending_features, pending_rate);
+            else
+                completeSync(0, 0);
+            return ArduinoSerialGeneralResult::OK;
+        case State::IDLE:
+            return ArduinoSerialGeneralResult::OK;
+        default:
+            break;
+    }
+    return ArduinoSerialGeneralResult::ERROR_WRONG_STATE;
+}
+
+template<typename Config>
+ArduinoSerialNextOperation
+ArduinoSerialProtocolT<Config>::nextOperation() const
+{
+    using namespace arduino_serial_detail;
+
+    switch (getState())
+    {
+        case State::WAITING_SYNC:
+        case State::IDLE:
+        case State::READ_STROBE_2:
+        case State::READ_SYNC_STROBE_2:
+        case State::READ_SYNC_STROBE_3:
+        case State::READ_SYNC_STROBE_4:
+        case State::READ_SYNC_REPLY_1:
+        case State::READ_SYNC_REPLY_2:
+        case State::READ_SYNC_REPLY_3:
+        case State::READ_SYNC_REPLY_4:
+            return next_operation(ArduinoSerialOperation::READ_HEADER, 1);
+        case State::WRITE_SYNC_REPLY:
+            return next_operation(ArduinoSerialOperation::SEND_SYNC_REPLY, 0);
+        case State::SENDING_SYNC:
+            return next_operation(ArduinoSerialOperation::SEND_SYNC, 0);
+        case State::READ_HEADER:
+            return next_operation(ArduinoSerialOperation::READ_HEADER, HEADER_SIZE - 2);
+        case State::READ_EXTENDED_HEADER:
+            return next_operation(ArduinoSerialOperation::READ_HEADER,
+                                  EXTENDED_HEADER_SIZE - 2);
+        case State::READ_SHORT_HEADER:
+            return next_operation(ArduinoSerialOperation::READ_HEADER, SHORT_HEADER_SIZE - 2);
+        case State::READ_SYNC_PARAMS:
+        case State::READ_SYNC_REPLY_PARAMS:
+            return next_operation(ArduinoSerialOperation::READ_HEADER, SYNC_PARAMS_SIZE);
+        case State::READ_PAYLOAD:
+            // COBS payload is already decoded
+            return next_operation(ArduinoSerialOperation::READ_PAYLOAD,
+                                  COBS_FRAMING ? 0 : payload_state.payload_len,
+                                  payload_state.packet_id);
+        default:
+            break;
+    }
+    return next_operation(ArduinoSerialOperation::NOPE, 0);
+}
+
+template<typename Config>
+ArduinoSerialReceiveResult
+ArduinoSerialProtocolT<Config>::readBytes(const void* data, size_t data_size)
+{
+    const State before = getState();
+    const bool scanning = scan_strobe;
+    const ArduinoSerialReceiveResult result =
+            COBS_FRAMING ? readCobs(data, data_size) : readState(data, data_size);
+    arduino_serial_detail::count_receive(*this, before, scanning, result);
+    if (link_rate != 0)
+        checkBaud(before, scanning, result);
+
+    if (getState() != before)
+        hooks().onTransition(before, getState());
+    if (result.read_result == ArduinoSerialReadResult::OK
+        && before == State::READ_PAYLOAD)
+        hooks().onPacket(result.packet_id, result.payload, result.payload_size);
+    else if (arduino_serial_detail::is_error(result.read_result))
+        hooks().onError(before, result.read_result);
+
+#if ARDUINO_SERIAL_LATENCY
+    if (result.read_result == ArduinoSerialReadResult::OK)
+    {
+        if (before == State::IDLE && arduino_serial_detail::is_packet_state(getState()))
+            frame_start_ticks = arrival_ticks;
+        else if (before == State::READ_PAYLOAD && frame_start_ticks != 0)
+            latency_histogram.record(arduino_serial_now_ticks() - frame_start_ticks);
+    }
+#endif
+    return result;
+}
+
+template<typename Config>
+ArduinoSerialReceiveResult
+ArduinoSerialProtocolT<Config>::readState(const void* data, size_t data_size)
+{
+    using namespace arduino_serial_detail;
+
+    switch (getState())
+    {
+        case State::WAITING_SYNC:
+            return read_strobe(state, data, data_size,
+                               Config::SYNC_STROBE_1, State::READ_SYNC_STROBE_2,
+                               State::WAITING_SYNC);
+        case State::IDLE:
+        {
+            if (scan_strobe)
+            {
+                const size_t skip = find_strobe<Config>(data, data_size);
+                if (skip > 0)
+                    return receive_result(ArduinoSerialReadResult::NOPE, skip);
+            }
+
+            // both strobes and the rest of header in one step, when whole
+            // header is already in the buffer
+            const uint8_t* bytes = static_cast<const uint8_t*>(data);
+            const State header_state = data_size >= 2 && bytes[0] == Config::STROBE_1
+                                       ? headerStateFor(bytes[1]) : State::IDLE;
+            if (header_state != State::IDLE)
+            {
+                ArduinoSerialReceiveResult header_result =
+                        readHeader(header_state, bytes + 2, data_size - 2);
+                if (header_result.read_result
+                    != ArduinoSerialReadResult::ERROR_INSUFFICIENT_DATA_LENGTH)
+                {
+                    header_result.bytes_read += 2;
+                    return header_result;
+                }
+            }
+
+            ArduinoSerialReceiveResult strobe_result =
+                    read_strobe_or_sync<Config>(state, data, data_size,
+                                        is_primary ? State::READ_SYNC_REPLY_2
+                                                   : State::READ_SYNC_STROBE_2);
+            if (strobe_result.read_result == ArduinoSerialReadResult::OK)
+            {
+                scan_strobe = false;
+            }
+            if (strobe_result.read_result == ArduinoSerialReadResult::ERROR_UNEXPECTED_DATA
+                && scan_strobe)
+            {
+                strobe_result.read_result = ArduinoSerialReadResult::NOPE;
+            }
+            return strobe_result;
+        }
+        case State::READ_STROBE_2:
+        {
+            const uint8_t strobe_2 = data_size >= 1
+                                     ? static_cast<const uint8_t*>(data)[0] : Config::STROBE_2;
+            const State header_state = headerStateFor(strobe_2);
+            if (header_state != State::IDLE)
+                return read_strobe(state, data, data_size, strobe_2, header_state, State::IDLE);
+            return read_strobe(state, data, data_size,
+                               Config::STROBE_2, State::READ_HEADER,
+                               State::IDLE);
+        }
+        case State::READ_SYNC_STROBE_2:
+            return read_strobe(state, data, data_size,
+                               Config::SYNC_STROBE_2, State::READ_SYNC_STROBE_3,
+                               was_synced ? State::IDLE : State::WAITING_SYNC);
+        case State::READ_SYNC_STROBE_3:
+            return read_strobe(state, data, data_size,
+                               Config::SYNC_STROBE_3, State::READ_SYNC_STROBE_4,
+                               was_synced ? State::IDLE : State::WAITING_SYNC);
+        case State::READ_SYNC_STROBE_4:
+            reply_params = false;
+            if (data_size >= 1
+                && static_cast<const uint8_t*>(data)[0] == Config::SYNC_STROBE_4_PARAMS)
+                return read_strobe(state, data, data_size,
+                                   Config::SYNC_STROBE_4_PARAMS, State::READ_SYNC_PARAMS,
+                                   was_synced ? State::IDLE : State::WAITING_SYNC);
+            return read_strobe(state, data, data_size,
+                               Config::SYNC_STROBE_4, State::WRITE_SYNC_REPLY,
+                               was_synced ? State::IDLE : State::WAITING_SYNC);
+        case State::READ_SYNC_PARAMS:
+        case State::READ_SYNC_REPLY_PARAMS:
+            return readSyncParams(data, data_size);
+        case State::WRITE_SYNC_REPLY:
+        case State::SENDING_SYNC:
+            return receive_result(ArduinoSerialReadResult::NOPE, 0);
+        case State::READ_SYNC_REPLY_1:
+            return read_strobe(state, data, data_size,
+                               Config::SYNC_STROBE_1, State::READ_SYNC_REPLY_2,
+                               State::READ_SYNC_REPLY_1);
+        case State::READ_SYNC_REPLY_2:
+            return read_strobe(state, data, data_size,
+                               Config::SYNC_STROBE_2, State::READ_SYNC_REPLY_3,
+                               sync_pending ? State::READ_SYNC_REPLY_1 : State::IDLE);
+        case State::READ_SYNC_REPLY_3:
+            return read_strobe(state, data, data_size,
+                               Config::SYNC_STROBE_3, State::READ_SYNC_REPLY_4,
+                               sync_pending ? State::READ_SYNC_REPLY_1 : State::IDLE);
+        case State::READ_SYNC_REPLY_4:
+        {
+            if (data_size >= 1
+                && static_cast<const uint8_t*>(data)[0] == Config::SYNC_STROBE_REPLY_PARAMS)
+                return read_strobe(state, data, data_size,
+                                   Config::SYNC_STROBE_REPLY_PARAMS,
+                                   State::READ_SYNC_REPLY_PARAMS,
+                                   sync_pending ? State::READ_SYNC_REPLY_1 : State::IDLE);
+
+            ArduinoSerialReceiveResult reply_result =
+                    read_strobe(state, data, data_size,
+                                Config::SYNC_STROBE_REPLY, State::IDLE,
+                                sync_pending ? State::READ_SYNC_REPLY_1 : State::IDLE);
+            if (reply_result.read_result == ArduinoSerialReadResult::OK)
+            {
+                completeSync(0, 0);
+            }
+            return reply_result;
+        }
+        case State::READ_HEADER:
+        case State::READ_EXTENDED_HEADER:
+        case State::READ_SHORT_HEADER:
+            return readHeader(getState(), data, data_size);
+        case State::READ_PAYLOAD:
+        {
+            ArduinoSerialReceiveResult payload_result =
+                    read_payload<Config>(state, payload_state, data, data_size);
+            if (payload_result.read_result == ArduinoSerialReadResult::OK
+                && payload_result.packet_id != 0)
+            {
+                last_id = payload_result.packet_id;
+            }
+            return payload_result;
+        }
+        default:
+            break;
+    }
+
+    return receive_result(ArduinoSerialReadResult::NOPE, 0);
+}
+
+template<typename Config>
+ArduinoSerialProtocolState
+ArduinoSerialProtocolT<Config>::headerStateFor(uint8_t strobe_2) const
+{
+    if (strobe_2 == Config::STROBE_2)
+        return State::READ_HEADER;
+    if (strobe_2 == Config::EXTENDED_STROBE_2 && maxPayloadSize() > MAX_PAYLOAD_SIZE)
+        return State::READ_EXTENDED_HEADER;
+    if (strobe_2 == Config::SHORT_STROBE_2
+        && (link_features & ARDUINO_SERIAL_FEATURE_SHORT_FRAMES) != 0)
+        return State::READ_SHORT_HEADER;
+    return State::IDLE;
+}
+
+template<typename Config>
+ArduinoSerialReceiveResult
+ArduinoSerialProtocolT<Config>::readHeader(State header_state,
+                                           const void* data, size_t data_size)
+{
+    using namespace arduino_serial_detail;
+
+    ArduinoSerialReceiveResult result;
+    switch (header_state)
+    {
+        case State::READ_EXTENDED_HEADER:
+            result = read_extended_header<Config>(state, payload_state, data, data_size);
+            break;
+        case State::READ_SHORT_HEADER:
+            result = read_short_header<Config>(state, payload_state, last_id, data, data_size);
+            break;
+        default:
+            result = read_header<Config>(state, payload_state, data, data_size);
+            break;
+    }
+
+    // bad header may hide the strobe of the next frame
+    if (result.read_result != ArduinoSerialReadResult::ERROR_INSUFFICIENT_DATA_LENGTH)
+        scan_strobe = result.read_result == ArduinoSerialReadResult::ERROR_CHECKSUM;
+    return result;
+}
+
+template<typename Config>
+ArduinoSerialReceiveResult
+ArduinoSerialProtocolT<Config>::readSyncParams(const void* _data, size_t data_size)
+{
+    using namespace arduino_serial_detail;
+
+    if (data_size < SYNC_PARAMS_SIZE)
+        return receive_result(
+                ArduinoSerialReadResult::ERROR_INSUFFICIENT_DATA_LENGTH, 0);
+
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    const bool request = getState() == State::READ_SYNC_PARAMS;
+    if (arduino_serial_crc8(0, data, SYNC_PARAMS_SIZE - 1) != data[SYNC_PARAMS_SIZE - 1])
+    {
+        if (request)
+            set_state(state, was_synced ? State::IDLE : State::WAITING_SYNC);
+        else
+            set_state(state, sync_pending ? State::READ_SYNC_REPLY_1 : State::IDLE);
+
+        return receive_result(ArduinoSerialReadResult::ERROR_CHECKSUM, SYNC_PARAMS_SIZE);
+    }
+
+    const uint8_t features = data[0] & supported_features;
+    const uint8_t rate = highest_rate(data[1] & offeredRates());
+    if (request)
+    {
+        pending_features = features;
+        pending_rate = rate;
+        reply_params = true;
+        set_state(state, State::WRITE_SYNC_REPLY);
+    }
+    else
+    {
+        completeSync(features, rate);
+        // new rate is confirmed by one more sync at that rate
+        set_state(state, baud_confirmed ? State::IDLE : State::SENDING_SYNC);
+    }
+    return receive_result(ArduinoSerialReadResult::OK, SYNC_PARAMS_SIZE);
+}
+
+template<typename Config>
+ArduinoSerialReceiveResult
+ArduinoSerialProtocolT<Config>::readCobs(const void* data, size_t data_size)
+{
+    using namespace arduino_serial_detail;
+
+    switch (getState())
+    {
+        case State::READ_PAYLOAD:
+        {
+            // validated from the decoded frame, nothing of data is used
+            ArduinoSerialReceiveResult result =
+                    readState(cobs().current(), cobs().remaining());
+            result.bytes_read = 0;
+            return result;
+        }
+        case State::WRITE_SYNC_REPLY:
+        case State::SENDING_SYNC:
+            return receive_result(ArduinoSerialReadResult::NOPE, 0);
+        default:
+            break;
+    }
+
+    size_t used = 0;
+    switch (cobs().push(static_cast<const uint8_t*>(data), data_size, used))
+    {
+        case ArduinoSerialCobsResult::FRAME:
+            break;
+        case ArduinoSerialCobsResult::ERROR:
+            return receive_result(ArduinoSerialReadResult::ERROR_UNEXPECTED_DATA, used);
+        default:
+            return receive_result(ArduinoSerialReadResult::NOPE, used);
+    }
+
+    // whole frame goes through the strobe states up to the next frame
+    // boundary, or READ_PAYLOAD with the payload in the frame; padding
+    // after it is ignored
+    const State start = getState();
+    ArduinoSerialReceiveResult step;
+    do
+    {
+        step = readState(cobs().current(), cobs().remaining());
+        cobs().consume(step.bytes_read);
+    }
+    while (step.read_result == ArduinoSerialReadResult::OK && cobs().remaining() > 0
+           && getState() != State::READ_PAYLOAD && !is_frame_boundary(getState()));
+    scan_strobe = false;
+
+    if (step.read_result == ArduinoSerialReadResult::OK)
+    {
+        if (getState() == State::READ_PAYLOAD
+            && cobs().remaining() >= payload_state.payload_len)
+            return receive_result(ArduinoSerialReadResult::OK, used);
+        if (is_frame_boundary(getState()))
+            return receive_result(ArduinoSerialReadResult::OK, used);
+    }
+
+    // truncated frame
+    clear(payload_state);
+    set_state(state, start);
+    if (is_error(step.read_result))
+        return receive_result(step.read_result, used);
+    return receive_result(ArduinoSerialReadResult::ERROR_UNEXPECTED_DATA, used);
+}
+
+template<typename Config>
+void ArduinoSerialProtocolT<Config>::completeSync(uint8_t features, uint8_t rate)
+{
+    arduino_serial_detail::count_sync(*this, was_synced);
+    ++sync_count;
+    was_synced = true;
+    sync_pending = false;
+    link_features = features;
+    baud_confirmed = rate == 0 || rate == link_rate;
+    link_rate = rate;
+    baud_errors = 0;
+    // both sides count IDs from 0 after a sync, so short frame IDs are
+    // expanded around the same reference; primary did so in syncSent()
+    last_id = 0;
+    if (!is_primary)
+        seq_id = 0;
+    arduino_serial_detail::clear(payload_state);
+}
+
+template<typename Config>
+void ArduinoSerialProtocolT<Config>::checkBaud(
+        State before, bool scanning, const ArduinoSerialReceiveResult& result)
+{
+    using namespace arduino_serial_detail;
+
+    // once a frame got through at the new rate, errors are ordinary ones
+    if (baud_confirmed)
+        return;
+
+    if (result.read_result == ArduinoSerialReadResult::OK && before == State::READ_PAYLOAD)
+    {
+        baud_confirmed = true;
+        baud_errors = 0;
+        return;
+    }
+
+    const bool discarded = result.read_result == ArduinoSerialReadResult::NOPE
+                           && scanning && result.bytes_read > 0;
+    if (!discarded && !is_error(result.read_result))
+        return;
+
+    if (++baud_errors < BAUD_ROLLBACK_ERRORS)
+        return;
+
+    rollbackBaud();
+    sync_pending = false;
+    scan_strobe = false;
+    clear(payload_state);
+    set_state(state, is_primary ? State::SENDING_SYNC : State::WAITING_SYNC);
+}
+
+template<typename Config>
+void ArduinoSerialProtocolT<Config>::rollbackBaud()
+{
+    failed_rates |= link_rate;
+    link_rate = 0;
+    baud_confirmed = true;
+    baud_errors = 0;
+    add(ArduinoSerialCounter::BAUD_ROLLBACKS, 1);
+}
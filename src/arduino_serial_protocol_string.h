@@ -1,7 +1,8 @@
 #pragma once
 
-#include <string>
 #include <map>
+#include <ostream>
+#include <string>
 
 #include "arduino_serial_protocol.h"
 
@@ -40,7 +41,7 @@ const std::map<T, std::string> StringInfo<T>::string_repr =
 
 
 template <>
-void create_string_repr<ArduinoSerialGeneralResult>(
+inline void create_string_repr<ArduinoSerialGeneralResult>(
         std::map<ArduinoSerialGeneralResult, std::string>& map)
 {
     using T = std::map<ArduinoSerialGeneralResult, std::string>;
@@ -49,12 +50,13 @@ void create_string_repr<ArduinoSerialGeneralResult>(
             {ArduinoSerialGeneralResult::ERROR_WRONG_STATE, "ERROR_WRONG_STATE"},
             {ArduinoSerialGeneralResult::ERROR_NOT_SYNCED, "ERROR_NOT_SYNCED"},
             {ArduinoSerialGeneralResult::ERROR_PAYLOAD_SIZE_TOO_BIG, "ERROR_PAYLOAD_SIZE_TOO_BIG"},
+            {ArduinoSerialGeneralResult::ERROR_BUFFER_TOO_SMALL, "ERROR_BUFFER_TOO_SMALL"},
             {ArduinoSerialGeneralResult::ERROR_UNDEFINED, "ERROR_UNDEFINED"},
     };
 }
 
 template <>
-void create_string_repr<ArduinoSerialOperation>(
+inline void create_string_repr<ArduinoSerialOperation>(
         std::map<ArduinoSerialOperation, std::string>& map)
 {
     using T = std::map<ArduinoSerialOperation, std::string>;
@@ -63,11 +65,12 @@ void create_string_repr<ArduinoSerialOperation>(
             {ArduinoSerialOperation::READ_HEADER, "READ_HEADER"},
             {ArduinoSerialOperation::READ_PAYLOAD, "READ_PAYLOAD"},
             {ArduinoSerialOperation::SEND_SYNC_REPLY, "SEND_SYNC_REPLY"},
+            {ArduinoSerialOperation::SEND_SYNC, "SEND_SYNC"},
     };
 }
 
 template <>
-void create_string_repr<ArduinoSerialReadResult>(
+inline void create_string_repr<ArduinoSerialReadResult>(
         std::map<ArduinoSerialReadResult, std::string>& map)
 {
     using T = std::map<ArduinoSerialReadResult, std::string>;
@@ -77,5 +80,59 @@ void create_string_repr<ArduinoSerialReadResult>(
             {ArduinoSerialReadResult::ERROR_UNEXPECTED_DATA, "ERROR_UNEXPECTED_DATA"},
             {ArduinoSerialReadResult::ERROR_CHECKSUM, "ERROR_CHECKSUM"},
             {ArduinoSerialReadResult::ERROR_INSUFFICIENT_DATA_LENGTH, "ERROR_INSUFFICIENT_DATA_LENGTH"},
+            {ArduinoSerialReadResult::ERROR_BUFFER_TOO_SMALL, "ERROR_BUFFER_TOO_SMALL"},
     };
 }
+
+template <>
+inline void create_string_repr<ArduinoSerialProtocolState>(
+        std::map<ArduinoSerialProtocolState, std::string>& map)
+{
+    using T = std::map<ArduinoSerialProtocolState, std::string>;
+    map = T{
+            {ArduinoSerialProtocolState::UNDEFINED, "UNDEFINED"},
+            {ArduinoSerialProtocolState::WAITING_SYNC, "WAITING_SYNC"},
+            {ArduinoSerialProtocolState::IDLE, "IDLE"},
+            {ArduinoSerialProtocolState::READ_STROBE_2, "READ_STROBE_2"},
+            {ArduinoSerialProtocolState::READ_SYNC_STROBE_2, "READ_SYNC_STROBE_2"},
+            {ArduinoSerialProtocolState::READ_SYNC_STROBE_3, "READ_SYNC_STROBE_3"},
+            {ArduinoSerialProtocolState::READ_SYNC_STROBE_4, "READ_SYNC_STROBE_4"},
+            {ArduinoSerialProtocolState::WRITE_SYNC_REPLY, "WRITE_SYNC_REPLY"},
+            {ArduinoSerialProtocolState::READ_HEADER, "READ_HEADER"},
+            {ArduinoSerialProtocolState::READ_PAYLOAD, "READ_PAYLOAD"},
+            {ArduinoSerialProtocolState::SENDING_SYNC, "SENDING_SYNC"},
+            {ArduinoSerialProtocolState::READ_SYNC_REPLY_1, "READ_SYNC_REPLY_1"},
+            {ArduinoSerialProtocolState::READ_SYNC_REPLY_2, "READ_SYNC_REPLY_2"},
+            {ArduinoSerialProtocolState::READ_SYNC_REPLY_3, "READ_SYNC_REPLY_3"},
+            {ArduinoSerialProtocolState::READ_SYNC_REPLY_4, "READ_SYNC_REPLY_4"},
+            {ArduinoSerialProtocolState::READ_SYNC_PARAMS, "READ_SYNC_PARAMS"},
+            {ArduinoSerialProtocolState::READ_SYNC_REPLY_PARAMS, "READ_SYNC_REPLY_PARAMS"},
+            {ArduinoSerialProtocolState::READ_EXTENDED_HEADER, "READ_EXTENDED_HEADER"},
+            {ArduinoSerialProtocolState::READ_SHORT_HEADER, "READ_SHORT_HEADER"},
+    };
+}
+
+
+inline std::ostream& operator<<(std::ostream& os, ArduinoSerialGeneralResult result)
+{
+    os << StringInfo<ArduinoSerialGeneralResult>::toString(result);
+    return os;
+}
+
+inline std::ostream& operator<<(std::ostream& os, ArduinoSerialOperation operation)
+{
+    os << StringInfo<ArduinoSerialOperation>::toString(operation);
+    return os;
+}
+
+inline std::ostream& operator<<(std::ostream& os, ArduinoSerialReadResult result)
+{
+    os << StringInfo<ArduinoSerialReadResult>::toString(result);
+    return os;
+}
+
+inline std::ostream& operator<<(std::ostream& os, ArduinoSerialProtocolState state)
+{
+    os << StringInfo<ArduinoSerialProtocolState>::toString(state);
+    return os;
+}
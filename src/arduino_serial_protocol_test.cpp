@@ -1,8 +1,10 @@
 #include "gtest/gtest.h"
 
 #include "arduino_serial_protocol.h"
+#include "arduino_serial_protocol_impl.h"
 #include "arduino_serial_protocol_string.h"
 
+#include <algorithm>
 #include <memory.h>
 #include <ostream>
 #include <vector>
@@ -16,25 +18,6 @@ return testing::AssertionFailure() \
 << ", got " << _got << " line:" << __LINE__
 
 
-std::ostream& operator<<(std::ostream& os, ArduinoSerialGeneralResult result)
-{
-    os << StringInfo<ArduinoSerialGeneralResult>::toString(result);
-    return os;
-}
-
-std::ostream& operator<<(std::ostream& os, ArduinoSerialOperation operation)
-{
-    os << StringInfo<ArduinoSerialOperation>::toString(operation);
-    return os;
-}
-
-std::ostream& operator<<(std::ostream& os, ArduinoSerialReadResult result)
-{
-    os << StringInfo<ArduinoSerialReadResult>::toString(result);
-    return os;
-}
-
-
 const uint8_t SYNC_STROBE[] = {0xD3, 0x74, 0xE5, 0x52};
 
 
@@ -1010,39 +993,21 @@ TEST_F(FArduinoSerialProtocol, ReceivePacketExtensiveLength)
 
     auto result1 = protocol->readBytes(data, 16);
     ASSERT_EQ(ArduinoSerialReadResult::OK, result1.read_result);
-    ASSERT_EQ(1, result1.bytes_read);
+    ASSERT_EQ(protocol->headerSize(), result1.bytes_read);
 
     auto operation2 = protocol->nextOperation();
-    ASSERT_EQ(ArduinoSerialOperation::READ_HEADER, operation2.read_operation);
-    ASSERT_EQ(1, operation2.bytes_to_read);
-    ASSERT_EQ(0, operation2.id);
+    ASSERT_EQ(ArduinoSerialOperation::READ_PAYLOAD, operation2.read_operation);
+    ASSERT_EQ(4, operation2.bytes_to_read);
+    ASSERT_EQ(1, operation2.id);
 
-    auto result2 = protocol->readBytes(data + 1, 15);
+    auto result2 = protocol->readBytes(data + protocol->headerSize(), 8);
     ASSERT_EQ(ArduinoSerialReadResult::OK, result2.read_result);
-    ASSERT_EQ(1, result2.bytes_read);
+    ASSERT_EQ(4, result2.bytes_read);
 
     auto operation3 = protocol->nextOperation();
     ASSERT_EQ(ArduinoSerialOperation::READ_HEADER, operation3.read_operation);
-    ASSERT_EQ(protocol->headerSize() - 2, operation3.bytes_to_read);
+    ASSERT_EQ(1, operation3.bytes_to_read);
     ASSERT_EQ(0, operation3.id);
-
-    auto result3 = protocol->readBytes(data + 2, 14);
-    ASSERT_EQ(ArduinoSerialReadResult::OK, result3.read_result);
-    ASSERT_EQ(protocol->headerSize() - 2, result3.bytes_read);
-
-    auto operation4 = protocol->nextOperation();
-    ASSERT_EQ(ArduinoSerialOperation::READ_PAYLOAD, operation4.read_operation);
-    ASSERT_EQ(4, operation4.bytes_to_read);
-    ASSERT_EQ(1, operation4.id);
-
-    auto result4 = protocol->readBytes(data + protocol->headerSize(), 8);
-    ASSERT_EQ(ArduinoSerialReadResult::OK, result4.read_result);
-    ASSERT_EQ(4, result4.bytes_read);
-
-    auto operation5 = protocol->nextOperation();
-    ASSERT_EQ(ArduinoSerialOperation::READ_HEADER, operation5.read_operation);
-    ASSERT_EQ(1, operation5.bytes_to_read);
-    ASSERT_EQ(0, operation5.id);
 }
 
 TEST_F(FArduinoSerialProtocol, ReceivePacketsHeaderCRCError)
@@ -1243,3 +1208,1356 @@ TEST_F(FArduinoSerialProtocol, ReceivePacketsPayloadCRCError)
         ASSERT_EQ(0, operation5.id);
     }
 }
+
+TEST_F(FArduinoSerialProtocol, ReceivePacketsHeaderCRCErrorScan)
+{
+    ASSERT_TRUE(syncSecondary());
+
+    const uint8_t data[] = {
+            0xA5, 0x63, 0x00, 0x01,
+            0x04, 0x08, 0x24, 0xEA,
+            0x0A, 0x2B, 0x30, 0x45,
+            0x00, 0xA5, 0x00, 0xD3,
+            0x74, 0x00, 0x12, 0x34,
+            0xA5, 0x63, 0x00, 0x02,
+            0x04, 0x36, 0x95, 0x7F,
+            0x0A, 0x2B, 0x30, 0x45};
+
+    auto result1 = protocol->readBytes(data, 1);
+    ASSERT_EQ(ArduinoSerialReadResult::OK, result1.read_result);
+    auto result2 = protocol->readBytes(data + 1, 1);
+    ASSERT_EQ(ArduinoSerialReadResult::OK, result2.read_result);
+
+    auto result3 = protocol->readBytes(data + 2, protocol->headerSize() - 2);
+    ASSERT_EQ(ArduinoSerialReadResult::ERROR_CHECKSUM, result3.read_result);
+    ASSERT_EQ(4, result3.bytes_read);
+
+    auto result4 = protocol->readBytes(data + 6, sizeof(data) - 6);
+    ASSERT_EQ(ArduinoSerialReadResult::NOPE, result4.read_result);
+    ASSERT_EQ(14, result4.bytes_read);
+
+    auto operation1 = protocol->nextOperation();
+    ASSERT_EQ(ArduinoSerialOperation::READ_HEADER, operation1.read_operation);
+    ASSERT_EQ(1, operation1.bytes_to_read);
+
+    auto result5 = protocol->readBytes(data + 20, 1);
+    ASSERT_EQ(ArduinoSerialReadResult::OK, result5.read_result);
+    ASSERT_EQ(1, result5.bytes_read);
+
+    auto result6 = protocol->readBytes(data + 21, 1);
+    ASSERT_EQ(ArduinoSerialReadResult::OK, result6.read_result);
+
+    auto result7 = protocol->readBytes(data + 22, protocol->headerSize() - 2);
+    ASSERT_EQ(ArduinoSerialReadResult::OK, result7.read_result);
+
+    auto operation2 = protocol->nextOperation();
+    ASSERT_EQ(ArduinoSerialOperation::READ_PAYLOAD, operation2.read_operation);
+    ASSERT_EQ(4, operation2.bytes_to_read);
+    ASSERT_EQ(2, operation2.id);
+
+    auto result8 = protocol->readBytes(data + 28, 4);
+    ASSERT_EQ(ArduinoSerialReadResult::OK, result8.read_result);
+    ASSERT_EQ(4, result8.bytes_read);
+}
+
+TEST_F(FArduinoSerialProtocol, ReceivePacketWholeHeader)
+{
+    ASSERT_TRUE(syncSecondary());
+
+    const uint8_t data[] = {
+            0xA5, 0x63, 0x00, 0x01,
+            0x04, 0x09, 0x24, 0xEA,
+            0x0A, 0x2B, 0x30, 0x45};
+
+    auto result1 = protocol->readBytes(data, sizeof(data));
+    ASSERT_EQ(ArduinoSerialReadResult::OK, result1.read_result);
+    ASSERT_EQ(protocol->headerSize(), result1.bytes_read);
+
+    auto operation1 = protocol->nextOperation();
+    ASSERT_EQ(ArduinoSerialOperation::READ_PAYLOAD, operation1.read_operation);
+    ASSERT_EQ(4, operation1.bytes_to_read);
+    ASSERT_EQ(1, operation1.id);
+
+    auto result2 = protocol->readBytes(data + protocol->headerSize(), 4);
+    ASSERT_EQ(ArduinoSerialReadResult::OK, result2.read_result);
+    ASSERT_EQ(4, result2.bytes_read);
+
+    auto operation2 = protocol->nextOperation();
+    ASSERT_EQ(ArduinoSerialOperation::READ_HEADER, operation2.read_operation);
+    ASSERT_EQ(1, operation2.bytes_to_read);
+}
+
+TEST_F(FArduinoSerialProtocol, ReceivePacketWholeHeaderCRCError)
+{
+    ASSERT_TRUE(syncSecondary());
+
+    const uint8_t data[] = {
+            0xA5, 0x63, 0x00, 0x01,
+            0x04, 0x08, 0x24, 0xEA,
+            0x0A, 0x2B, 0x30, 0x45,
+            0xA5, 0x63, 0x00, 0x02,
+            0x04, 0x36, 0x95, 0x7F,
+            0x0A, 0x2B, 0x30, 0x45};
+
+    auto result1 = protocol->readBytes(data, sizeof(data));
+    ASSERT_EQ(ArduinoSerialReadResult::ERROR_CHECKSUM, result1.read_result);
+    ASSERT_EQ(6, result1.bytes_read);
+
+    auto result2 = protocol->readBytes(data + 6, sizeof(data) - 6);
+    ASSERT_EQ(ArduinoSerialReadResult::NOPE, result2.read_result);
+    ASSERT_EQ(6, result2.bytes_read);
+
+    auto result3 = protocol->readBytes(data + 12, sizeof(data) - 12);
+    ASSERT_EQ(ArduinoSerialReadResult::OK, result3.read_result);
+    ASSERT_EQ(protocol->headerSize(), result3.bytes_read);
+
+    auto operation1 = protocol->nextOperation();
+    ASSERT_EQ(ArduinoSerialOperation::READ_PAYLOAD, operation1.read_operation);
+    ASSERT_EQ(4, operation1.bytes_to_read);
+    ASSERT_EQ(2, operation1.id);
+}
+
+TEST_F(FArduinoSerialProtocol, ReceivePacketPayloadView)
+{
+    ASSERT_TRUE(syncSecondary());
+
+    const uint8_t data[] = {
+            0xA5, 0x63, 0x00, 0x01,
+            0x04, 0x09, 0x24, 0xEA,
+            0x0A, 0x2B, 0x30, 0x45};
+
+    auto result1 = protocol->readBytes(data, protocol->headerSize());
+    ASSERT_EQ(ArduinoSerialReadResult::OK, result1.read_result);
+    ASSERT_EQ(nullptr, result1.payload);
+    ASSERT_EQ(0, result1.payload_size);
+    ASSERT_EQ(0, result1.packet_id);
+
+    auto result2 = protocol->readBytes(data + protocol->headerSize(), 4);
+    ASSERT_EQ(ArduinoSerialReadResult::OK, result2.read_result);
+    ASSERT_EQ(4, result2.bytes_read);
+    ASSERT_EQ(data + protocol->headerSize(), result2.payload);
+    ASSERT_EQ(4, result2.payload_size);
+    ASSERT_EQ(1, result2.packet_id);
+}
+
+TEST_F(FArduinoSerialProtocol, ReceivePacketPayloadViewCRCError)
+{
+    ASSERT_TRUE(syncSecondary());
+
+    const uint8_t data[] = {
+            0xA5, 0x63, 0x00, 0x01,
+            0x04, 0x09, 0x24, 0xEA,
+            0x0A, 0x2B, 0x31, 0x45};
+
+    auto result1 = protocol->readBytes(data, protocol->headerSize());
+    ASSERT_EQ(ArduinoSerialReadResult::OK, result1.read_result);
+
+    auto result2 = protocol->readBytes(data + protocol->headerSize(), 4);
+    ASSERT_EQ(ArduinoSerialReadResult::ERROR_CHECKSUM, result2.read_result);
+    ASSERT_EQ(nullptr, result2.payload);
+    ASSERT_EQ(0, result2.payload_size);
+    ASSERT_EQ(0, result2.packet_id);
+}
+
+TEST(ArduinoSerialProtocol, PrimarySync)
+{
+    auto protocol = ArduinoSerialProtocol::createPrimary();
+
+    auto operation1 = protocol.nextOperation();
+    EXPECT_EQ(ArduinoSerialOperation::SEND_SYNC, operation1.read_operation);
+    EXPECT_EQ(0, operation1.bytes_to_read);
+
+    auto header = std::vector<uint8_t>(protocol.headerSize(), 0);
+    auto payload = std::vector<uint8_t>(2, 0);
+    EXPECT_EQ(ArduinoSerialGeneralResult::ERROR_NOT_SYNCED,
+              protocol.writeHeader(header.data(), 1, payload.data(), 2));
+
+    auto sync = std::vector<uint8_t>(protocol.syncHeaderSize(), 0);
+    EXPECT_EQ(ArduinoSerialGeneralResult::OK, protocol.writeSyncHeader(sync.data()));
+    EXPECT_EQ(std::vector<uint8_t>({0xD3, 0x74, 0xE5, 0x52}), sync);
+    EXPECT_EQ(ArduinoSerialGeneralResult::OK, protocol.syncSent());
+    EXPECT_EQ(ArduinoSerialGeneralResult::ERROR_WRONG_STATE, protocol.syncSent());
+
+    auto operation2 = protocol.nextOperation();
+    EXPECT_EQ(ArduinoSerialOperation::READ_HEADER, operation2.read_operation);
+    EXPECT_EQ(1, operation2.bytes_to_read);
+
+    // packets may be pipelined behind sync request
+    EXPECT_EQ(ArduinoSerialGeneralResult::OK,
+              protocol.writeHeader(header.data(), 1, payload.data(), 2));
+
+    const uint8_t reply[] = {0x00, 0xD3, 0x74, 0xE5, 0x25};
+    auto result1 = protocol.readBytes(reply, 1);
+    EXPECT_EQ(ArduinoSerialReadResult::ERROR_UNEXPECTED_DATA, result1.read_result);
+    for (size_t i = 1; i < sizeof(reply); ++i)
+    {
+        auto result = protocol.readBytes(reply + i, 1);
+        EXPECT_EQ(ArduinoSerialReadResult::OK, result.read_result);
+        EXPECT_EQ(1, result.bytes_read);
+    }
+
+    auto operation3 = protocol.nextOperation();
+    EXPECT_EQ(ArduinoSerialOperation::READ_HEADER, operation3.read_operation);
+    EXPECT_EQ(1, operation3.bytes_to_read);
+    EXPECT_EQ(ArduinoSerialGeneralResult::ERROR_WRONG_STATE, protocol.syncTimeout());
+
+    // late duplicate reply is skipped in IDLE
+    for (size_t i = 1; i < sizeof(reply); ++i)
+    {
+        auto result = protocol.readBytes(reply + i, 1);
+        EXPECT_EQ(ArduinoSerialReadResult::OK, result.read_result);
+    }
+    EXPECT_EQ(ArduinoSerialOperation::READ_HEADER,
+              protocol.nextOperation().read_operation);
+}
+
+TEST(ArduinoSerialProtocol, PrimarySyncTimeout)
+{
+    auto protocol = ArduinoSerialProtocol::createPrimary();
+    EXPECT_EQ(ArduinoSerialGeneralResult::OK, protocol.syncSent());
+
+    const uint8_t wrong_reply[] = {0xD3, 0x74, 0xE5, 0x52};
+    for (size_t i = 0; i < sizeof(wrong_reply) - 1; ++i)
+    {
+        auto result = protocol.readBytes(wrong_reply + i, 1);
+        EXPECT_EQ(ArduinoSerialReadResult::OK, result.read_result);
+    }
+    auto result = protocol.readBytes(wrong_reply + 3, 1);
+    EXPECT_EQ(ArduinoSerialReadResult::ERROR_UNEXPECTED_DATA, result.read_result);
+    EXPECT_EQ(ArduinoSerialOperation::READ_HEADER,
+              protocol.nextOperation().read_operation);
+
+    EXPECT_EQ(ArduinoSerialGeneralResult::OK, protocol.syncTimeout());
+    EXPECT_EQ(ArduinoSerialOperation::SEND_SYNC,
+              protocol.nextOperation().read_operation);
+    EXPECT_EQ(ArduinoSerialGeneralResult::OK, protocol.syncSent());
+}
+
+TEST(ArduinoSerialProtocol, PrimaryToSecondary)
+{
+    auto primary = ArduinoSerialProtocol::createPrimary();
+    auto secondary = ArduinoSerialProtocol::createSecondary();
+
+    // sync request and first packet go out in one write
+    const uint8_t payload[] = {0x0A, 0x2B, 0x30, 0x45};
+    std::vector<uint8_t> to_secondary(primary.syncHeaderSize()
+                                      + primary.packetSize(sizeof(payload)));
+    ASSERT_EQ(ArduinoSerialGeneralResult::OK,
+              primary.writeSyncHeader(to_secondary.data()));
+    ASSERT_EQ(ArduinoSerialGeneralResult::OK, primary.syncSent());
+    uint8_t* packet = to_secondary.data() + primary.syncHeaderSize();
+    ASSERT_EQ(ArduinoSerialGeneralResult::OK,
+              primary.writeHeader(packet, primary.createNextPacketId(),
+                                  payload, sizeof(payload)));
+    memcpy(packet + primary.headerSize(), payload, sizeof(payload));
+
+    size_t offset = 0;
+    for (; offset < primary.syncHeaderSize(); ++offset)
+        ASSERT_EQ(ArduinoSerialReadResult::OK,
+                  secondary.readBytes(to_secondary.data() + offset, 1).read_result);
+    ASSERT_EQ(ArduinoSerialOperation::SEND_SYNC_REPLY,
+              secondary.nextOperation().read_operation);
+
+    std::vector<uint8_t> to_primary(secondary.syncReplyHeaderSize());
+    ASSERT_EQ(ArduinoSerialGeneralResult::OK,
+              secondary.writeSyncReplyHeader(to_primary.data()));
+    ASSERT_EQ(ArduinoSerialGeneralResult::OK, secondary.syncReplySent());
+
+    auto header_result = secondary.readBytes(to_secondary.data() + offset,
+                                             to_secondary.size() - offset);
+    ASSERT_EQ(ArduinoSerialReadResult::OK, header_result.read_result);
+    offset += header_result.bytes_read;
+    auto payload_result = secondary.readBytes(to_secondary.data() + offset,
+                                              to_secondary.size() - offset);
+    ASSERT_EQ(ArduinoSerialReadResult::OK, payload_result.read_result);
+    ASSERT_EQ(1, payload_result.packet_id);
+    ASSERT_EQ(sizeof(payload), payload_result.payload_size);
+
+    for (size_t i = 0; i < to_primary.size(); ++i)
+        ASSERT_EQ(ArduinoSerialReadResult::OK,
+                  primary.readBytes(to_primary.data() + i, 1).read_result);
+    ASSERT_EQ(ArduinoSerialGeneralResult::ERROR_WRONG_STATE, primary.syncTimeout());
+    ASSERT_EQ(ArduinoSerialOperation::READ_HEADER,
+              primary.nextOperation().read_operation);
+}
+
+TEST_F(FArduinoSerialProtocol, CreatePacketFused)
+{
+    ASSERT_TRUE(syncSecondary());
+
+    for (size_t size : {0, 1, 4, 7, 8, 9, 64, 255})
+    {
+        std::vector<uint8_t> payload(size);
+        for (size_t i = 0; i < size; ++i)
+            payload[i] = static_cast<uint8_t>(i * 7 + 3);
+
+        auto expected = std::vector<uint8_t>(protocol->packetSize(size), 0);
+        ASSERT_EQ(ArduinoSerialGeneralResult::OK,
+                  protocol->writeHeader(expected.data(), 5, payload.data(), size));
+        std::copy(payload.begin(), payload.end(),
+                  expected.begin() + protocol->headerSize());
+
+        auto packet = std::vector<uint8_t>(protocol->packetSize(size), 0);
+        ASSERT_EQ(ArduinoSerialGeneralResult::OK,
+                  protocol->writePacket(packet.data(), 5, payload.data(), size));
+        ASSERT_EQ(expected, packet) << "payload size " << size;
+    }
+
+    auto packet = std::vector<uint8_t>(protocol->packetSize(256), 0);
+    EXPECT_EQ(ArduinoSerialGeneralResult::ERROR_PAYLOAD_SIZE_TOO_BIG,
+              protocol->writePacket(packet.data(), 1, packet.data(), 256));
+}
+
+TEST_F(FArduinoSerialProtocol, CreatePacketIov)
+{
+    auto header = std::vector<uint8_t>(protocol->headerSize(), 0);
+    const uint8_t payload[] = {0x0A, 0x2B, 0x30, 0x45};
+    struct iovec iov[2];
+
+    EXPECT_EQ(ArduinoSerialGeneralResult::ERROR_NOT_SYNCED,
+              protocol->writeHeaderIov(header.data(), iov, 1,
+                                       payload, sizeof(payload)));
+
+    ASSERT_TRUE(syncSecondary());
+
+    ASSERT_EQ(ArduinoSerialGeneralResult::OK,
+              protocol->writeHeaderIov(header.data(), iov, 1,
+                                       payload, sizeof(payload)));
+    EXPECT_EQ(std::vector<uint8_t>({0xA5, 0x63, 0x00, 0x01, 0x04, 0x09, 0x24, 0xEA}),
+              header);
+    EXPECT_EQ(header.data(), iov[0].iov_base);
+    EXPECT_EQ(protocol->headerSize(), iov[0].iov_len);
+    EXPECT_EQ(payload, iov[1].iov_base);
+    EXPECT_EQ(sizeof(payload), iov[1].iov_len);
+}
+
+TEST_F(FArduinoSerialProtocol, CreatePacketBatch)
+{
+    ASSERT_TRUE(syncSecondary());
+
+    const uint8_t payload1[] = {0x0A, 0x2B, 0x30, 0x45};
+    const uint8_t payload2[] = {0x01};
+    const ArduinoSerialPayload payloads[] = {
+            {payload1, sizeof(payload1)},
+            {nullptr, 0},
+            {payload2, sizeof(payload2)}};
+
+    const size_t size = protocol->batchSize(payloads, 3);
+    ASSERT_EQ(3 * protocol->headerSize() + 5, size);
+
+    auto buffer = std::vector<uint8_t>(size, 0);
+    auto result = protocol->writePackets(buffer.data(), buffer.size(), payloads, 3);
+    EXPECT_EQ(ArduinoSerialGeneralResult::OK, result.result);
+    EXPECT_EQ(3, result.packets_written);
+    EXPECT_EQ(size, result.bytes_written);
+    EXPECT_EQ(1, result.first_id);
+
+    const uint8_t expected_first[] = {
+            0xA5, 0x63, 0x00, 0x01,
+            0x04, 0x09, 0x24, 0xEA,
+            0x0A, 0x2B, 0x30, 0x45};
+    EXPECT_TRUE(std::equal(expected_first, expected_first + sizeof(expected_first),
+                           buffer.begin()));
+
+    size_t offset = 0;
+    for (ArduinoSerialProtocolID id = 1; id <= 3; ++id)
+    {
+        auto header_result = protocol->readBytes(buffer.data() + offset,
+                                                 buffer.size() - offset);
+        ASSERT_EQ(ArduinoSerialReadResult::OK, header_result.read_result);
+        offset += header_result.bytes_read;
+        auto payload_result = protocol->readBytes(buffer.data() + offset,
+                                                  buffer.size() - offset);
+        ASSERT_EQ(ArduinoSerialReadResult::OK, payload_result.read_result);
+        ASSERT_EQ(id, payload_result.packet_id);
+        ASSERT_EQ(payloads[id - 1].size, payload_result.payload_size);
+        offset += payload_result.bytes_read;
+    }
+    EXPECT_EQ(size, offset);
+}
+
+TEST_F(FArduinoSerialProtocol, CreatePacketBatchErrors)
+{
+    const uint8_t payload[] = {0x0A, 0x2B, 0x30, 0x45};
+    const ArduinoSerialPayload payloads[] = {
+            {payload, sizeof(payload)},
+            {payload, sizeof(payload)},
+            {payload, 256}};
+    auto buffer = std::vector<uint8_t>(protocol->batchSize(payloads, 3), 0);
+
+    auto result1 = protocol->writePackets(buffer.data(), buffer.size(), payloads, 2);
+    EXPECT_EQ(ArduinoSerialGeneralResult::ERROR_NOT_SYNCED, result1.result);
+    EXPECT_EQ(0, result1.packets_written);
+
+    ASSERT_TRUE(syncSecondary());
+
+    auto result2 = protocol->writePackets(buffer.data(),
+                                          protocol->packetSize(sizeof(payload)) + 1,
+                                          payloads, 2);
+    EXPECT_EQ(ArduinoSerialGeneralResult::ERROR_BUFFER_TOO_SMALL, result2.result);
+    EXPECT_EQ(1, result2.packets_written);
+    EXPECT_EQ(protocol->packetSize(sizeof(payload)), result2.bytes_written);
+    EXPECT_EQ(1, result2.first_id);
+
+    auto result3 = protocol->writePackets(buffer.data(), buffer.size(), payloads, 3);
+    EXPECT_EQ(ArduinoSerialGeneralResult::ERROR_PAYLOAD_SIZE_TOO_BIG, result3.result);
+    EXPECT_EQ(2, result3.packets_written);
+    EXPECT_EQ(2, result3.first_id);
+    EXPECT_EQ(4, protocol->createNextPacketId());
+}
+
+#if ARDUINO_SERIAL_STATS
+TEST_F(FArduinoSerialProtocol, Stats)
+{
+    ASSERT_TRUE(syncSecondary());
+
+    auto stats1 = protocol->stats();
+    EXPECT_EQ(1, stats1.syncs);
+    EXPECT_EQ(0, stats1.resyncs);
+    EXPECT_EQ(sizeof(SYNC_STROBE), stats1.bytes_in);
+    EXPECT_EQ(protocol->syncReplyHeaderSize(), stats1.bytes_out);
+
+    // header CRC error, 14 bytes skipped looking for strobe, good packet
+    const uint8_t data[] = {
+            0xA5, 0x63, 0x00, 0x01,
+            0x04, 0x08, 0x24, 0xEA,
+            0x0A, 0x2B, 0x30, 0x45,
+            0x00, 0xA5, 0x00, 0xD3,
+            0x74, 0x00, 0x12, 0x34,
+            0xA5, 0x63, 0x00, 0x02,
+            0x04, 0x36, 0x95, 0x7F,
+            0x0A, 0x2B, 0x30, 0x45};
+    size_t offset = 0;
+    while (offset < sizeof(data))
+        offset += protocol->readBytes(data + offset, sizeof(data) - offset).bytes_read;
+
+    auto stats2 = protocol->stats();
+    EXPECT_EQ(1, stats2.packets_ok);
+    EXPECT_EQ(1, stats2.header_crc_errors);
+    EXPECT_EQ(0, stats2.payload_crc_errors);
+    EXPECT_EQ(14, stats2.bytes_discarded);
+    EXPECT_EQ(sizeof(SYNC_STROBE) + sizeof(data), stats2.bytes_in);
+
+    const uint8_t payload[] = {0x0A, 0x2B, 0x30, 0x45};
+    auto packet = std::vector<uint8_t>(protocol->packetSize(sizeof(payload)), 0);
+    ASSERT_EQ(ArduinoSerialGeneralResult::OK,
+              protocol->writePacket(packet.data(), 3, payload, sizeof(payload)));
+    packet.back() ^= 0xFF;
+    offset = 0;
+    while (offset < packet.size())
+        offset += protocol->readBytes(packet.data() + offset, packet.size() - offset).bytes_read;
+
+    auto stats3 = protocol->stats();
+    EXPECT_EQ(1, stats3.packets_ok);
+    EXPECT_EQ(1, stats3.payload_crc_errors);
+    EXPECT_EQ(protocol->syncReplyHeaderSize() + packet.size(), stats3.bytes_out);
+
+    ASSERT_TRUE(syncSecondary());
+    auto stats4 = protocol->stats();
+    EXPECT_EQ(2, stats4.syncs);
+    EXPECT_EQ(1, stats4.resyncs);
+}
+#endif
+
+namespace
+{
+
+struct RecordingHooks : public ArduinoSerialNoHooks
+{
+    using Transition = std::pair<ArduinoSerialProtocolState, ArduinoSerialProtocolState>;
+
+    void onTransition(ArduinoSerialProtocolState from, ArduinoSerialProtocolState to)
+    { transitions->push_back(Transition{from, to}); }
+
+    void onPacket(ArduinoSerialProtocolID id, const void*, size_t payload_size)
+    { packets->push_back(std::make_pair(id, payload_size)); }
+
+    void onError(ArduinoSerialProtocolState state, ArduinoSerialReadResult error)
+    { errors->push_back(std::make_pair(state, error)); }
+
+    std::vector<Transition>* transitions;
+    std::vector<std::pair<ArduinoSerialProtocolID, size_t>>* packets;
+    std::vector<std::pair<ArduinoSerialProtocolState, ArduinoSerialReadResult>>* errors;
+};
+
+}
+
+TEST(ArduinoSerialProtocol, Hooks)
+{
+    using State = ArduinoSerialProtocolState;
+
+    std::vector<RecordingHooks::Transition> transitions;
+    std::vector<std::pair<ArduinoSerialProtocolID, size_t>> packets;
+    std::vector<std::pair<State, ArduinoSerialReadResult>> errors;
+    RecordingHooks hooks;
+    hooks.transitions = &transitions;
+    hooks.packets = &packets;
+    hooks.errors = &errors;
+
+    using Protocol = ArduinoSerialProtocolT<ArduinoSerialHooksConfig<RecordingHooks>>;
+    auto protocol = Protocol::createSecondary(hooks);
+    for (size_t i = 0; i < sizeof(SYNC_STROBE); ++i)
+        protocol.readBytes(&SYNC_STROBE[i], 1);
+    ASSERT_EQ(ArduinoSerialGeneralResult::OK, protocol.syncReplySent());
+
+    const std::vector<RecordingHooks::Transition> sync_transitions = {
+            {State::WAITING_SYNC, State::READ_SYNC_STROBE_2},
+            {State::READ_SYNC_STROBE_2, State::READ_SYNC_STROBE_3},
+            {State::READ_SYNC_STROBE_3, State::READ_SYNC_STROBE_4},
+            {State::READ_SYNC_STROBE_4, State::WRITE_SYNC_REPLY},
+            {State::WRITE_SYNC_REPLY, State::IDLE}};
+    EXPECT_EQ(sync_transitions, transitions);
+    transitions.clear();
+
+    const uint8_t payload[] = {0x0A, 0x2B, 0x30, 0x45};
+    std::vector<uint8_t> packet(protocol.packetSize(sizeof(payload)));
+    protocol.writePacket(packet.data(), 7, payload, sizeof(payload));
+    protocol.readBytes(packet.data(), packet.size());
+    protocol.readBytes(packet.data() + protocol.headerSize(), sizeof(payload));
+
+    const std::vector<RecordingHooks::Transition> packet_transitions = {
+            {State::IDLE, State::READ_PAYLOAD},
+            {State::READ_PAYLOAD, State::IDLE}};
+    EXPECT_EQ(packet_transitions, transitions);
+    ASSERT_EQ(1u, packets.size());
+    EXPECT_EQ(7, packets[0].first);
+    EXPECT_EQ(sizeof(payload), packets[0].second);
+    EXPECT_TRUE(errors.empty());
+
+    packet.back() ^= 0xFF;
+    protocol.readBytes(packet.data(), packet.size());
+    protocol.readBytes(packet.data() + protocol.headerSize(), sizeof(payload));
+    const uint8_t garbage = 0x00;
+    protocol.readBytes(&garbage, 1);
+
+    ASSERT_EQ(2u, errors.size());
+    EXPECT_EQ(State::READ_PAYLOAD, errors[0].first);
+    EXPECT_EQ(ArduinoSerialReadResult::ERROR_CHECKSUM, errors[0].second);
+    EXPECT_EQ(State::IDLE, errors[1].first);
+    EXPECT_EQ(ArduinoSerialReadResult::ERROR_UNEXPECTED_DATA, errors[1].second);
+    EXPECT_EQ(1u, packets.size());
+}
+
+TEST(ArduinoSerialProtocol, HooksSplitPacket)
+{
+    std::vector<RecordingHooks::Transition> transitions;
+    std::vector<std::pair<ArduinoSerialProtocolID, size_t>> packets;
+    std::vector<std::pair<ArduinoSerialProtocolState, ArduinoSerialReadResult>> errors;
+    RecordingHooks hooks;
+    hooks.transitions = &transitions;
+    hooks.packets = &packets;
+    hooks.errors = &errors;
+
+    using Protocol = ArduinoSerialProtocolT<ArduinoSerialHooksConfig<RecordingHooks>>;
+    auto protocol = Protocol::createSecondary(hooks);
+    for (size_t i = 0; i < sizeof(SYNC_STROBE); ++i)
+        protocol.readBytes(&SYNC_STROBE[i], 1);
+    ASSERT_EQ(ArduinoSerialGeneralResult::OK, protocol.syncReplySent());
+
+    const uint8_t payload[] = {0x0A, 0x2B, 0x30, 0x45};
+    std::vector<uint8_t> packet(protocol.packetSize(sizeof(payload)));
+    protocol.writePacket(packet.data(), 7, payload, sizeof(payload));
+
+    // first read ends inside the header, the rest comes with the next one
+    const size_t split = protocol.headerSize() - 2;
+    size_t offset = 0;
+    ArduinoSerialReceiveResult result;
+    do
+    {
+        result = protocol.readBytes(packet.data() + offset, split - offset);
+        offset += result.bytes_read;
+    }
+    while (result.read_result == ArduinoSerialReadResult::OK);
+    EXPECT_EQ(ArduinoSerialReadResult::ERROR_INSUFFICIENT_DATA_LENGTH, result.read_result);
+
+    while (offset < packet.size())
+        offset += protocol.readBytes(packet.data() + offset,
+                                     packet.size() - offset).bytes_read;
+
+    ASSERT_EQ(1u, packets.size());
+    EXPECT_EQ(7, packets[0].first);
+    EXPECT_TRUE(errors.empty());
+}
+
+namespace
+{
+
+// Runs stream through protocol in chunks of up to step bytes, returns
+// payloads read
+template<typename Protocol>
+std::vector<std::vector<uint8_t>> feed(Protocol& protocol,
+                                       const std::vector<uint8_t>& stream,
+                                       size_t step = SIZE_MAX)
+{
+    std::vector<std::vector<uint8_t>> payloads;
+    size_t offset = 0;
+    for (;;)
+    {
+        const ArduinoSerialOperation operation = protocol.nextOperation().read_operation;
+        if (operation == ArduinoSerialOperation::READ_HEADER && offset == stream.size())
+            break;
+        if (operation != ArduinoSerialOperation::READ_HEADER
+            && operation != ArduinoSerialOperation::READ_PAYLOAD)
+            break;
+        const size_t size = std::min(step, stream.size() - offset);
+        const auto result = protocol.readBytes(stream.data() + offset, size);
+        // a COBS payload is decoded with its frame and takes no more bytes,
+        // strobe framing stops here at the end of stream
+        if (result.bytes_read == 0
+            && result.read_result == ArduinoSerialReadResult::ERROR_INSUFFICIENT_DATA_LENGTH)
+            break;
+        if (result.read_result == ArduinoSerialReadResult::OK
+            && operation == ArduinoSerialOperation::READ_PAYLOAD)
+        {
+            const uint8_t* payload = static_cast<const uint8_t*>(result.payload);
+            payloads.emplace_back(payload, payload + result.payload_size);
+        }
+        offset += result.bytes_read;
+    }
+    return payloads;
+}
+
+template<typename Protocol>
+void sync_link(Protocol& primary, Protocol& secondary, size_t step = SIZE_MAX)
+{
+    std::vector<uint8_t> request(primary.syncHeaderSize());
+    primary.writeSyncHeader(request.data());
+    primary.syncSent();
+    feed(secondary, request, step);
+
+    std::vector<uint8_t> reply(secondary.syncReplyHeaderSize());
+    secondary.writeSyncReplyHeader(reply.data());
+    secondary.syncReplySent();
+    feed(primary, reply, step);
+}
+
+std::vector<uint8_t> make_payload(size_t size)
+{
+    std::vector<uint8_t> payload(size);
+    for (size_t i = 0; i < size; ++i)
+        payload[i] = static_cast<uint8_t>(i * 13 + 5);
+    return payload;
+}
+
+}
+
+namespace
+{
+
+struct CompactConfig : ArduinoSerialDefaultConfig
+{
+    static constexpr const uint8_t STROBE_1 = 0x7E;
+    static constexpr const uint8_t STROBE_2 = 0x81;
+    static constexpr const uint8_t SYNC_STROBE_1 = 0xC3;
+    static constexpr const size_t ID_SIZE = 1;
+    static constexpr const size_t MAX_PAYLOAD_SIZE = 32;
+    static constexpr const ArduinoSerialChecksum CHECKSUM = ArduinoSerialChecksum::CRC8;
+};
+
+using CompactProtocol = ArduinoSerialProtocolT<CompactConfig>;
+
+}
+
+TEST(ArduinoSerialProtocol, CompileTimeConfig)
+{
+    auto primary = CompactProtocol::createPrimary();
+    auto secondary = CompactProtocol::createSecondary();
+    EXPECT_EQ(6u, secondary.headerSize());
+
+    sync_link(primary, secondary, 1);
+    ASSERT_TRUE(primary.isSynced());
+    ASSERT_TRUE(secondary.isSynced());
+
+    const uint8_t payload[] = {0x0A, 0x2B, 0x30, 0x45, 0x7E};
+    std::vector<uint8_t> packet(primary.packetSize(sizeof(payload)));
+    ASSERT_EQ(ArduinoSerialGeneralResult::OK,
+              primary.writePacket(packet.data(), 0xAB, payload, sizeof(payload)));
+    EXPECT_EQ(0x7E, packet[0]);
+    EXPECT_EQ(0x81, packet[1]);
+    EXPECT_EQ(0xAB, packet[2]);
+    EXPECT_EQ(sizeof(payload), packet[3]);
+
+    // leading garbage with default strobes is skipped byte by byte
+    std::vector<uint8_t> stream = {0xA5, 0x63, 0x00};
+    stream.insert(stream.end(), packet.begin(), packet.end());
+    size_t offset = 0;
+    ArduinoSerialReceiveResult result;
+    do
+    {
+        result = secondary.readBytes(stream.data() + offset, stream.size() - offset);
+        offset += result.bytes_read;
+    } while (result.read_result != ArduinoSerialReadResult::OK
+             || secondary.nextOperation().read_operation != ArduinoSerialOperation::READ_PAYLOAD);
+    EXPECT_EQ(stream.size() - sizeof(payload), offset);
+
+    result = secondary.readBytes(stream.data() + offset, stream.size() - offset);
+    ASSERT_EQ(ArduinoSerialReadResult::OK, result.read_result);
+    EXPECT_EQ(0xAB, result.packet_id);
+    ASSERT_EQ(sizeof(payload), result.payload_size);
+    EXPECT_EQ(0, memcmp(payload, result.payload, sizeof(payload)));
+
+    packet.back() ^= 0x01;
+    secondary.readBytes(packet.data(), packet.size());
+    result = secondary.readBytes(packet.data() + secondary.headerSize(), sizeof(payload));
+    EXPECT_EQ(ArduinoSerialReadResult::ERROR_CHECKSUM, result.read_result);
+
+    uint8_t big[CompactProtocol::MAX_PAYLOAD_SIZE + 1] = {};
+    std::vector<uint8_t> big_packet(primary.packetSize(sizeof(big)));
+    EXPECT_EQ(ArduinoSerialGeneralResult::ERROR_PAYLOAD_SIZE_TOO_BIG,
+              primary.writePacket(big_packet.data(), 1, big, sizeof(big)));
+    EXPECT_EQ(ArduinoSerialGeneralResult::OK,
+              primary.writePacket(big_packet.data(), 1, big, sizeof(big) - 1));
+}
+
+TEST(ArduinoSerialProtocol, CompileTimeConfigIdWraps)
+{
+    auto primary = CompactProtocol::createPrimary();
+    for (int i = 1; i <= 255; ++i)
+        ASSERT_EQ(i, primary.createNextPacketId());
+    EXPECT_EQ(1, primary.createNextPacketId());
+    EXPECT_EQ(2, primary.createNextPacketId());
+}
+
+#if ARDUINO_SERIAL_MAX_EXTENDED_PAYLOAD > 255
+TEST(ArduinoSerialProtocol, ExtendedFrames)
+{
+    auto primary = ArduinoSerialProtocol::createPrimary();
+    auto secondary = ArduinoSerialProtocol::createSecondary();
+    primary.setFeatures(ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES);
+    secondary.setFeatures(ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES);
+
+    EXPECT_EQ(8u, primary.syncHeaderSize());
+    sync_link(primary, secondary);
+    ASSERT_TRUE(primary.isSynced());
+    ASSERT_TRUE(secondary.isSynced());
+    EXPECT_EQ(ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES, primary.features());
+    EXPECT_EQ(ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES, secondary.features());
+    EXPECT_EQ(ARDUINO_SERIAL_MAX_EXTENDED_PAYLOAD, primary.maxPayloadSize());
+
+    // small payloads keep the classic header
+    EXPECT_EQ(8u + 255, primary.packetSize(255));
+    EXPECT_EQ(11u + 1000, primary.packetSize(1000));
+
+    const auto payload = make_payload(1000);
+    std::vector<uint8_t> stream(primary.packetSize(payload.size()));
+    ASSERT_EQ(ArduinoSerialGeneralResult::OK,
+              primary.writePacket(stream.data(), 0x1234, payload.data(), payload.size()));
+    EXPECT_EQ(std::vector<uint8_t>({0xA5, 0x9C, 0x12, 0x34, 0x03, 0xE8}),
+              std::vector<uint8_t>(stream.begin(), stream.begin() + 6));
+
+    std::vector<uint8_t> header(primary.dataHeaderSize(payload.size()));
+    ASSERT_EQ(ArduinoSerialGeneralResult::OK,
+              primary.writeHeader(header.data(), 0x1234, payload.data(), payload.size()));
+    EXPECT_EQ(header, std::vector<uint8_t>(stream.begin(), stream.begin() + header.size()));
+
+    const auto small = make_payload(4);
+    const size_t offset = stream.size();
+    stream.resize(offset + primary.packetSize(small.size()));
+    primary.writePacket(stream.data() + offset, 0x1235, small.data(), small.size());
+
+    const auto packets = feed(secondary, stream);
+    ASSERT_EQ(2, packets.size());
+    EXPECT_EQ(payload, packets[0]);
+    EXPECT_EQ(small, packets[1]);
+
+    std::vector<uint8_t> reverse(secondary.packetSize(payload.size()));
+    ASSERT_EQ(ArduinoSerialGeneralResult::OK,
+              secondary.writePacket(reverse.data(), 7, payload.data(), payload.size()));
+    const auto reverse_packets = feed(primary, reverse);
+    ASSERT_EQ(1, reverse_packets.size());
+    EXPECT_EQ(payload, reverse_packets[0]);
+
+    EXPECT_EQ(ArduinoSerialGeneralResult::ERROR_PAYLOAD_SIZE_TOO_BIG,
+              primary.writePacket(stream.data(), 1, nullptr,
+                                  ARDUINO_SERIAL_MAX_EXTENDED_PAYLOAD + 1));
+}
+#endif
+
+TEST(ArduinoSerialProtocol, ExtendedFramesNotAgreed)
+{
+    auto primary = ArduinoSerialProtocol::createPrimary();
+    auto secondary = ArduinoSerialProtocol::createSecondary();
+    primary.setFeatures(ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES);
+
+    sync_link(primary, secondary);
+    ASSERT_TRUE(primary.isSynced());
+    ASSERT_TRUE(secondary.isSynced());
+    EXPECT_EQ(0, primary.features());
+    EXPECT_EQ(0, secondary.features());
+    EXPECT_EQ(255u, primary.maxPayloadSize());
+
+    const auto payload = make_payload(1000);
+    std::vector<uint8_t> packet(primary.packetSize(payload.size()));
+    EXPECT_EQ(ArduinoSerialGeneralResult::ERROR_PAYLOAD_SIZE_TOO_BIG,
+              primary.writePacket(packet.data(), 1, payload.data(), payload.size()));
+}
+
+#if ARDUINO_SERIAL_MAX_EXTENDED_PAYLOAD > 255
+TEST(ArduinoSerialProtocol, ExtendedFramesAlternateSync)
+{
+    auto primary = ArduinoSerialProtocol::createPrimary();
+    primary.setFeatures(ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES);
+
+    std::vector<uint8_t> request(primary.syncHeaderSize());
+    primary.writeSyncHeader(request.data());
+    EXPECT_EQ(0xAD, request[3]);
+    primary.syncSent();
+
+    // peer without parameters did not answer, next request is a plain one
+    ASSERT_EQ(ArduinoSerialGeneralResult::OK, primary.syncTimeout());
+    ASSERT_EQ(4u, primary.syncHeaderSize());
+    request.resize(primary.syncHeaderSize());
+    primary.writeSyncHeader(request.data());
+    EXPECT_EQ(std::vector<uint8_t>({0xD3, 0x74, 0xE5, 0x52}), request);
+    primary.syncSent();
+
+    const std::vector<uint8_t> reply = {0xD3, 0x74, 0xE5, 0x25};
+    feed(primary, reply);
+    EXPECT_TRUE(primary.isSynced());
+    EXPECT_EQ(0, primary.features());
+}
+
+TEST(ArduinoSerialProtocol, ExtendedFramesErrors)
+{
+    auto primary = ArduinoSerialProtocol::createPrimary();
+    auto secondary = ArduinoSerialProtocol::createSecondary();
+    primary.setFeatures(ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES);
+    secondary.setFeatures(ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES);
+
+    // corrupted parameters are a checksum error, request is dropped
+    std::vector<uint8_t> request(primary.syncHeaderSize());
+    primary.writeSyncHeader(request.data());
+    request[4] ^= 0x02;
+    feed(secondary, request);
+    EXPECT_EQ(ArduinoSerialOperation::READ_HEADER, secondary.nextOperation().read_operation);
+    EXPECT_FALSE(secondary.isSynced());
+#if ARDUINO_SERIAL_STATS
+    EXPECT_EQ(1u, secondary.stats().header_crc_errors);
+#endif
+
+    sync_link(primary, secondary);
+    ASSERT_EQ(ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES, secondary.features());
+
+    const auto payload = make_payload(600);
+    std::vector<uint8_t> stream(primary.packetSize(payload.size()));
+    primary.writePacket(stream.data(), 1, payload.data(), payload.size());
+    stream[400] ^= 0x10;
+    const auto small = make_payload(3);
+    const size_t offset = stream.size();
+    stream.resize(offset + primary.packetSize(small.size()));
+    primary.writePacket(stream.data() + offset, 2, small.data(), small.size());
+
+    const auto packets = feed(secondary, stream);
+    ASSERT_EQ(1, packets.size());
+    EXPECT_EQ(small, packets[0]);
+#if ARDUINO_SERIAL_STATS
+    EXPECT_EQ(1u, secondary.stats().payload_crc_errors);
+#endif
+}
+#else
+TEST(ArduinoSerialProtocol, ExtendedFramesNotBuilt)
+{
+    auto primary = ArduinoSerialProtocol::createPrimary();
+    auto secondary = ArduinoSerialProtocol::createSecondary();
+    primary.setFeatures(ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES
+                        | ARDUINO_SERIAL_FEATURE_SHORT_FRAMES);
+    secondary.setFeatures(ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES
+                          | ARDUINO_SERIAL_FEATURE_SHORT_FRAMES);
+
+    // not offered by this build
+    std::vector<uint8_t> request(primary.syncHeaderSize());
+    primary.writeSyncHeader(request.data());
+    EXPECT_EQ(ARDUINO_SERIAL_FEATURE_SHORT_FRAMES, request[4]);
+
+    // and refused when a peer offers it
+    request[4] = ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES | ARDUINO_SERIAL_FEATURE_SHORT_FRAMES;
+    const size_t params_crc = ArduinoSerialProtocol::SYNC_PARAMS_SIZE - 1;
+    request[4 + params_crc] = arduino_serial_crc8(0, request.data() + 4, params_crc);
+    feed(secondary, request);
+    ASSERT_EQ(ArduinoSerialOperation::SEND_SYNC_REPLY,
+              secondary.nextOperation().read_operation);
+    std::vector<uint8_t> reply(secondary.syncReplyHeaderSize());
+    secondary.writeSyncReplyHeader(reply.data());
+    EXPECT_EQ(ARDUINO_SERIAL_FEATURE_SHORT_FRAMES, reply[4]);
+    secondary.syncReplySent();
+    EXPECT_EQ(ARDUINO_SERIAL_FEATURE_SHORT_FRAMES, secondary.features());
+    EXPECT_EQ(255u, secondary.maxPayloadSize());
+}
+#endif
+
+TEST(ArduinoSerialProtocol, ShortFrames)
+{
+    auto primary = ArduinoSerialProtocol::createPrimary();
+    auto secondary = ArduinoSerialProtocol::createSecondary();
+    primary.setFeatures(ARDUINO_SERIAL_FEATURE_SHORT_FRAMES);
+    secondary.setFeatures(ARDUINO_SERIAL_FEATURE_SHORT_FRAMES
+                          | ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES);
+
+    sync_link(primary, secondary);
+    ASSERT_EQ(ARDUINO_SERIAL_FEATURE_SHORT_FRAMES, primary.features());
+    ASSERT_EQ(ARDUINO_SERIAL_FEATURE_SHORT_FRAMES, secondary.features());
+
+    EXPECT_EQ(6u, primary.dataHeaderSize(4));
+    EXPECT_EQ(6u + 16, primary.packetSize(16));
+    EXPECT_EQ(8u + 17, primary.packetSize(17));
+
+    const auto payload = make_payload(4);
+    std::vector<uint8_t> packet(primary.packetSize(payload.size()));
+    ASSERT_EQ(ArduinoSerialGeneralResult::OK,
+              primary.writePacket(packet.data(), 0x1234, payload.data(), payload.size()));
+    EXPECT_EQ(std::vector<uint8_t>({0xA5, 0xC6, 0x34, 0x04}),
+              std::vector<uint8_t>(packet.begin(), packet.begin() + 4));
+
+    std::vector<uint8_t> header(primary.dataHeaderSize(payload.size()));
+    ASSERT_EQ(ArduinoSerialGeneralResult::OK,
+              primary.writeHeader(header.data(), 0x1234, payload.data(), payload.size()));
+    EXPECT_EQ(header, std::vector<uint8_t>(packet.begin(), packet.begin() + header.size()));
+}
+
+TEST(ArduinoSerialProtocol, ShortFramesIds)
+{
+    auto primary = ArduinoSerialProtocol::createPrimary();
+    auto secondary = ArduinoSerialProtocol::createSecondary();
+    primary.setFeatures(ARDUINO_SERIAL_FEATURE_SHORT_FRAMES);
+    secondary.setFeatures(ARDUINO_SERIAL_FEATURE_SHORT_FRAMES);
+    sync_link(primary, secondary);
+
+    // wrap of the ID range, a low byte of 0 and ID 0 used for ACKs
+    const std::vector<ArduinoSerialProtocolID> ids = {
+            0xFFFD, 0xFFFF, 1, 2, 0x80, 0xFF, 0, 0x100, 0x101, 0x17F, 0x1F0};
+    const auto payload = make_payload(3);
+    std::vector<uint8_t> stream;
+    for (const auto id : ids)
+    {
+        const size_t offset = stream.size();
+        stream.resize(offset + primary.packetSize(payload.size(), id));
+        primary.writePacket(stream.data() + offset, id, payload.data(), payload.size());
+        // only ID 0 goes with the full header
+        EXPECT_EQ(id == 0 ? 0x63 : 0xC6, stream[offset + 1]);
+    }
+    EXPECT_EQ(primary.packetSize(payload.size()) + 2, primary.packetSize(payload.size(), 0));
+
+    std::vector<ArduinoSerialProtocolID> received;
+    size_t offset = 0;
+    while (offset < stream.size())
+    {
+        const auto operation = secondary.nextOperation();
+        const auto result = secondary.readBytes(stream.data() + offset,
+                                                stream.size() - offset);
+        ASSERT_EQ(ArduinoSerialReadResult::OK, result.read_result);
+        if (operation.read_operation == ArduinoSerialOperation::READ_PAYLOAD)
+            received.push_back(result.packet_id);
+        offset += result.bytes_read;
+    }
+    EXPECT_EQ(ids, received);
+}
+
+TEST(ArduinoSerialProtocol, ShortFramesAfterResync)
+{
+    std::unique_ptr<ArduinoSerialProtocol> primary;
+    auto secondary = ArduinoSerialProtocol::createSecondary();
+    secondary.setFeatures(ARDUINO_SERIAL_FEATURE_SHORT_FRAMES);
+
+    // IDs run far past the 128 a low byte can tell apart, in both
+    // directions, before the host restarts and syncs again
+    const auto payload = make_payload(4);
+    for (int round = 0; round < 3; ++round)
+    {
+        primary.reset(new ArduinoSerialProtocol{ArduinoSerialProtocol::createPrimary()});
+        primary->setFeatures(ARDUINO_SERIAL_FEATURE_SHORT_FRAMES);
+        sync_link(*primary, secondary);
+        ASSERT_TRUE(primary->isSynced());
+
+        for (auto* sender : {primary.get(), &secondary})
+        {
+            auto& receiver = sender == primary.get() ? secondary : *primary;
+            std::vector<uint8_t> stream;
+            for (int i = 0; i < 200; ++i)
+            {
+                const size_t offset = stream.size();
+                stream.resize(offset + sender->packetSize(payload.size()));
+                sender->writePacket(stream.data() + offset, sender->createNextPacketId(),
+                                    payload.data(), payload.size());
+            }
+            ASSERT_EQ(200u * (6 + 4), stream.size());
+            EXPECT_EQ(200u, feed(receiver, stream).size()) << round;
+        }
+    }
+}
+
+TEST(ArduinoSerialProtocol, ShortFramesAfterSyncRetry)
+{
+    auto primary = ArduinoSerialProtocol::createPrimary();
+    auto secondary = ArduinoSerialProtocol::createSecondary();
+    for (auto* link : {&primary, &secondary})
+    {
+        link->setFeatures(ARDUINO_SERIAL_FEATURE_SHORT_FRAMES);
+        link->setBaudRates(ARDUINO_SERIAL_BAUD_921600);
+    }
+
+    const auto payload = make_payload(4);
+    auto append = [&](std::vector<uint8_t>& stream, int count)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            const size_t offset = stream.size();
+            stream.resize(offset + primary.packetSize(payload.size()));
+            primary.writePacket(stream.data() + offset, primary.createNextPacketId(),
+                                payload.data(), payload.size());
+        }
+    };
+
+    // IDs taken before the sync confirming the new rate are forgotten
+    sync_link(primary, secondary);
+    ASSERT_EQ(ArduinoSerialOperation::SEND_SYNC, primary.nextOperation().read_operation);
+    for (int i = 0; i < 150; ++i)
+        primary.createNextPacketId();
+
+    // the request is lost; packets queued behind it are sent again behind
+    // the retried one and the ones after them keep counting
+    std::vector<uint8_t> request(primary.syncHeaderSize());
+    primary.writeSyncHeader(request.data());
+    primary.syncSent();
+    std::vector<uint8_t> stream;
+    append(stream, 10);
+    ASSERT_EQ(ArduinoSerialGeneralResult::OK, primary.syncTimeout());
+    request.resize(primary.syncHeaderSize());
+    primary.writeSyncHeader(request.data());
+    primary.syncSent();
+    feed(secondary, request);
+    std::vector<uint8_t> reply(secondary.syncReplyHeaderSize());
+    secondary.writeSyncReplyHeader(reply.data());
+    secondary.syncReplySent();
+    feed(primary, reply);
+    ASSERT_TRUE(primary.isSynced());
+    append(stream, 150);
+
+    std::vector<ArduinoSerialProtocolID> received;
+    size_t offset = 0;
+    while (offset < stream.size())
+    {
+        const auto operation = secondary.nextOperation();
+        const auto result = secondary.readBytes(stream.data() + offset,
+                                                stream.size() - offset);
+        ASSERT_EQ(ArduinoSerialReadResult::OK, result.read_result);
+        if (operation.read_operation == ArduinoSerialOperation::READ_PAYLOAD)
+            received.push_back(result.packet_id);
+        offset += result.bytes_read;
+    }
+    ASSERT_EQ(160u, received.size());
+    for (size_t i = 0; i < received.size(); ++i)
+        EXPECT_EQ(i + 1, received[i]);
+}
+
+TEST(ArduinoSerialProtocol, ShortFramesErrors)
+{
+    auto primary = ArduinoSerialProtocol::createPrimary();
+    auto secondary = ArduinoSerialProtocol::createSecondary();
+    primary.setFeatures(ARDUINO_SERIAL_FEATURE_SHORT_FRAMES);
+    secondary.setFeatures(ARDUINO_SERIAL_FEATURE_SHORT_FRAMES);
+    sync_link(primary, secondary);
+
+    const auto payload = make_payload(5);
+    std::vector<uint8_t> stream;
+    for (ArduinoSerialProtocolID id = 1; id <= 3; ++id)
+    {
+        const size_t offset = stream.size();
+        stream.resize(offset + primary.packetSize(payload.size()));
+        primary.writePacket(stream.data() + offset, id, payload.data(), payload.size());
+    }
+    // ID byte of the first one and length of the second one
+    stream[2] ^= 0x40;
+    stream[primary.packetSize(payload.size()) + 3] = 0x7F;
+
+    const auto packets = feed(secondary, stream);
+    ASSERT_EQ(1, packets.size());
+    EXPECT_EQ(payload, packets[0]);
+#if ARDUINO_SERIAL_STATS
+    EXPECT_EQ(1u, secondary.stats().payload_crc_errors);
+    EXPECT_EQ(1u, secondary.stats().header_crc_errors);
+#endif
+}
+
+TEST(ArduinoSerialProtocol, BaudRateNegotiation)
+{
+    auto primary = ArduinoSerialProtocol::createPrimary();
+    auto secondary = ArduinoSerialProtocol::createSecondary();
+    primary.setBaudRates(ARDUINO_SERIAL_BAUD_460800 | ARDUINO_SERIAL_BAUD_1000000
+                         | ARDUINO_SERIAL_BAUD_2000000);
+    secondary.setBaudRates(ARDUINO_SERIAL_BAUD_460800 | ARDUINO_SERIAL_BAUD_1000000);
+
+    std::vector<uint8_t> request(primary.syncHeaderSize());
+    ASSERT_EQ(8u, request.size());
+    primary.writeSyncHeader(request.data());
+    EXPECT_EQ(0xAD, request[3]);
+    EXPECT_EQ(0, request[4]);
+    EXPECT_EQ(0xA4, request[5]);
+    primary.syncSent();
+    feed(secondary, request);
+
+    // fastest common rate, secondary switches once reply is out
+    std::vector<uint8_t> reply(secondary.syncReplyHeaderSize());
+    secondary.writeSyncReplyHeader(reply.data());
+    EXPECT_EQ(ARDUINO_SERIAL_BAUD_1000000, reply[5]);
+    EXPECT_EQ(0u, secondary.baudRate());
+    secondary.syncReplySent();
+    EXPECT_EQ(1000000u, secondary.baudRate());
+
+    // primary syncs once more at the new rate before sending
+    feed(primary, reply);
+    EXPECT_EQ(1000000u, primary.baudRate());
+    EXPECT_EQ(ArduinoSerialOperation::SEND_SYNC, primary.nextOperation().read_operation);
+    EXPECT_FALSE(primary.isSynced());
+
+    sync_link(primary, secondary);
+    EXPECT_TRUE(primary.isSynced());
+    EXPECT_TRUE(secondary.isSynced());
+    EXPECT_EQ(1000000u, primary.baudRate());
+    EXPECT_EQ(1000000u, secondary.baudRate());
+}
+
+TEST(ArduinoSerialProtocol, BaudRateNotAgreed)
+{
+    auto primary = ArduinoSerialProtocol::createPrimary();
+    auto secondary = ArduinoSerialProtocol::createSecondary();
+    primary.setBaudRates(ARDUINO_SERIAL_BAUD_1000000);
+    secondary.setBaudRates(ARDUINO_SERIAL_BAUD_2000000);
+
+    sync_link(primary, secondary);
+    EXPECT_TRUE(primary.isSynced());
+    EXPECT_TRUE(secondary.isSynced());
+    EXPECT_EQ(0u, primary.baudRate());
+    EXPECT_EQ(0u, secondary.baudRate());
+
+    // plain sync request falls back to the initial rate
+    primary.setBaudRates(0);
+    secondary.setBaudRates(0);
+    EXPECT_EQ(4u, primary.syncHeaderSize());
+}
+
+TEST(ArduinoSerialProtocol, BaudRateRollbackOnTimeout)
+{
+    auto primary = ArduinoSerialProtocol::createPrimary();
+    auto secondary = ArduinoSerialProtocol::createSecondary();
+    primary.setBaudRates(ARDUINO_SERIAL_BAUD_500000 | ARDUINO_SERIAL_BAUD_2000000);
+    secondary.setBaudRates(ARDUINO_SERIAL_BAUD_500000 | ARDUINO_SERIAL_BAUD_2000000);
+
+    sync_link(primary, secondary);
+    ASSERT_EQ(2000000u, primary.baudRate());
+
+    // confirming sync at 2 Mbaud gets no reply
+    std::vector<uint8_t> request(primary.syncHeaderSize());
+    primary.writeSyncHeader(request.data());
+    primary.syncSent();
+    ASSERT_EQ(ArduinoSerialGeneralResult::OK, primary.syncTimeout());
+    EXPECT_EQ(0u, primary.baudRate());
+    EXPECT_FALSE(primary.isSynced());
+    EXPECT_EQ(ArduinoSerialOperation::SEND_SYNC, primary.nextOperation().read_operation);
+#if ARDUINO_SERIAL_STATS
+    EXPECT_EQ(1u, primary.stats().baud_rollbacks);
+#endif
+
+    // failed rate is not offered again
+    request.resize(primary.syncHeaderSize());
+    primary.writeSyncHeader(request.data());
+    EXPECT_EQ(ARDUINO_SERIAL_BAUD_500000, request[5]);
+}
+
+TEST(ArduinoSerialProtocol, BaudRateRollbackOnErrors)
+{
+    auto primary = ArduinoSerialProtocol::createPrimary();
+    auto secondary = ArduinoSerialProtocol::createSecondary();
+    primary.setBaudRates(ARDUINO_SERIAL_BAUD_921600);
+    secondary.setBaudRates(ARDUINO_SERIAL_BAUD_921600);
+    sync_link(primary, secondary);
+    ASSERT_EQ(921600u, primary.baudRate());
+    ASSERT_EQ(921600u, secondary.baudRate());
+
+    // confirming sync comes in at another rate and is garbage
+    const std::vector<uint8_t> garbage = {0x00, 0x80, 0xF8, 0x00, 0x78};
+    std::vector<uint8_t> request(primary.syncHeaderSize());
+    primary.writeSyncHeader(request.data());
+    primary.syncSent();
+    feed(secondary, garbage);
+    EXPECT_EQ(0u, secondary.baudRate());
+    EXPECT_FALSE(secondary.isSynced());
+#if ARDUINO_SERIAL_STATS
+    EXPECT_EQ(1u, secondary.stats().baud_rollbacks);
+#endif
+
+    // so it gets no reply
+    ASSERT_EQ(ArduinoSerialGeneralResult::OK, primary.syncTimeout());
+    EXPECT_EQ(0u, primary.baudRate());
+    EXPECT_EQ(ArduinoSerialOperation::SEND_SYNC, primary.nextOperation().read_operation);
+
+    // resync at the initial rate, 921600 is not tried again
+    sync_link(primary, secondary);
+    EXPECT_TRUE(primary.isSynced());
+    EXPECT_TRUE(secondary.isSynced());
+    EXPECT_EQ(0u, primary.baudRate());
+    EXPECT_EQ(0u, secondary.baudRate());
+}
+
+TEST(ArduinoSerialProtocol, BaudRateKeptAfterConfirm)
+{
+    auto primary = ArduinoSerialProtocol::createPrimary();
+    auto secondary = ArduinoSerialProtocol::createSecondary();
+    primary.setBaudRates(ARDUINO_SERIAL_BAUD_921600);
+    secondary.setBaudRates(ARDUINO_SERIAL_BAUD_921600);
+    sync_link(primary, secondary);
+    sync_link(primary, secondary);
+    ASSERT_TRUE(primary.isSynced());
+    ASSERT_EQ(921600u, secondary.baudRate());
+
+    // noise on a confirmed link is an ordinary error on either side
+    const std::vector<uint8_t> garbage = {0x00, 0x80, 0xF8, 0x00, 0x78};
+    for (size_t i = 0; i < 4; ++i)
+    {
+        feed(secondary, garbage);
+        feed(primary, garbage);
+    }
+    EXPECT_EQ(921600u, secondary.baudRate());
+    EXPECT_EQ(921600u, primary.baudRate());
+    EXPECT_TRUE(primary.isSynced());
+#if ARDUINO_SERIAL_STATS
+    EXPECT_EQ(0u, secondary.stats().baud_rollbacks);
+    EXPECT_EQ(0u, primary.stats().baud_rollbacks);
+#endif
+
+    const auto payload = make_payload(5);
+    std::vector<uint8_t> stream = {0x00, 0x11, 0x22};
+    const size_t offset = stream.size();
+    stream.resize(offset + primary.packetSize(payload.size()));
+    primary.writePacket(stream.data() + offset, 1, payload.data(), payload.size());
+    const auto packets = feed(secondary, stream);
+    ASSERT_EQ(1u, packets.size());
+    EXPECT_EQ(payload, packets[0]);
+}
+
+namespace
+{
+
+struct CobsConfig : ArduinoSerialDefaultConfig
+{
+    static constexpr const ArduinoSerialFraming FRAMING = ArduinoSerialFraming::COBS;
+};
+
+using CobsProtocol = ArduinoSerialProtocolT<CobsConfig>;
+
+void append_cobs_packet(CobsProtocol& protocol, std::vector<uint8_t>& stream,
+                        const std::vector<uint8_t>& payload)
+{
+    const size_t offset = stream.size();
+    stream.resize(offset + protocol.packetSize(payload.size()));
+    ASSERT_EQ(ArduinoSerialGeneralResult::OK,
+              protocol.writePacket(stream.data() + offset, protocol.createNextPacketId(),
+                                   payload.data(), payload.size()));
+}
+
+}
+
+TEST(ArduinoSerialProtocol, CobsFraming)
+{
+    auto primary = CobsProtocol::createPrimary();
+    auto secondary = CobsProtocol::createSecondary();
+
+    std::vector<uint8_t> request(primary.syncHeaderSize());
+    ASSERT_EQ(6u, request.size());
+    primary.writeSyncHeader(request.data());
+    EXPECT_EQ(std::vector<uint8_t>({0x05, 0xD3, 0x74, 0xE5, 0x52, 0x00}), request);
+    primary.syncSent();
+    feed(secondary, request);
+    EXPECT_EQ(ArduinoSerialOperation::SEND_SYNC_REPLY, secondary.nextOperation().read_operation);
+
+    std::vector<uint8_t> reply(secondary.syncReplyHeaderSize());
+    secondary.writeSyncReplyHeader(reply.data());
+    secondary.syncReplySent();
+    feed(primary, reply);
+    ASSERT_TRUE(primary.isSynced());
+    ASSERT_TRUE(secondary.isSynced());
+
+    // zeros and strobes inside payloads
+    const std::vector<uint8_t> payload1 = {0x00, 0xA5, 0x63, 0x00, 0x00, 0x07};
+    const auto payload2 = make_payload(255);
+    const std::vector<uint8_t> payload3 = {0xD3, 0x74, 0xE5, 0x52};
+    std::vector<uint8_t> stream;
+    for (const auto* payload : {&payload1, &payload2, &payload3})
+        append_cobs_packet(primary, stream, *payload);
+    EXPECT_EQ(arduino_serial_cobs_size(primary.headerSize() + 255), primary.packetSize(255));
+    EXPECT_EQ(stream.size() - 3, static_cast<size_t>(
+            std::count_if(stream.begin(), stream.end(), [](uint8_t value) { return value != 0; })));
+
+    for (size_t step : {4096u, 1u, 5u})
+    {
+        const auto packets = feed(secondary, stream, step);
+        ASSERT_EQ(3u, packets.size()) << step;
+        EXPECT_EQ(payload1, packets[0]);
+        EXPECT_EQ(payload2, packets[1]);
+        EXPECT_EQ(payload3, packets[2]);
+    }
+
+    uint8_t header[CobsProtocol::HEADER_SIZE];
+    EXPECT_EQ(ArduinoSerialGeneralResult::ERROR_UNDEFINED,
+              primary.writeHeader(header, 1, payload1.data(), payload1.size()));
+}
+
+TEST(ArduinoSerialProtocol, CobsResync)
+{
+    auto primary = CobsProtocol::createPrimary();
+    auto secondary = CobsProtocol::createSecondary();
+    sync_link(primary, secondary);
+    ASSERT_TRUE(secondary.isSynced());
+
+    // joined in the middle of frames that look like packets
+    std::vector<uint8_t> stream = {0xA5, 0x63, 0x00, 0x01, 0x05, 0xA5, 0x00};
+    append_cobs_packet(primary, stream, {0xA5, 0x63, 0x00, 0x01, 0x05});
+    const size_t corrupted = stream.size();
+    append_cobs_packet(primary, stream, make_payload(40));
+    append_cobs_packet(primary, stream, {0x11});
+    const size_t short_frame = stream.size();
+    append_cobs_packet(primary, stream, {0x22});
+    append_cobs_packet(primary, stream, {0x33});
+
+    // bad payload, and a frame cut short by a lost byte
+    stream[corrupted + 20] ^= 0x40;
+    stream.erase(stream.begin() + short_frame + 3);
+
+    const auto packets = feed(secondary, stream);
+    ASSERT_EQ(3u, packets.size());
+    EXPECT_EQ(std::vector<uint8_t>({0xA5, 0x63, 0x00, 0x01, 0x05}), packets[0]);
+    EXPECT_EQ(std::vector<uint8_t>({0x11}), packets[1]);
+    EXPECT_EQ(std::vector<uint8_t>({0x33}), packets[2]);
+#if ARDUINO_SERIAL_STATS
+    EXPECT_EQ(1u, secondary.stats().payload_crc_errors);
+    EXPECT_EQ(0u, secondary.stats().bytes_discarded);
+#endif
+}
+
+#if ARDUINO_SERIAL_MAX_EXTENDED_PAYLOAD > 255
+TEST(ArduinoSerialProtocol, CobsExtendedFrames)
+{
+    auto primary = CobsProtocol::createPrimary();
+    auto secondary = CobsProtocol::createSecondary();
+    primary.setFeatures(ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES
+                        | ARDUINO_SERIAL_FEATURE_SHORT_FRAMES);
+    secondary.setFeatures(ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES
+                          | ARDUINO_SERIAL_FEATURE_SHORT_FRAMES);
+    ASSERT_EQ(10u, primary.syncHeaderSize());
+    sync_link(primary, secondary);
+    ASSERT_EQ(ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES | ARDUINO_SERIAL_FEATURE_SHORT_FRAMES,
+              secondary.features());
+
+    auto big = make_payload(1000);
+    for (size_t i = 0; i < big.size(); i += 3)
+        big[i] = 0;
+    std::vector<uint8_t> stream;
+    append_cobs_packet(primary, stream, big);
+    append_cobs_packet(primary, stream, {0x00, 0x01});
+    EXPECT_EQ(arduino_serial_cobs_size(primary.dataHeaderSize(2) + 2), primary.packetSize(2));
+
+    const auto packets = feed(secondary, stream, 64);
+    ASSERT_EQ(2u, packets.size());
+    EXPECT_EQ(big, packets[0]);
+    EXPECT_EQ(std::vector<uint8_t>({0x00, 0x01}), packets[1]);
+}
+#endif
@@ -0,0 +1,261 @@
+#pragma once
+
+#include "arduino_serial_protocol.h"
+#include "arduino_serial_reorder.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+enum class ArduinoSerialReliableResult
+{
+    OK,
+    ERROR_WINDOW_FULL,
+    ERROR_PAYLOAD_SIZE_TOO_BIG,
+    ERROR_NOT_SYNCED
+};
+
+enum class ArduinoSerialDelivery
+{
+    // new data packet, hand it to the application
+    DELIVER,
+    // seen before (retransmit of a packet whose ACK got lost), drop it
+    DUPLICATE,
+    // ACK frame, consumed by the link
+    ACK,
+    // malformed ACK
+    DROPPED
+};
+
+
+// Selective-repeat reliable delivery over one ArduinoSerialProtocol.
+// Up to Window data packets are in flight; every one is kept framed
+// until acknowledged and sent again when its retransmission timer runs
+// out. Receiver acknowledges with a cumulative ID (everything up to it
+// arrived) plus a bitmap of the next 32 IDs, so only lost packets are
+// sent again, and drops duplicates by packet_id (ArduinoSerialReorderWindow).
+//
+// Portable and allocation free, time is passed in by the caller (e.g.
+// millis()). Link owns packet IDs of its protocol, every packet the
+// protocol decodes has to be passed to onPacket(). Link starts over by
+// itself once its protocol completed a new sync handshake.
+template<size_t Window, size_t MaxPayload = 255>
+class ArduinoSerialReliableLink
+{
+public:
+    static_assert(Window >= 1 && Window <= 32, "Window must be 1..32");
+    static_assert(MaxPayload <= 255, "MaxPayload must fit a packet");
+
+    static constexpr const size_t ACK_PAYLOAD_SIZE = 6;
+
+    ArduinoSerialReliableLink(ArduinoSerialProtocol& protocol, uint32_t rto_ms)
+    : protocol(protocol)
+    , rto_ms{rto_ms}
+    , sync_count{protocol.syncCount()}
+    {
+        reset();
+    }
+
+    ArduinoSerialReliableLink(const ArduinoSerialReliableLink&) = delete;
+
+    void reset()
+    {
+        for (size_t i = 0; i < Window; ++i)
+            slots[i].in_use = false;
+        next_id = 1;
+        receive_window.reset();
+        ack_pending = false;
+        retransmissions = 0;
+    }
+
+    // sender side
+
+    // Frames payload into a free window slot, frame has to be written
+    // to the link now
+    ArduinoSerialReliableResult send(const void* payload, size_t payload_size,
+                                     uint32_t now_ms, ArduinoSerialPayload& frame)
+    {
+        followSync();
+        if (payload_size > MaxPayload)
+            return ArduinoSerialReliableResult::ERROR_PAYLOAD_SIZE_TOO_BIG;
+
+        Slot* slot = freeSlot();
+        if (slot == nullptr)
+            return ArduinoSerialReliableResult::ERROR_WINDOW_FULL;
+
+        const ArduinoSerialGeneralResult result =
+                protocol.writePacket(slot->frame, next_id, payload, payload_size);
+        if (result == ArduinoSerialGeneralResult::ERROR_PAYLOAD_SIZE_TOO_BIG)
+            return ArduinoSerialReliableResult::ERROR_PAYLOAD_SIZE_TOO_BIG;
+        if (result != ArduinoSerialGeneralResult::OK)
+            return ArduinoSerialReliableResult::ERROR_NOT_SYNCED;
+
+        slot->in_use = true;
+        slot->id = next_id;
+        slot->size = protocol.packetSize(payload_size, next_id);
+        slot->sent_ms = now_ms;
+        slot->retries = 0;
+        next_id = arduino_serial_id_next(next_id);
+
+        frame.data = slot->frame;
+        frame.size = slot->size;
+        return ArduinoSerialReliableResult::OK;
+    }
+
+    // One frame whose timer ran out, false when none is due. Timeout
+    // doubles with every retry, up to 16 * rto.
+    bool nextRetransmit(uint32_t now_ms, ArduinoSerialPayload& frame)
+    {
+        followSync();
+        for (size_t i = 0; i < Window; ++i)
+        {
+            Slot& slot = slots[i];
+            if (!slot.in_use)
+                continue;
+            const uint8_t backoff = slot.retries < 4 ? slot.retries : 4;
+            if (now_ms - slot.sent_ms < (rto_ms << backoff))
+                continue;
+
+            slot.sent_ms = now_ms;
+            if (slot.retries < 0xFF)
+                ++slot.retries;
+            ++retransmissions;
+            frame.data = slot.frame;
+            frame.size = slot.size;
+            return true;
+        }
+        return false;
+    }
+
+    size_t inFlight() const
+    {
+        size_t result = 0;
+        for (size_t i = 0; i < Window; ++i)
+            result += slots[i].in_use ? 1 : 0;
+        return result;
+    }
+
+    uint32_t retransmitted() const
+    { return retransmissions; }
+
+    // receiver side
+
+    // Every packet decoded by protocol goes here
+    ArduinoSerialDelivery onPacket(ArduinoSerialProtocolID id,
+                                   const void* payload, size_t payload_size)
+    {
+        followSync();
+        if (id == 0)
+            return onAck(payload, payload_size);
+
+        ack_pending = true;
+        if (receive_window.accept(id, payload, payload_size)
+            != ArduinoSerialReorderResult::DELIVER)
+            return ArduinoSerialDelivery::DUPLICATE;
+        return ArduinoSerialDelivery::DELIVER;
+    }
+
+    // ACK for everything received since the previous one, false when
+    // nothing new arrived. Frame stays valid until the next call.
+    bool nextAck(ArduinoSerialPayload& frame)
+    {
+        followSync();
+        if (!ack_pending)
+            return false;
+
+        uint8_t payload[ACK_PAYLOAD_SIZE];
+        const ArduinoSerialProtocolID cumulative = receive_window.cumulativeId();
+        const uint32_t bitmap = receive_window.seenBitmap();
+        payload[0] = static_cast<uint8_t>(cumulative >> 8);
+        payload[1] = static_cast<uint8_t>(cumulative);
+        for (size_t i = 0; i < 4; ++i)
+            payload[2 + i] = static_cast<uint8_t>(bitmap >> (8 * (3 - i)));
+
+        if (protocol.writePacket(ack_frame, 0, payload, sizeof(payload))
+            != ArduinoSerialGeneralResult::OK)
+            return false;
+
+        ack_pending = false;
+        frame.data = ack_frame;
+        frame.size = protocol.packetSize(sizeof(payload), 0);
+        return true;
+    }
+
+private:
+    struct Slot
+    {
+        bool in_use;
+        uint8_t retries;
+        ArduinoSerialProtocolID id;
+        uint32_t sent_ms;
+        size_t size;
+        uint8_t frame[ArduinoSerialProtocol::HEADER_SIZE + MaxPayload];
+    };
+
+    // Peer starts over with ID 1 after a new handshake, so does the link
+    void followSync()
+    {
+        if (protocol.syncCount() == sync_count)
+            return;
+        sync_count = protocol.syncCount();
+        reset();
+    }
+
+    // Free slot, unless next ID would be Window or more ahead of the
+    // oldest unacknowledged one (receiver could not place it)
+    Slot* freeSlot()
+    {
+        Slot* result = nullptr;
+        for (size_t i = 0; i < Window; ++i)
+        {
+            if (!slots[i].in_use)
+                result = &slots[i];
+            else if (arduino_serial_id_distance(slots[i].id, next_id) >= Window)
+                return nullptr;
+        }
+        return result;
+    }
+
+    ArduinoSerialDelivery onAck(const void* _payload, size_t payload_size)
+    {
+        if (payload_size != ACK_PAYLOAD_SIZE)
+            return ArduinoSerialDelivery::DROPPED;
+
+        const uint8_t* payload = static_cast<const uint8_t*>(_payload);
+        const ArduinoSerialProtocolID cumulative =
+                static_cast<ArduinoSerialProtocolID>((payload[0] << 8) | payload[1]);
+        uint32_t bitmap = 0;
+        for (size_t i = 0; i < 4; ++i)
+            bitmap = (bitmap << 8) | payload[2 + i];
+
+        for (size_t i = 0; i < Window; ++i)
+        {
+            Slot& slot = slots[i];
+            if (!slot.in_use)
+                continue;
+            // up to cumulative when reaching it takes less than half the range
+            const uint16_t behind = arduino_serial_id_distance(slot.id, cumulative);
+            const uint16_t ahead = arduino_serial_id_distance(cumulative, slot.id);
+            if (behind < 0x8000)
+                slot.in_use = false;
+            else if (ahead >= 1 && ahead <= 32
+                     && (bitmap & (uint32_t{1} << (ahead - 1))) != 0)
+                slot.in_use = false;
+        }
+        return ArduinoSerialDelivery::ACK;
+    }
+
+    ArduinoSerialProtocol& protocol;
+    uint32_t rto_ms;
+    uint8_t sync_count;
+
+    Slot slots[Window];
+    ArduinoSerialProtocolID next_id;
+
+    ArduinoSerialReorderWindow<32> receive_window;
+    bool ack_pending;
+    uint8_t ack_frame[ArduinoSerialProtocol::HEADER_SIZE + ACK_PAYLOAD_SIZE];
+
+    uint32_t retransmissions;
+
+}; // class ArduinoSerialReliableLink
@@ -0,0 +1,232 @@
+#include "gtest/gtest.h"
+
+#include "arduino_serial_protocol.h"
+#include "arduino_serial_reliable.h"
+#include "arduino_serial_stream_decoder.h"
+#include "arduino_serial_test_sync.h"
+
+#include <memory.h>
+#include <memory>
+#include <random>
+#include <vector>
+
+
+namespace
+{
+
+using Link = ArduinoSerialReliableLink<8, 32>;
+
+struct Endpoint
+{
+    Endpoint()
+    : protocol{ArduinoSerialProtocol::createSecondary()}
+    , decoder{protocol}
+    , link{protocol, 100}
+    {
+        sync(protocol);
+    }
+
+    static void onPacket(void* context, ArduinoSerialProtocolID id,
+                         const void* payload, size_t payload_size)
+    {
+        Endpoint* endpoint = static_cast<Endpoint*>(context);
+        const ArduinoSerialDelivery delivery =
+                endpoint->link.onPacket(id, payload, payload_size);
+        if (delivery == ArduinoSerialDelivery::DELIVER)
+        {
+            const uint8_t* data = static_cast<const uint8_t*>(payload);
+            endpoint->delivered.push_back(std::vector<uint8_t>(data, data + payload_size));
+        }
+        else if (delivery == ArduinoSerialDelivery::DUPLICATE)
+        {
+            ++endpoint->duplicates;
+        }
+    }
+
+    void receive(const ArduinoSerialPayload& frame)
+    {
+        decoder.decode(frame.data, frame.size, &Endpoint::onPacket, this);
+    }
+
+    ArduinoSerialProtocol protocol;
+    ArduinoSerialStreamDecoder decoder;
+    Link link;
+    std::vector<std::vector<uint8_t>> delivered;
+    size_t duplicates = 0;
+};
+
+void send_ack(Endpoint& from, Endpoint& to)
+{
+    ArduinoSerialPayload ack = {nullptr, 0};
+    if (from.link.nextAck(ack))
+        to.receive(ack);
+}
+
+}
+
+
+TEST(ArduinoSerialReliable, IdDistance)
+{
+    EXPECT_EQ(0, arduino_serial_id_distance(5, 5));
+    EXPECT_EQ(3, arduino_serial_id_distance(5, 8));
+    EXPECT_EQ(1, arduino_serial_id_distance(0, 1));
+    EXPECT_EQ(1, arduino_serial_id_distance(0xFFFF, 1));
+    EXPECT_EQ(2, arduino_serial_id_distance(0xFFFE, 1));
+    EXPECT_EQ(65534, arduino_serial_id_distance(1, 0xFFFF));
+    EXPECT_EQ(1, arduino_serial_id_next(0));
+    EXPECT_EQ(1, arduino_serial_id_next(0xFFFF));
+}
+
+TEST(ArduinoSerialReliable, WindowAndCumulativeAck)
+{
+    Endpoint a;
+    Endpoint b;
+
+    const uint8_t payload[] = {0x01, 0x02, 0x03};
+    ArduinoSerialPayload frame = {nullptr, 0};
+    for (size_t i = 0; i < 8; ++i)
+    {
+        ASSERT_EQ(ArduinoSerialReliableResult::OK,
+                  a.link.send(payload, sizeof(payload), 0, frame));
+        b.receive(frame);
+    }
+    EXPECT_EQ(ArduinoSerialReliableResult::ERROR_WINDOW_FULL,
+              a.link.send(payload, sizeof(payload), 0, frame));
+    EXPECT_EQ(8, a.link.inFlight());
+    EXPECT_EQ(8, b.delivered.size());
+
+    uint8_t big[33] = {};
+    EXPECT_EQ(ArduinoSerialReliableResult::ERROR_PAYLOAD_SIZE_TOO_BIG,
+              a.link.send(big, sizeof(big), 0, frame));
+
+    send_ack(b, a);
+    EXPECT_EQ(0, a.link.inFlight());
+    EXPECT_FALSE(a.link.nextRetransmit(1000, frame));
+
+    ArduinoSerialPayload ack = {nullptr, 0};
+    EXPECT_FALSE(b.link.nextAck(ack));
+}
+
+TEST(ArduinoSerialReliable, SelectiveRetransmit)
+{
+    Endpoint a;
+    Endpoint b;
+
+    std::vector<ArduinoSerialPayload> frames(4);
+    std::vector<std::vector<uint8_t>> copies;
+    for (uint8_t i = 0; i < 4; ++i)
+    {
+        const uint8_t payload[] = {i};
+        ASSERT_EQ(ArduinoSerialReliableResult::OK,
+                  a.link.send(payload, sizeof(payload), 0, frames[i]));
+    }
+    // second packet is lost
+    b.receive(frames[0]);
+    b.receive(frames[2]);
+    b.receive(frames[3]);
+    EXPECT_EQ(3, b.delivered.size());
+
+    send_ack(b, a);
+    EXPECT_EQ(1, a.link.inFlight());
+
+    ArduinoSerialPayload frame = {nullptr, 0};
+    EXPECT_FALSE(a.link.nextRetransmit(99, frame));
+    ASSERT_TRUE(a.link.nextRetransmit(100, frame));
+    EXPECT_FALSE(a.link.nextRetransmit(100, frame));
+    EXPECT_EQ(1, a.link.retransmitted());
+
+    b.receive(frame);
+    ASSERT_EQ(4, b.delivered.size());
+    EXPECT_EQ(std::vector<uint8_t>{1}, b.delivered[3]);
+
+    // retransmit again, as if the ACK got lost: dropped as duplicate
+    ASSERT_TRUE(a.link.nextRetransmit(300, frame));
+    b.receive(frame);
+    EXPECT_EQ(4, b.delivered.size());
+    EXPECT_EQ(1, b.duplicates);
+
+    send_ack(b, a);
+    EXPECT_EQ(0, a.link.inFlight());
+}
+
+TEST(ArduinoSerialReliable, PeerReconnects)
+{
+    std::unique_ptr<Endpoint> a{new Endpoint};
+    Endpoint b;
+
+    const uint8_t payload[] = {0x01};
+    ArduinoSerialPayload frame = {nullptr, 0};
+    for (size_t i = 0; i < 5; ++i)
+    {
+        ASSERT_EQ(ArduinoSerialReliableResult::OK,
+                  a->link.send(payload, sizeof(payload), 0, frame));
+        b.receive(frame);
+        ASSERT_EQ(ArduinoSerialReliableResult::OK,
+                  b.link.send(payload, sizeof(payload), 0, frame));
+    }
+    EXPECT_EQ(5, b.delivered.size());
+    EXPECT_EQ(5, b.link.inFlight());
+
+    // a restarts with ID 1 and syncs b again
+    a.reset(new Endpoint);
+    sync(b.protocol);
+
+    const uint8_t fresh[] = {0x02};
+    ASSERT_EQ(ArduinoSerialReliableResult::OK,
+              a->link.send(fresh, sizeof(fresh), 0, frame));
+    b.receive(frame);
+    ASSERT_EQ(6, b.delivered.size());
+    EXPECT_EQ(std::vector<uint8_t>{0x02}, b.delivered[5]);
+    EXPECT_EQ(0, b.duplicates);
+    EXPECT_EQ(0, b.link.inFlight());
+
+    send_ack(b, *a);
+    EXPECT_EQ(0, a->link.inFlight());
+}
+
+TEST(ArduinoSerialReliable, LossyChannel)
+{
+    Endpoint a;
+    Endpoint b;
+    std::mt19937 random{42};
+    std::bernoulli_distribution lost{0.3};
+
+    const size_t count = 300;
+    size_t sent = 0;
+    uint32_t now = 0;
+    ArduinoSerialPayload frame = {nullptr, 0};
+    while (b.delivered.size() < count && now < 1000000)
+    {
+        now += 10;
+        while (sent < count)
+        {
+            const uint8_t payload[] = {static_cast<uint8_t>(sent),
+                                       static_cast<uint8_t>(sent >> 8)};
+            if (a.link.send(payload, sizeof(payload), now, frame)
+                != ArduinoSerialReliableResult::OK)
+                break;
+            ++sent;
+            if (!lost(random))
+                b.receive(frame);
+        }
+        while (a.link.nextRetransmit(now, frame))
+        {
+            if (!lost(random))
+                b.receive(frame);
+        }
+        ArduinoSerialPayload ack = {nullptr, 0};
+        if (b.link.nextAck(ack) && !lost(random))
+            a.receive(ack);
+    }
+
+    ASSERT_EQ(count, b.delivered.size());
+    std::vector<bool> seen(count, false);
+    for (const std::vector<uint8_t>& payload : b.delivered)
+    {
+        const size_t index = payload[0] | (payload[1] << 8);
+        ASSERT_LT(index, count);
+        EXPECT_FALSE(seen[index]);
+        seen[index] = true;
+    }
+    EXPECT_GT(a.link.retransmitted(), 0);
+}
@@ -0,0 +1,301 @@
+#pragma once
+
+#include "arduino_serial_protocol.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+
+// Packet IDs run 1..65535 and wrap to 1, ID 0 is never used for data
+// (see createNextPacketId).
+// Distance from a to b going forward, 0 stands for the ID before 1.
+inline uint16_t arduino_serial_id_distance(ArduinoSerialProtocolID a,
+                                           ArduinoSerialProtocolID b)
+{
+    const uint32_t index_a = (a + 65534u) % 65535u;
+    const uint32_t index_b = (b + 65534u) % 65535u;
+    return static_cast<uint16_t>((index_b + 65535u - index_a) % 65535u);
+}
+
+inline ArduinoSerialProtocolID arduino_serial_id_next(ArduinoSerialProtocolID id)
+{
+    return id == 0xFFFF ? 1 : static_cast<ArduinoSerialProtocolID>(id + 1);
+}
+
+inline ArduinoSerialProtocolID arduino_serial_id_advance(ArduinoSerialProtocolID id,
+                                                         uint16_t count)
+{
+    const uint32_t index = (id + 65534u) % 65535u;
+    return static_cast<ArduinoSerialProtocolID>((index + count) % 65535u + 1);
+}
+
+
+enum class ArduinoSerialReorderResult
+{
+    // hand payload to the application now
+    DELIVER,
+    // kept until the IDs before it arrive, comes out of release()
+    BUFFERED,
+    // seen before or older than the window
+    DUPLICATE,
+    // cannot be buffered (too big, or release() was not drained)
+    DROPPED
+};
+
+
+// Payload copies of packets waiting for release, slot Window holds the
+// one that arrived too far ahead
+template<size_t Window, size_t MaxPayload>
+struct ArduinoSerialReorderStorage
+{
+    void store(size_t slot, const void* payload, size_t payload_size)
+    {
+        memcpy(data[slot], payload, payload_size);
+        size[slot] = payload_size;
+    }
+
+    void move(size_t from, size_t to)
+    {
+        memcpy(data[to], data[from], size[from]);
+        size[to] = size[from];
+    }
+
+    ArduinoSerialPayload get(size_t slot) const
+    {
+        ArduinoSerialPayload payload;
+        payload.data = data[slot];
+        payload.size = size[slot];
+        return payload;
+    }
+
+    size_t size[Window + 1];
+    uint8_t data[Window + 1][MaxPayload];
+};
+
+// Deduplication only, nothing is buffered
+template<size_t Window>
+struct ArduinoSerialReorderStorage<Window, 0>
+{
+    void store(size_t, const void*, size_t)
+    {}
+
+    void move(size_t, size_t)
+    {}
+
+    ArduinoSerialPayload get(size_t) const
+    {
+        ArduinoSerialPayload payload;
+        payload.data = nullptr;
+        payload.size = 0;
+        return payload;
+    }
+};
+
+
+// Receive window over packet IDs: a cumulative ID (everything up to it
+// was seen) and a bitmap of the Window IDs after it, so duplicates are
+// dropped in O(1) without allocation.
+//
+// With MaxPayload 0 packets are only deduplicated and delivered as they
+// come. With MaxPayload > 0 they are released in ID order: early ones
+// are copied into the window and come out of release() once the gap
+// before them is filled. A packet more than Window ahead gives up on
+// the missing IDs; buffered packets before it are released first.
+// Drain release() after every accept().
+//
+// A peer that reconnects starts over with ID 1, which would look like
+// an old duplicate. Call reset() after every sync handshake, or pass
+// protocol.syncCount() to follow() before every accept().
+template<size_t Window, size_t MaxPayload = 0>
+class ArduinoSerialReorderWindow
+{
+public:
+    static_assert(Window >= 1 && Window <= 32, "Window must be 1..32");
+    static_assert(MaxPayload <= 255, "MaxPayload must fit a packet");
+
+    static constexpr const bool IN_ORDER = MaxPayload > 0;
+
+    ArduinoSerialReorderWindow()
+    : sync_count{0}
+    {
+        reset();
+    }
+
+    // Resets the window when sync_count differs from the previous one
+    void follow(uint8_t count)
+    {
+        if (count == sync_count)
+            return;
+        sync_count = count;
+        reset();
+    }
+
+    void reset()
+    {
+        base = 0;
+        bitmap = 0;
+        head = 0;
+        advance = 0;
+        overflow_pending = false;
+        overflow_id = 0;
+        duplicates = 0;
+        skipped = 0;
+    }
+
+    ArduinoSerialReorderResult accept(ArduinoSerialProtocolID id,
+                                      const void* payload, size_t payload_size)
+    {
+        if (overflow_pending)
+            return ArduinoSerialReorderResult::DROPPED;
+
+        const uint16_t distance = arduino_serial_id_distance(base, id);
+        if (distance == 0 || distance >= 0x8000)
+        {
+            ++duplicates;
+            return ArduinoSerialReorderResult::DUPLICATE;
+        }
+
+        if (distance > Window)
+        {
+            if (!IN_ORDER)
+            {
+                slide(distance - Window);
+                return mark(Window);
+            }
+            if (payload_size > MaxPayload)
+                return ArduinoSerialReorderResult::DROPPED;
+            advance = distance - Window;
+            overflow_pending = true;
+            overflow_id = id;
+            storage.store(Window, payload, payload_size);
+            return ArduinoSerialReorderResult::BUFFERED;
+        }
+
+        if ((bitmap & bit(distance)) != 0)
+        {
+            ++duplicates;
+            return ArduinoSerialReorderResult::DUPLICATE;
+        }
+
+        if (!IN_ORDER)
+            return mark(distance);
+
+        if (distance == 1)
+        {
+            // buffered packets after it come out of release()
+            step();
+            return ArduinoSerialReorderResult::DELIVER;
+        }
+
+        if (payload_size > MaxPayload)
+            return ArduinoSerialReorderResult::DROPPED;
+        storage.store(slot(distance), payload, payload_size);
+        bitmap |= bit(distance);
+        return ArduinoSerialReorderResult::BUFFERED;
+    }
+
+    // Next buffered packet that is in order now, false when none.
+    // Payload stays valid until the next accept()/release().
+    bool release(ArduinoSerialProtocolID& id, ArduinoSerialPayload& payload)
+    {
+        if (!IN_ORDER)
+            return false;
+
+        for (;;)
+        {
+            if ((bitmap & 1) != 0)
+            {
+                const size_t index = slot(1);
+                step();
+                if (advance > 0)
+                    --advance;
+                id = base;
+                payload = storage.get(index);
+                return true;
+            }
+            if (advance > 0)
+            {
+                // skip the whole gap up to the next buffered packet at once
+                uint16_t count = 0;
+                while (count < advance && count < 32
+                       && (bitmap & (uint32_t{1} << count)) == 0)
+                    ++count;
+                if (bitmap == 0)
+                    count = advance;
+                slide(count);
+                advance -= count;
+                skipped += count;
+                continue;
+            }
+            if (overflow_pending)
+            {
+                overflow_pending = false;
+                const uint16_t distance = arduino_serial_id_distance(base, overflow_id);
+                storage.move(Window, slot(distance));
+                bitmap |= bit(distance);
+                continue;
+            }
+            return false;
+        }
+    }
+
+    // highest ID up to which everything was delivered or given up on
+    ArduinoSerialProtocolID cumulativeId() const
+    { return base; }
+
+    // bit i set: ID cumulativeId() + 1 + i was seen
+    uint32_t seenBitmap() const
+    { return bitmap; }
+
+    uint32_t duplicateCount() const
+    { return duplicates; }
+
+    // IDs given up on to release later packets, in order mode only
+    uint32_t skippedCount() const
+    { return skipped; }
+
+private:
+    static uint32_t bit(uint16_t distance)
+    { return uint32_t{1} << (distance - 1); }
+
+    // Seen at distance, base moves over everything contiguous
+    ArduinoSerialReorderResult mark(uint16_t distance)
+    {
+        bitmap |= bit(distance);
+        while ((bitmap & 1) != 0)
+            step();
+        return ArduinoSerialReorderResult::DELIVER;
+    }
+
+    void slide(uint16_t count)
+    {
+        bitmap = count >= 32 ? 0 : bitmap >> count;
+        base = arduino_serial_id_advance(base, count);
+        head = static_cast<uint8_t>((head + count) % Window);
+    }
+
+    void step()
+    {
+        bitmap >>= 1;
+        base = arduino_serial_id_next(base);
+        head = static_cast<uint8_t>((head + 1) % Window);
+    }
+
+    size_t slot(uint16_t distance) const
+    { return (head + distance - 1) % Window; }
+
+    ArduinoSerialProtocolID base;
+    uint32_t bitmap;
+    // slot of base + 1
+    uint8_t head;
+    // IDs base still has to move over before the overflow packet fits
+    uint16_t advance;
+    bool overflow_pending;
+    ArduinoSerialProtocolID overflow_id;
+    uint32_t duplicates;
+    uint32_t skipped;
+    uint8_t sync_count;
+    ArduinoSerialReorderStorage<Window, MaxPayload> storage;
+
+}; // class ArduinoSerialReorderWindow
@@ -0,0 +1,182 @@
+#include "gtest/gtest.h"
+
+#include "arduino_serial_protocol.h"
+#include "arduino_serial_reorder.h"
+#include "arduino_serial_test_sync.h"
+
+#include <algorithm>
+#include <memory.h>
+#include <random>
+#include <utility>
+#include <vector>
+
+
+namespace
+{
+
+using Result = ArduinoSerialReorderResult;
+
+template<typename Window>
+std::vector<ArduinoSerialProtocolID> drain(Window& window)
+{
+    std::vector<ArduinoSerialProtocolID> result;
+    ArduinoSerialProtocolID id = 0;
+    ArduinoSerialPayload payload = {nullptr, 0};
+    while (window.release(id, payload))
+    {
+        EXPECT_EQ(sizeof(id), payload.size);
+        EXPECT_EQ(0, memcmp(&id, payload.data, sizeof(id)));
+        result.push_back(id);
+    }
+    return result;
+}
+
+template<typename Window>
+Result accept(Window& window, ArduinoSerialProtocolID id)
+{
+    return window.accept(id, &id, sizeof(id));
+}
+
+}
+
+
+TEST(ArduinoSerialReorder, IdAdvance)
+{
+    EXPECT_EQ(1, arduino_serial_id_advance(0, 1));
+    EXPECT_EQ(10, arduino_serial_id_advance(5, 5));
+    EXPECT_EQ(2, arduino_serial_id_advance(0xFFFE, 3));
+}
+
+TEST(ArduinoSerialReorder, Deduplicate)
+{
+    ArduinoSerialReorderWindow<8> window;
+
+    EXPECT_EQ(Result::DELIVER, accept(window, 1));
+    EXPECT_EQ(Result::DELIVER, accept(window, 2));
+    EXPECT_EQ(Result::DUPLICATE, accept(window, 2));
+    EXPECT_EQ(Result::DELIVER, accept(window, 4));
+    EXPECT_EQ(2, window.cumulativeId());
+    EXPECT_EQ(0x2u, window.seenBitmap());
+    EXPECT_EQ(Result::DUPLICATE, accept(window, 4));
+    EXPECT_EQ(Result::DELIVER, accept(window, 3));
+    EXPECT_EQ(4, window.cumulativeId());
+    EXPECT_EQ(Result::DUPLICATE, accept(window, 1));
+    EXPECT_EQ(3, window.duplicateCount());
+
+    // far ahead slides the window, IDs behind it count as old
+    EXPECT_EQ(Result::DELIVER, accept(window, 30));
+    EXPECT_EQ(22, window.cumulativeId());
+    EXPECT_EQ(Result::DUPLICATE, accept(window, 10));
+    EXPECT_EQ(Result::DELIVER, accept(window, 23));
+
+    ArduinoSerialProtocolID id = 0;
+    ArduinoSerialPayload payload = {nullptr, 0};
+    EXPECT_FALSE(window.release(id, payload));
+}
+
+TEST(ArduinoSerialReorder, InOrderRelease)
+{
+    ArduinoSerialReorderWindow<4, 8> window;
+
+    EXPECT_EQ(Result::BUFFERED, accept(window, 3));
+    EXPECT_EQ(Result::BUFFERED, accept(window, 2));
+    EXPECT_EQ(Result::DUPLICATE, accept(window, 3));
+    EXPECT_TRUE(drain(window).empty());
+
+    EXPECT_EQ(Result::DELIVER, accept(window, 1));
+    EXPECT_EQ((std::vector<ArduinoSerialProtocolID>{2, 3}), drain(window));
+    EXPECT_EQ(3, window.cumulativeId());
+
+    uint8_t big[9] = {};
+    EXPECT_EQ(Result::DROPPED, window.accept(5, big, sizeof(big)));
+}
+
+TEST(ArduinoSerialReorder, InOrderGivesUpOnGap)
+{
+    ArduinoSerialReorderWindow<4, 8> window;
+
+    EXPECT_EQ(Result::BUFFERED, accept(window, 2));
+    EXPECT_EQ(Result::BUFFERED, accept(window, 3));
+    // 7 does not fit before 1..3 are gone, 1 is given up on
+    EXPECT_EQ(Result::BUFFERED, accept(window, 7));
+    EXPECT_EQ(Result::DROPPED, accept(window, 5));
+    EXPECT_EQ((std::vector<ArduinoSerialProtocolID>{2, 3}), drain(window));
+    EXPECT_EQ(1, window.skippedCount());
+
+    EXPECT_EQ(Result::BUFFERED, accept(window, 5));
+    EXPECT_EQ(Result::DELIVER, accept(window, 4));
+    EXPECT_EQ((std::vector<ArduinoSerialProtocolID>{5}), drain(window));
+    EXPECT_EQ(Result::DELIVER, accept(window, 6));
+    EXPECT_EQ((std::vector<ArduinoSerialProtocolID>{7}), drain(window));
+
+    // far jump, e.g. after the peer reconnected without reset()
+    EXPECT_EQ(Result::BUFFERED, accept(window, 1000));
+    EXPECT_TRUE(drain(window).empty());
+    EXPECT_EQ(1000 - 4, window.cumulativeId());
+    EXPECT_EQ(1 + 1000 - 4 - 7, window.skippedCount());
+    EXPECT_EQ(Result::DUPLICATE, accept(window, 900));
+    EXPECT_EQ(Result::DELIVER, accept(window, 997));
+}
+
+TEST(ArduinoSerialReorder, InOrderAcrossWrap)
+{
+    ArduinoSerialReorderWindow<8, 2> window;
+    std::mt19937 random{7};
+
+    // local shuffles and duplicates inside the window, over the ID wrap
+    std::vector<ArduinoSerialProtocolID> sent;
+    ArduinoSerialProtocolID id = 0;
+    for (size_t i = 0; i < 70000; ++i)
+    {
+        id = arduino_serial_id_next(id);
+        sent.push_back(id);
+    }
+    for (size_t i = 0; i + 4 < sent.size(); i += 4)
+    {
+        std::shuffle(sent.begin() + i, sent.begin() + i + 4, random);
+        if (random() % 16 == 0)
+            sent.insert(sent.begin() + i + 4, sent[i]);
+    }
+
+    std::vector<ArduinoSerialProtocolID> received;
+    for (ArduinoSerialProtocolID value : sent)
+    {
+        if (accept(window, value) == Result::DELIVER)
+            received.push_back(value);
+        for (ArduinoSerialProtocolID released : drain(window))
+            received.push_back(released);
+    }
+
+    ASSERT_EQ(70000, received.size());
+    ArduinoSerialProtocolID expected = 0;
+    for (size_t i = 0; i < received.size(); ++i)
+    {
+        expected = arduino_serial_id_next(expected);
+        ASSERT_EQ(expected, received[i]) << i;
+    }
+    EXPECT_EQ(0, window.skippedCount());
+}
+
+TEST(ArduinoSerialReorder, PeerReconnects)
+{
+    auto protocol = ArduinoSerialProtocol::createSecondary();
+    sync(protocol);
+
+    ArduinoSerialReorderWindow<8> window;
+    window.follow(protocol.syncCount());
+    for (ArduinoSerialProtocolID id = 1; id <= 100; ++id)
+        ASSERT_EQ(Result::DELIVER, accept(window, id));
+
+    // restarted peer without a handshake looks like an old duplicate
+    EXPECT_EQ(Result::DUPLICATE, accept(window, 1));
+
+    sync(protocol);
+    window.follow(protocol.syncCount());
+    EXPECT_EQ(Result::DELIVER, accept(window, 1));
+    EXPECT_EQ(Result::DELIVER, accept(window, 2));
+    EXPECT_EQ(2, window.cumulativeId());
+
+    // same handshake keeps the window
+    window.follow(protocol.syncCount());
+    EXPECT_EQ(Result::DUPLICATE, accept(window, 2));
+}
@@ -0,0 +1,242 @@
+#include "arduino_serial_ring_buffer.h"
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+constexpr const size_t ArduinoSerialRingBuffer::CACHE_LINE_SIZE;
+
+
+namespace
+{
+
+size_t round_up_pow2(size_t value)
+{
+    size_t result = 1;
+    while (result < value)
+        result <<= 1;
+    return result;
+}
+
+// Maps the same memory at [base, base + size) and [base + size, base + 2 * size)
+uint8_t* map_mirrored(size_t size)
+{
+    const int fd = memfd_create("arduino_serial_ring", 0);
+    if (fd < 0)
+        return nullptr;
+
+    if (ftruncate(fd, size) != 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    void* base = mmap(nullptr, 2 * size, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    uint8_t* data = static_cast<uint8_t*>(base);
+    void* first = mmap(data, size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_FIXED, fd, 0);
+    void* second = mmap(data + size, size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_FIXED, fd, 0);
+    close(fd);
+
+    if (first == MAP_FAILED || second == MAP_FAILED)
+    {
+        munmap(base, 2 * size);
+        return nullptr;
+    }
+    return data;
+}
+
+ArduinoSerialReceiveResult
+receive_result(ArduinoSerialReadResult read_result)
+{
+    ArduinoSerialReceiveResult result;
+    result.read_result = read_result;
+    result.bytes_read = 0;
+    result.payload = nullptr;
+    result.payload_size = 0;
+    result.packet_id = 0;
+    return result;
+}
+
+}
+
+ArduinoSerialRingBuffer::ArduinoSerialRingBuffer(
+        size_t capacity, ArduinoSerialRingBufferMapping mapping)
+: buffer{nullptr}
+, scratch{nullptr}
+, mask{0}
+, buffer_mapping{mapping}
+{
+    head.value.store(0);
+    head.cached = 0;
+    tail.value.store(0);
+    tail.cached = 0;
+
+    if (capacity == 0)
+        return;
+
+    if (mapping == ArduinoSerialRingBufferMapping::MIRRORED)
+    {
+        const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        capacity = round_up_pow2(capacity < page_size ? page_size : capacity);
+        buffer = map_mirrored(capacity);
+    }
+    else
+    {
+        capacity = round_up_pow2(capacity);
+        buffer = new uint8_t[capacity];
+        scratch = new uint8_t[capacity];
+    }
+
+    if (buffer != nullptr)
+        mask = capacity - 1;
+}
+
+ArduinoSerialRingBuffer::~ArduinoSerialRingBuffer()
+{
+    if (buffer_mapping == ArduinoSerialRingBufferMapping::MIRRORED)
+    {
+        if (buffer != nullptr)
+            munmap(buffer, 2 * capacity());
+    }
+    else
+    {
+        delete[] buffer;
+        delete[] scratch;
+    }
+}
+
+void* ArduinoSerialRingBuffer::writeView(size_t& size)
+{
+    const size_t h = head.value.load(std::memory_order_relaxed);
+    if (h - head.cached == capacity())
+        head.cached = tail.value.load(std::memory_order_acquire);
+
+    const size_t offset = h & mask;
+    size = capacity() - (h - head.cached);
+    if (buffer_mapping == ArduinoSerialRingBufferMapping::PLAIN
+        && size > capacity() - offset)
+        size = capacity() - offset;
+    return buffer + offset;
+}
+
+void ArduinoSerialRingBuffer::commitWrite(size_t size)
+{
+    const size_t h = head.value.load(std::memory_order_relaxed);
+    head.value.store(h + size, std::memory_order_release);
+}
+
+size_t ArduinoSerialRingBuffer::write(const void* _data, size_t size)
+{
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    size_t written = 0;
+    while (written < size)
+    {
+        size_t view_size = 0;
+        void* view = writeView(view_size);
+        if (view_size == 0)
+            break;
+        if (view_size > size - written)
+            view_size = size - written;
+        memcpy(view, data + written, view_size);
+        commitWrite(view_size);
+        written += view_size;
+    }
+    return written;
+}
+
+size_t ArduinoSerialRingBuffer::readable() const
+{
+    return head.value.load(std::memory_order_acquire)
+           - tail.value.load(std::memory_order_relaxed);
+}
+
+const void* ArduinoSerialRingBuffer::readView(size_t& size)
+{
+    const size_t t = tail.value.load(std::memory_order_relaxed);
+    if (tail.cached == t)
+        tail.cached = head.value.load(std::memory_order_acquire);
+
+    const size_t offset = t & mask;
+    size = tail.cached - t;
+    if (buffer_mapping == ArduinoSerialRingBufferMapping::PLAIN
+        && size > capacity() - offset)
+        size = capacity() - offset;
+    return buffer + offset;
+}
+
+const void* ArduinoSerialRingBuffer::peek(size_t size)
+{
+    const size_t t = tail.value.load(std::memory_order_relaxed);
+    if (tail.cached - t < size)
+    {
+        tail.cached = head.value.load(std::memory_order_acquire);
+        if (tail.cached - t < size)
+            return nullptr;
+    }
+
+    const size_t offset = t & mask;
+    if (buffer_mapping == ArduinoSerialRingBufferMapping::MIRRORED
+        || offset + size <= capacity())
+        return buffer + offset;
+
+    const size_t first = capacity() - offset;
+    memcpy(scratch, buffer + offset, first);
+    memcpy(scratch + first, buffer, size - first);
+    return scratch;
+}
+
+void ArduinoSerialRingBuffer::consume(size_t size)
+{
+    const size_t t = tail.value.load(std::memory_order_relaxed);
+    // bytes known from readable() only, cache must not fall behind tail
+    if (tail.cached - t < size)
+        tail.cached = t + size;
+    tail.value.store(t + size, std::memory_order_release);
+}
+
+ArduinoSerialRingReader::ArduinoSerialRingReader(
+        ArduinoSerialRingBuffer& ring, ArduinoSerialProtocol& protocol)
+: ring(ring)
+, protocol(protocol)
+, pending_consume{0}
+{
+}
+
+ArduinoSerialReceiveResult ArduinoSerialRingReader::readNext()
+{
+    ring.consume(pending_consume);
+    pending_consume = 0;
+
+    const ArduinoSerialNextOperation operation = protocol.nextOperation();
+    if (operation.read_operation != ArduinoSerialOperation::READ_HEADER
+        && operation.read_operation != ArduinoSerialOperation::READ_PAYLOAD)
+        return receive_result(ArduinoSerialReadResult::NOPE);
+
+    if (operation.bytes_to_read > ring.capacity())
+        return receive_result(ArduinoSerialReadResult::ERROR_BUFFER_TOO_SMALL);
+
+    size_t size = 0;
+    const void* data = ring.readView(size);
+    if (size < operation.bytes_to_read)
+    {
+        data = ring.peek(operation.bytes_to_read);
+        if (data == nullptr)
+            return receive_result(
+                    ArduinoSerialReadResult::ERROR_INSUFFICIENT_DATA_LENGTH);
+        size = operation.bytes_to_read;
+    }
+
+    const ArduinoSerialReceiveResult result = protocol.readBytes(data, size);
+    pending_consume = result.bytes_read;
+    return result;
+}
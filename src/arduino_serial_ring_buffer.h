@@ -0,0 +1,117 @@
+#pragma once
+
+#include "arduino_serial_protocol.h"
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+
+enum class ArduinoSerialRingBufferMapping
+{
+    // single buffer, views crossing the wrap point are linearized
+    // into a consumer scratch buffer
+    PLAIN,
+    // buffer mapped twice back to back, every view is contiguous
+    MIRRORED
+};
+
+
+// Single-producer/single-consumer byte ring buffer, host only.
+// Producer calls writeView/commitWrite (or write), consumer calls
+// readView/peek/consume; each side may run on its own thread.
+class ArduinoSerialRingBuffer
+{
+public:
+    static constexpr const size_t CACHE_LINE_SIZE = 64;
+
+    // capacity is rounded up to a power of two (and to page size
+    // for MIRRORED mapping)
+    ArduinoSerialRingBuffer(size_t capacity,
+                            ArduinoSerialRingBufferMapping mapping);
+
+    ArduinoSerialRingBuffer(const ArduinoSerialRingBuffer&) = delete;
+    ArduinoSerialRingBuffer& operator=(const ArduinoSerialRingBuffer&) = delete;
+
+    ~ArduinoSerialRingBuffer();
+
+    bool isValid() const
+    { return buffer != nullptr; }
+
+    size_t capacity() const
+    { return mask + 1; }
+
+    ArduinoSerialRingBufferMapping mapping() const
+    { return buffer_mapping; }
+
+    // producer side
+
+    // contiguous free space, e.g. to read() into; may lag behind the
+    // consumer until the space last seen is used up
+    void* writeView(size_t& size);
+
+    void commitWrite(size_t size);
+
+    size_t write(const void* data, size_t size);
+
+    // consumer side
+
+    size_t readable() const;
+
+    // contiguous readable bytes; may lag behind the producer until the
+    // bytes last seen are consumed
+    const void* readView(size_t& size);
+
+    // size contiguous readable bytes or null if fewer are buffered,
+    // valid until consume()
+    const void* peek(size_t size);
+
+    void consume(size_t size);
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Index
+    {
+        std::atomic<size_t> value;
+        // other side's index as last seen, reloaded only when the ring
+        // looks full (producer) or empty (consumer) to avoid touching
+        // its cache line on every view
+        size_t cached;
+    };
+
+    Index head;
+    Index tail;
+
+    uint8_t* buffer;
+    uint8_t* scratch;
+    size_t mask;
+    ArduinoSerialRingBufferMapping buffer_mapping;
+
+}; // class ArduinoSerialRingBuffer
+
+
+// Drives ArduinoSerialProtocol from the consumer side of a ring buffer,
+// handing readBytes exactly the contiguous bytes nextOperation() asks for.
+// Bytes are released to producer on the next call, so payload view of
+// returned result stays valid until then.
+// Every step has to fit in the ring at once, the largest one is an extended
+// payload with its checksum (ARDUINO_SERIAL_MAX_EXTENDED_PAYLOAD and a few
+// bytes). A smaller ring gets ERROR_BUFFER_TOO_SMALL for such a packet, as
+// it never becomes readable; ERROR_INSUFFICIENT_DATA_LENGTH means retry.
+class ArduinoSerialRingReader
+{
+public:
+    ArduinoSerialRingReader(ArduinoSerialRingBuffer& ring,
+                            ArduinoSerialProtocol& protocol);
+
+    ArduinoSerialRingReader(const ArduinoSerialRingReader&) = delete;
+
+    ~ArduinoSerialRingReader() = default;
+
+    ArduinoSerialReceiveResult readNext();
+
+private:
+    ArduinoSerialRingBuffer& ring;
+    ArduinoSerialProtocol& protocol;
+    size_t pending_consume;
+
+}; // class ArduinoSerialRingReader
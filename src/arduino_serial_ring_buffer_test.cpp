@@ -0,0 +1,209 @@
+#include "gtest/gtest.h"
+
+#include "arduino_serial_protocol.h"
+#include "arduino_serial_protocol_string.h"
+#include "arduino_serial_ring_buffer.h"
+#include "arduino_serial_test_sync.h"
+
+#include <memory.h>
+#include <thread>
+#include <vector>
+
+
+namespace
+{
+
+std::vector<uint8_t> make_stream(size_t packets)
+{
+    auto protocol = ArduinoSerialProtocol::createSecondary();
+    sync(protocol);
+
+    std::vector<uint8_t> stream;
+    for (size_t i = 0; i < packets; ++i)
+    {
+        std::vector<uint8_t> payload(i % 40, static_cast<uint8_t>(i));
+        const size_t offset = stream.size();
+        stream.resize(offset + protocol.packetSize(payload.size()));
+        protocol.writeHeader(stream.data() + offset, protocol.createNextPacketId(),
+                             payload.data(), payload.size());
+        memcpy(stream.data() + offset + protocol.headerSize(),
+               payload.data(), payload.size());
+    }
+    return stream;
+}
+
+}
+
+
+class FArduinoSerialRingBuffer
+        : public ::testing::TestWithParam<ArduinoSerialRingBufferMapping>
+{};
+
+
+TEST_P(FArduinoSerialRingBuffer, Capacity)
+{
+    ArduinoSerialRingBuffer ring{100, GetParam()};
+    ASSERT_TRUE(ring.isValid());
+    EXPECT_GE(ring.capacity(), 100);
+    EXPECT_EQ(0, ring.capacity() & (ring.capacity() - 1));
+    EXPECT_EQ(0, ring.readable());
+}
+
+TEST_P(FArduinoSerialRingBuffer, WrapAround)
+{
+    ArduinoSerialRingBuffer ring{64, GetParam()};
+    ASSERT_TRUE(ring.isValid());
+    const size_t capacity = ring.capacity();
+
+    std::vector<uint8_t> fill(capacity - 3, 0x11);
+    ASSERT_EQ(fill.size(), ring.write(fill.data(), fill.size()));
+    ring.consume(fill.size());
+
+    const uint8_t data[] = {1, 2, 3, 4, 5, 6, 7, 8};
+    ASSERT_EQ(sizeof(data), ring.write(data, sizeof(data)));
+    ASSERT_EQ(sizeof(data), ring.readable());
+
+    size_t view_size = 0;
+    const void* view = ring.readView(view_size);
+    if (GetParam() == ArduinoSerialRingBufferMapping::MIRRORED)
+    {
+        ASSERT_EQ(sizeof(data), view_size);
+        EXPECT_EQ(0, memcmp(view, data, sizeof(data)));
+    }
+    else
+    {
+        ASSERT_EQ(3, view_size);
+        EXPECT_EQ(0, memcmp(view, data, 3));
+    }
+
+    const void* peeked = ring.peek(sizeof(data));
+    ASSERT_NE(nullptr, peeked);
+    EXPECT_EQ(0, memcmp(peeked, data, sizeof(data)));
+    EXPECT_EQ(nullptr, ring.peek(sizeof(data) + 1));
+
+    ring.consume(sizeof(data));
+    EXPECT_EQ(0, ring.readable());
+}
+
+TEST_P(FArduinoSerialRingBuffer, Full)
+{
+    ArduinoSerialRingBuffer ring{64, GetParam()};
+    ASSERT_TRUE(ring.isValid());
+
+    std::vector<uint8_t> data(ring.capacity() + 10, 0x22);
+    EXPECT_EQ(ring.capacity(), ring.write(data.data(), data.size()));
+
+    size_t view_size = 1;
+    ring.writeView(view_size);
+    EXPECT_EQ(0, view_size);
+
+    ring.consume(10);
+    EXPECT_EQ(10, ring.write(data.data(), data.size()));
+}
+
+TEST_P(FArduinoSerialRingBuffer, ViewsReloadWhenUsedUp)
+{
+    ArduinoSerialRingBuffer ring{64, GetParam()};
+    ASSERT_TRUE(ring.isValid());
+
+    const uint8_t data[] = {1, 2, 3, 4};
+    ring.write(data, sizeof(data));
+    size_t view_size = 0;
+    ring.readView(view_size);
+    EXPECT_EQ(sizeof(data), view_size);
+
+    // producer index is read again only once the bytes seen are consumed
+    ring.write(data, sizeof(data));
+    ring.readView(view_size);
+    EXPECT_EQ(sizeof(data), view_size);
+    EXPECT_EQ(2 * sizeof(data), ring.readable());
+    ring.consume(sizeof(data));
+    ring.readView(view_size);
+    EXPECT_EQ(sizeof(data), view_size);
+    ring.consume(sizeof(data));
+
+    // same for the producer once the free space seen is filled
+    std::vector<uint8_t> fill(ring.capacity(), 0x33);
+    ring.write(fill.data(), fill.size());
+    ring.consume(10);
+    ring.writeView(view_size);
+    EXPECT_EQ(10, view_size);
+}
+
+TEST_P(FArduinoSerialRingBuffer, DecodeFromProducerThread)
+{
+    const size_t packets = 2000;
+    const auto stream = make_stream(packets);
+
+    ArduinoSerialRingBuffer ring{256, GetParam()};
+    ASSERT_TRUE(ring.isValid());
+    auto protocol = ArduinoSerialProtocol::createSecondary();
+    sync(protocol);
+    ArduinoSerialRingReader reader{ring, protocol};
+
+    std::thread producer{[&ring, &stream]()
+    {
+        size_t offset = 0;
+        size_t chunk = 1;
+        while (offset < stream.size())
+        {
+            size_t size = stream.size() - offset;
+            if (size > chunk)
+                size = chunk;
+            offset += ring.write(stream.data() + offset, size);
+            chunk = chunk % 97 + 1;
+        }
+    }};
+
+    size_t received = 0;
+    size_t errors = 0;
+    while (received < packets && errors == 0)
+    {
+        const auto result = reader.readNext();
+        if (result.read_result == ArduinoSerialReadResult::OK
+            && result.payload != nullptr)
+        {
+            const auto* payload = static_cast<const uint8_t*>(result.payload);
+            if (result.packet_id != received + 1
+                || result.payload_size != received % 40
+                || (result.payload_size > 0
+                    && payload[0] != static_cast<uint8_t>(received)))
+                ++errors;
+            ++received;
+        }
+        else if (result.read_result != ArduinoSerialReadResult::OK
+                 && result.read_result != ArduinoSerialReadResult::ERROR_INSUFFICIENT_DATA_LENGTH)
+        {
+            ++errors;
+        }
+    }
+    producer.join();
+
+    EXPECT_EQ(packets, received);
+    EXPECT_EQ(0, errors);
+}
+
+TEST(ArduinoSerialRingReader, PayloadLargerThanRing)
+{
+    ArduinoSerialRingBuffer ring{64, ArduinoSerialRingBufferMapping::PLAIN};
+    ASSERT_TRUE(ring.isValid());
+    ASSERT_EQ(64, ring.capacity());
+    auto protocol = ArduinoSerialProtocol::createSecondary();
+    sync(protocol);
+    ArduinoSerialRingReader reader{ring, protocol};
+
+    const std::vector<uint8_t> payload(100, 0x5A);
+    std::vector<uint8_t> stream(protocol.packetSize(payload.size()));
+    protocol.writeHeader(stream.data(), protocol.createNextPacketId(),
+                         payload.data(), payload.size());
+    ASSERT_EQ(protocol.headerSize(), ring.write(stream.data(), protocol.headerSize()));
+
+    EXPECT_EQ(ArduinoSerialReadResult::OK, reader.readNext().read_result);
+    ASSERT_EQ(ArduinoSerialOperation::READ_PAYLOAD, protocol.nextOperation().read_operation);
+    // payload never fits, so this is not a retry
+    EXPECT_EQ(ArduinoSerialReadResult::ERROR_BUFFER_TOO_SMALL, reader.readNext().read_result);
+}
+
+INSTANTIATE_TEST_CASE_P(Mappings, FArduinoSerialRingBuffer,
+                        ::testing::Values(ArduinoSerialRingBufferMapping::PLAIN,
+                                          ArduinoSerialRingBufferMapping::MIRRORED));
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arduino_serial_config.h"
+
+// Per-protocol statistics counters, on by default on host only.
+// When 0 ArduinoSerialProtocolCounters is empty and every update is
+// an inline no-op.
+#ifndef ARDUINO_SERIAL_STATS
+    #ifdef ARDUINO
+        #define ARDUINO_SERIAL_STATS 0
+    #else
+        #define ARDUINO_SERIAL_STATS 1
+    #endif
+#endif
+
+#if ARDUINO_SERIAL_STATS
+    #include <atomic>
+#endif
+
+
+enum class ArduinoSerialCounter : uint8_t
+{
+    PACKETS_OK,
+    HEADER_CRC_ERRORS,
+    PAYLOAD_CRC_ERRORS,
+    // skipped while looking for STROBE_1 after an error
+    BYTES_DISCARDED,
+    SYNCS,
+    // syncs on a link that was already synced before
+    RESYNCS,
+    BYTES_IN,
+    BYTES_OUT,
+    // agreed rates given up on, see baudRate()
+    BAUD_ROLLBACKS,
+    COUNT
+};
+
+struct ArduinoSerialProtocolStats
+{
+    uint64_t packets_ok;
+    uint64_t header_crc_errors;
+    uint64_t payload_crc_errors;
+    uint64_t bytes_discarded;
+    uint64_t syncs;
+    uint64_t resyncs;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t baud_rollbacks;
+};
+
+
+// Every counter has a single writer (receive side counters the decoding
+// thread, BYTES_OUT the encoding one), so updates are plain relaxed
+// load/store without a locked instruction. snapshot() may be called from
+// any thread at any time and never blocks the writers; counters are
+// read one by one, so a snapshot is not a consistent cut across them.
+class ArduinoSerialProtocolCounters
+{
+public:
+#if ARDUINO_SERIAL_STATS
+    ArduinoSerialProtocolCounters()
+    {
+        for (size_t i = 0; i < COUNT; ++i)
+            values[i].store(0, std::memory_order_relaxed);
+    }
+
+    ArduinoSerialProtocolCounters(ArduinoSerialProtocolCounters&& other)
+    {
+        for (size_t i = 0; i < COUNT; ++i)
+            values[i].store(other.values[i].load(std::memory_order_relaxed),
+                            std::memory_order_relaxed);
+    }
+
+    void add(ArduinoSerialCounter counter, uint64_t value) const
+    {
+        std::atomic<uint64_t>& target = values[static_cast<size_t>(counter)];
+        target.store(target.load(std::memory_order_relaxed) + value,
+                     std::memory_order_relaxed);
+    }
+
+    uint64_t get(ArduinoSerialCounter counter) const
+    { return values[static_cast<size_t>(counter)].load(std::memory_order_relaxed); }
+
+    ArduinoSerialProtocolStats snapshot() const
+    {
+        ArduinoSerialProtocolStats stats;
+        stats.packets_ok = get(ArduinoSerialCounter::PACKETS_OK);
+        stats.header_crc_errors = get(ArduinoSerialCounter::HEADER_CRC_ERRORS);
+        stats.payload_crc_errors = get(ArduinoSerialCounter::PAYLOAD_CRC_ERRORS);
+        stats.bytes_discarded = get(ArduinoSerialCounter::BYTES_DISCARDED);
+        stats.syncs = get(ArduinoSerialCounter::SYNCS);
+        stats.resyncs = get(ArduinoSerialCounter::RESYNCS);
+        stats.bytes_in = get(ArduinoSerialCounter::BYTES_IN);
+        stats.bytes_out = get(ArduinoSerialCounter::BYTES_OUT);
+        stats.baud_rollbacks = get(ArduinoSerialCounter::BAUD_ROLLBACKS);
+        return stats;
+    }
+
+private:
+    static constexpr const size_t COUNT =
+            static_cast<size_t>(ArduinoSerialCounter::COUNT);
+
+    // written from const encoder methods too
+    mutable std::atomic<uint64_t> values[COUNT];
+#else
+    void add(ArduinoSerialCounter, uint64_t) const
+    {}
+#endif
+
+}; // class ArduinoSerialProtocolCounters
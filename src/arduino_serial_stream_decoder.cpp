@@ -0,0 +1,110 @@
+#include "arduino_serial_stream_decoder.h"
+
+#include <string.h>
+
+
+constexpr const size_t ArduinoSerialStreamDecoder::CARRY_SIZE;
+
+
+namespace
+{
+
+ArduinoSerialDecodeResult decode_result()
+{
+    ArduinoSerialDecodeResult result;
+    result.bytes_read = 0;
+    result.packets_read = 0;
+    result.errors = 0;
+    return result;
+}
+
+bool is_error(ArduinoSerialReadResult read_result)
+{
+    return read_result == ArduinoSerialReadResult::ERROR_UNEXPECTED_DATA
+           || read_result == ArduinoSerialReadResult::ERROR_CHECKSUM;
+}
+
+}
+
+ArduinoSerialStreamDecoder::ArduinoSerialStreamDecoder(
+        ArduinoSerialProtocol& protocol)
+: protocol(protocol)
+, carry_len{0}
+{
+}
+
+void ArduinoSerialStreamDecoder::reset()
+{
+    carry_len = 0;
+}
+
+ArduinoSerialDecodeResult
+ArduinoSerialStreamDecoder::decode(const void* _data, size_t data_size,
+                                   ArduinoSerialPacketCallback callback,
+                                   void* context)
+{
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    ArduinoSerialDecodeResult result = decode_result();
+
+    for (;;)
+    {
+        const ArduinoSerialNextOperation operation = protocol.nextOperation();
+        if (operation.read_operation != ArduinoSerialOperation::READ_HEADER
+            && operation.read_operation != ArduinoSerialOperation::READ_PAYLOAD)
+            break;
+
+        const size_t available = data_size - result.bytes_read;
+        const uint8_t* chunk = data + result.bytes_read;
+        size_t chunk_size = available;
+
+        if (carry_len > 0 || available < operation.bytes_to_read)
+        {
+            if (operation.bytes_to_read > carry_len)
+            {
+                size_t missing = operation.bytes_to_read - carry_len;
+                if (missing > available)
+                    missing = available;
+                memcpy(carry + carry_len, chunk, missing);
+                carry_len += missing;
+                result.bytes_read += missing;
+            }
+            if (carry_len < operation.bytes_to_read)
+                break;
+
+            chunk = carry;
+            chunk_size = carry_len;
+        }
+
+        const ArduinoSerialReceiveResult receive =
+                protocol.readBytes(chunk, chunk_size);
+
+        if (receive.read_result == ArduinoSerialReadResult::OK
+            && operation.read_operation == ArduinoSerialOperation::READ_PAYLOAD)
+        {
+            ++result.packets_read;
+            if (callback != nullptr)
+                callback(context, receive.packet_id,
+                         receive.payload, receive.payload_size);
+        }
+        else if (is_error(receive.read_result))
+        {
+            ++result.errors;
+        }
+
+        if (chunk == carry)
+        {
+            carry_len -= receive.bytes_read;
+            memmove(carry, carry + receive.bytes_read, carry_len);
+        }
+        else
+        {
+            result.bytes_read += receive.bytes_read;
+        }
+
+        if (receive.bytes_read == 0
+            && receive.read_result != ArduinoSerialReadResult::OK)
+            break;
+    }
+
+    return result;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "arduino_serial_protocol.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+using ArduinoSerialPacketCallback = void (*)(void* context,
+                                             ArduinoSerialProtocolID id,
+                                             const void* payload,
+                                             size_t payload_size);
+
+struct ArduinoSerialDecodeResult
+{
+    size_t bytes_read;
+    size_t packets_read;
+    size_t errors;
+};
+
+
+// Feeds arbitrary-length chunks of a byte stream through
+// ArduinoSerialProtocol, reporting every validated packet to a callback.
+// Steps that are split between two chunks are kept in an internal
+// carry buffer, so the caller never has to re-slice its input.
+//
+// Decoding stops early only when protocol waits for a sync reply to be
+// sent (SEND_SYNC_REPLY), bytes_read tells where to continue afterwards.
+// Payload passed to callback is valid only during the callback.
+class ArduinoSerialStreamDecoder
+{
+public:
+    // largest step is a payload
+    static constexpr const size_t CARRY_SIZE =
+            ARDUINO_SERIAL_MAX_EXTENDED_PAYLOAD > 255 ? ARDUINO_SERIAL_MAX_EXTENDED_PAYLOAD : 255;
+
+    explicit ArduinoSerialStreamDecoder(ArduinoSerialProtocol& protocol);
+
+    ArduinoSerialStreamDecoder(const ArduinoSerialStreamDecoder&) = delete;
+
+    ~ArduinoSerialStreamDecoder() = default;
+
+    ArduinoSerialDecodeResult decode(const void* data, size_t data_size,
+                                     ArduinoSerialPacketCallback callback,
+                                     void* context);
+
+    size_t pendingBytes() const
+    { return carry_len; }
+
+    void reset();
+
+private:
+    ArduinoSerialProtocol& protocol;
+    size_t carry_len;
+    uint8_t carry[CARRY_SIZE];
+
+}; // class ArduinoSerialStreamDecoder
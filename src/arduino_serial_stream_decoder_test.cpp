@@ -0,0 +1,232 @@
+#include "gtest/gtest.h"
+
+#include "arduino_serial_protocol.h"
+#include "arduino_serial_protocol_string.h"
+#include "arduino_serial_stream_decoder.h"
+#include "arduino_serial_test_sync.h"
+
+#include <memory.h>
+#include <vector>
+
+
+namespace
+{
+
+struct ReceivedPacket
+{
+    ArduinoSerialProtocolID id;
+    std::vector<uint8_t> payload;
+};
+
+void collect_packet(void* context, ArduinoSerialProtocolID id,
+                    const void* payload, size_t payload_size)
+{
+    const uint8_t* data = static_cast<const uint8_t*>(payload);
+    ReceivedPacket packet;
+    packet.id = id;
+    packet.payload.assign(data, data + payload_size);
+    static_cast<std::vector<ReceivedPacket>*>(context)->push_back(packet);
+}
+
+#if ARDUINO_SERIAL_MAX_EXTENDED_PAYLOAD > 255
+// Sync with a request that offers extended frames
+void sync_extended(ArduinoSerialProtocol& protocol)
+{
+    auto primary = ArduinoSerialProtocol::createPrimary();
+    primary.setFeatures(ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES);
+    std::vector<uint8_t> request(primary.syncHeaderSize());
+    primary.writeSyncHeader(request.data());
+
+    protocol.setFeatures(ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES);
+    for (size_t offset = 0; offset < request.size();)
+        offset += protocol.readBytes(request.data() + offset,
+                                     request.size() - offset).bytes_read;
+    protocol.syncReplySent();
+}
+#endif
+
+void append_packet(ArduinoSerialProtocol& protocol, std::vector<uint8_t>& stream,
+                   const std::vector<uint8_t>& payload)
+{
+    const size_t offset = stream.size();
+    stream.resize(offset + protocol.packetSize(payload.size()));
+    memcpy(stream.data() + offset + protocol.dataHeaderSize(payload.size()),
+           payload.data(), payload.size());
+    protocol.writeHeader(stream.data() + offset, protocol.createNextPacketId(),
+                         payload.data(), payload.size());
+}
+
+}
+
+
+class FArduinoSerialStreamDecoder : public ::testing::Test
+{
+public:
+    FArduinoSerialStreamDecoder()
+    : sender{ArduinoSerialProtocol::createSecondary()}
+    , receiver{ArduinoSerialProtocol::createSecondary()}
+    , decoder{receiver}
+    {}
+
+    void SetUp() override
+    {
+        sync(sender);
+
+        append_packet(sender, stream, {0x0A, 0x2B, 0x30, 0x45});
+        append_packet(sender, stream, {});
+        append_packet(sender, stream, std::vector<uint8_t>(255, 0xA5));
+        append_packet(sender, stream, {0x63});
+    }
+
+    testing::AssertionResult checkPackets() const
+    {
+        if (packets.size() != 4)
+            return testing::AssertionFailure()
+                    << "packets expected to be 4, got " << packets.size();
+        for (size_t i = 0; i < packets.size(); ++i)
+        {
+            if (packets[i].id != i + 1)
+                return testing::AssertionFailure()
+                        << "packet " << i << " has id " << packets[i].id;
+        }
+        if (packets[0].payload != std::vector<uint8_t>({0x0A, 0x2B, 0x30, 0x45})
+            || !packets[1].payload.empty()
+            || packets[2].payload != std::vector<uint8_t>(255, 0xA5)
+            || packets[3].payload != std::vector<uint8_t>({0x63}))
+            return testing::AssertionFailure() << "payload mismatch";
+        return testing::AssertionSuccess();
+    }
+
+protected:
+    ArduinoSerialProtocol sender;
+    ArduinoSerialProtocol receiver;
+    ArduinoSerialStreamDecoder decoder;
+    std::vector<uint8_t> stream;
+    std::vector<ReceivedPacket> packets;
+
+};
+
+
+TEST_F(FArduinoSerialStreamDecoder, WholeBuffer)
+{
+    sync(receiver);
+
+    auto result = decoder.decode(stream.data(), stream.size(),
+                                 &collect_packet, &packets);
+    EXPECT_EQ(stream.size(), result.bytes_read);
+    EXPECT_EQ(4, result.packets_read);
+    EXPECT_EQ(0, result.errors);
+    EXPECT_EQ(0, decoder.pendingBytes());
+    EXPECT_TRUE(checkPackets());
+}
+
+TEST_F(FArduinoSerialStreamDecoder, ByteByByte)
+{
+    sync(receiver);
+
+    for (size_t i = 0; i < stream.size(); ++i)
+    {
+        auto result = decoder.decode(&stream[i], 1, &collect_packet, &packets);
+        ASSERT_EQ(1, result.bytes_read);
+        ASSERT_EQ(0, result.errors);
+    }
+    EXPECT_EQ(0, decoder.pendingBytes());
+    EXPECT_TRUE(checkPackets());
+}
+
+TEST_F(FArduinoSerialStreamDecoder, SplitAnywhere)
+{
+    for (size_t split = 0; split <= stream.size(); ++split)
+    {
+        auto split_receiver = ArduinoSerialProtocol::createSecondary();
+        ArduinoSerialStreamDecoder split_decoder{split_receiver};
+        packets.clear();
+        sync(split_receiver);
+
+        auto result1 = split_decoder.decode(stream.data(), split,
+                                            &collect_packet, &packets);
+        ASSERT_EQ(split, result1.bytes_read);
+        auto result2 = split_decoder.decode(stream.data() + split, stream.size() - split,
+                                            &collect_packet, &packets);
+        ASSERT_EQ(stream.size() - split, result2.bytes_read);
+        ASSERT_TRUE(checkPackets()) << "split at " << split;
+    }
+}
+
+TEST_F(FArduinoSerialStreamDecoder, HeaderCRCError)
+{
+    sync(receiver);
+
+    const uint8_t data[] = {
+            0xA5, 0x63, 0x00, 0x01,
+            0x04, 0x08, 0x24, 0xEA,
+            0x0A, 0x2B, 0x30, 0x45,
+            0xA5, 0x63, 0x00, 0x02,
+            0x04, 0x36, 0x95, 0x7F,
+            0x0A, 0x2B, 0x30, 0x45};
+
+    auto result = decoder.decode(data, 5, &collect_packet, &packets);
+    EXPECT_EQ(5, result.bytes_read);
+    EXPECT_EQ(0, result.packets_read);
+
+    auto result2 = decoder.decode(data + 5, sizeof(data) - 5,
+                                  &collect_packet, &packets);
+    EXPECT_EQ(sizeof(data) - 5, result2.bytes_read);
+    EXPECT_EQ(1, result2.packets_read);
+    EXPECT_EQ(1, result2.errors);
+    ASSERT_EQ(1, packets.size());
+    EXPECT_EQ(2, packets[0].id);
+    EXPECT_EQ(std::vector<uint8_t>({0x0A, 0x2B, 0x30, 0x45}), packets[0].payload);
+}
+
+TEST_F(FArduinoSerialStreamDecoder, StopsForSyncReply)
+{
+    std::vector<uint8_t> data(SYNC_STROBE, SYNC_STROBE + sizeof(SYNC_STROBE));
+    data.insert(data.end(), stream.begin(), stream.end());
+
+    auto result = decoder.decode(data.data(), data.size(), &collect_packet, &packets);
+    EXPECT_EQ(sizeof(SYNC_STROBE), result.bytes_read);
+    EXPECT_EQ(0, result.packets_read);
+    EXPECT_EQ(ArduinoSerialOperation::SEND_SYNC_REPLY,
+              receiver.nextOperation().read_operation);
+
+    ASSERT_EQ(ArduinoSerialGeneralResult::OK, receiver.syncReplySent());
+
+    auto result2 = decoder.decode(data.data() + result.bytes_read,
+                                  data.size() - result.bytes_read,
+                                  &collect_packet, &packets);
+    EXPECT_EQ(stream.size(), result2.bytes_read);
+    EXPECT_TRUE(checkPackets());
+}
+
+#if ARDUINO_SERIAL_MAX_EXTENDED_PAYLOAD > 255
+TEST(ArduinoSerialStreamDecoder, ExtendedFrameSplit)
+{
+    auto sender = ArduinoSerialProtocol::createSecondary();
+    sync_extended(sender);
+    ASSERT_EQ(ARDUINO_SERIAL_FEATURE_EXTENDED_FRAMES, sender.features());
+
+    std::vector<uint8_t> payload(3000);
+    for (size_t i = 0; i < payload.size(); ++i)
+        payload[i] = static_cast<uint8_t>(i * 7);
+    std::vector<uint8_t> stream;
+    append_packet(sender, stream, payload);
+    append_packet(sender, stream, {0x0A, 0x2B});
+
+    auto receiver = ArduinoSerialProtocol::createSecondary();
+    sync_extended(receiver);
+    ArduinoSerialStreamDecoder decoder{receiver};
+    std::vector<ReceivedPacket> packets;
+    for (size_t offset = 0; offset < stream.size(); offset += 100)
+    {
+        const size_t size = stream.size() - offset < 100 ? stream.size() - offset : 100;
+        auto result = decoder.decode(stream.data() + offset, size,
+                                     &collect_packet, &packets);
+        ASSERT_EQ(size, result.bytes_read);
+        ASSERT_EQ(0, result.errors);
+    }
+    ASSERT_EQ(2, packets.size());
+    EXPECT_EQ(payload, packets[0].payload);
+    EXPECT_EQ(std::vector<uint8_t>({0x0A, 0x2B}), packets[1].payload);
+}
+#endif
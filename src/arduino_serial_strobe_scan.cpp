@@ -0,0 +1,177 @@
+#include "arduino_serial_strobe_scan.h"
+
+#ifdef ARDUINO_SERIAL_SCAN_STROBE_X86
+    #include <immintrin.h>
+#endif
+
+
+namespace
+{
+
+// Last byte has variants: classic, extended and short frame; sync
+// request without and with parameters
+const uint8_t PACKET_STROBE[] = {0xA5, 0x63};
+const uint8_t PACKET_STROBE_VARIANTS[] = {0x63, 0x9C, 0xC6};
+const uint8_t SYNC_STROBE[] = {0xD3, 0x74, 0xE5, 0x52};
+const uint8_t SYNC_STROBE_VARIANTS[] = {0x52, 0xAD};
+
+bool is_variant(uint8_t value, const uint8_t* variants, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (value == variants[i])
+            return true;
+    }
+    return false;
+}
+
+bool matches_prefix(const uint8_t* data, size_t size,
+                    const uint8_t* pattern, size_t pattern_size,
+                    const uint8_t* variants, size_t variant_count)
+{
+    const size_t len = size < pattern_size ? size : pattern_size;
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (i + 1 == pattern_size ? !is_variant(data[i], variants, variant_count)
+                                  : data[i] != pattern[i])
+            return false;
+    }
+    return true;
+}
+
+bool is_candidate(const uint8_t* data, size_t size)
+{
+    return matches_prefix(data, size, PACKET_STROBE, sizeof(PACKET_STROBE),
+                          PACKET_STROBE_VARIANTS, sizeof(PACKET_STROBE_VARIANTS))
+           || matches_prefix(data, size, SYNC_STROBE, sizeof(SYNC_STROBE),
+                             SYNC_STROBE_VARIANTS, sizeof(SYNC_STROBE_VARIANTS));
+}
+
+size_t scan_scalar(const uint8_t* data, size_t offset, size_t size)
+{
+    for (; offset < size; ++offset)
+    {
+        if ((data[offset] == PACKET_STROBE[0] || data[offset] == SYNC_STROBE[0])
+            && is_candidate(data + offset, size - offset))
+            return offset;
+    }
+    return size;
+}
+
+}
+
+size_t arduino_serial_scan_strobe_scalar(const void* data, size_t size)
+{
+    return scan_scalar(static_cast<const uint8_t*>(data), 0, size);
+}
+
+#ifdef ARDUINO_SERIAL_SCAN_STROBE_X86
+
+// Vector loops test full patterns only while all lookahead bytes are
+// in the buffer, the tail is left to scalar code.
+
+size_t arduino_serial_scan_strobe_sse2(const void* _data, size_t size)
+{
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    const __m128i strobe_1 = _mm_set1_epi8(static_cast<char>(PACKET_STROBE[0]));
+    const __m128i strobe_2 = _mm_set1_epi8(static_cast<char>(PACKET_STROBE[1]));
+    const __m128i strobe_2x = _mm_set1_epi8(static_cast<char>(PACKET_STROBE_VARIANTS[1]));
+    const __m128i strobe_2s = _mm_set1_epi8(static_cast<char>(PACKET_STROBE_VARIANTS[2]));
+    const __m128i sync_1 = _mm_set1_epi8(static_cast<char>(SYNC_STROBE[0]));
+    const __m128i sync_2 = _mm_set1_epi8(static_cast<char>(SYNC_STROBE[1]));
+    const __m128i sync_3 = _mm_set1_epi8(static_cast<char>(SYNC_STROBE[2]));
+    const __m128i sync_4 = _mm_set1_epi8(static_cast<char>(SYNC_STROBE[3]));
+    const __m128i sync_4x = _mm_set1_epi8(static_cast<char>(SYNC_STROBE_VARIANTS[1]));
+
+    size_t offset = 0;
+    for (; offset + 16 + 3 <= size; offset += 16)
+    {
+        const uint8_t* p = data + offset;
+        const __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+        const __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 2));
+        const __m128i v3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 3));
+
+        const __m128i second = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v1, strobe_2), _mm_cmpeq_epi8(v1, strobe_2x)),
+                _mm_cmpeq_epi8(v1, strobe_2s));
+        const __m128i fourth = _mm_or_si128(_mm_cmpeq_epi8(v3, sync_4),
+                                            _mm_cmpeq_epi8(v3, sync_4x));
+        const __m128i packet = _mm_and_si128(_mm_cmpeq_epi8(v0, strobe_1), second);
+        const __m128i sync = _mm_and_si128(
+                _mm_and_si128(_mm_cmpeq_epi8(v0, sync_1),
+                              _mm_cmpeq_epi8(v1, sync_2)),
+                _mm_and_si128(_mm_cmpeq_epi8(v2, sync_3), fourth));
+
+        const unsigned int mask = static_cast<unsigned int>(
+                _mm_movemask_epi8(_mm_or_si128(packet, sync)));
+        if (mask != 0)
+            return offset + __builtin_ctz(mask);
+    }
+    return scan_scalar(data, offset, size);
+}
+
+__attribute__((target("avx2")))
+size_t arduino_serial_scan_strobe_avx2(const void* _data, size_t size)
+{
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    const __m256i strobe_1 = _mm256_set1_epi8(static_cast<char>(PACKET_STROBE[0]));
+    const __m256i strobe_2 = _mm256_set1_epi8(static_cast<char>(PACKET_STROBE[1]));
+    const __m256i strobe_2x = _mm256_set1_epi8(static_cast<char>(PACKET_STROBE_VARIANTS[1]));
+    const __m256i strobe_2s = _mm256_set1_epi8(static_cast<char>(PACKET_STROBE_VARIANTS[2]));
+    const __m256i sync_1 = _mm256_set1_epi8(static_cast<char>(SYNC_STROBE[0]));
+    const __m256i sync_2 = _mm256_set1_epi8(static_cast<char>(SYNC_STROBE[1]));
+    const __m256i sync_3 = _mm256_set1_epi8(static_cast<char>(SYNC_STROBE[2]));
+    const __m256i sync_4 = _mm256_set1_epi8(static_cast<char>(SYNC_STROBE[3]));
+    const __m256i sync_4x = _mm256_set1_epi8(static_cast<char>(SYNC_STROBE_VARIANTS[1]));
+
+    size_t offset = 0;
+    for (; offset + 32 + 3 <= size; offset += 32)
+    {
+        const uint8_t* p = data + offset;
+        const __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        const __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+        const __m256i v2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 2));
+        const __m256i v3 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 3));
+
+        const __m256i second = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v1, strobe_2), _mm256_cmpeq_epi8(v1, strobe_2x)),
+                _mm256_cmpeq_epi8(v1, strobe_2s));
+        const __m256i fourth = _mm256_or_si256(_mm256_cmpeq_epi8(v3, sync_4),
+                                               _mm256_cmpeq_epi8(v3, sync_4x));
+        const __m256i packet = _mm256_and_si256(_mm256_cmpeq_epi8(v0, strobe_1), second);
+        const __m256i sync = _mm256_and_si256(
+                _mm256_and_si256(_mm256_cmpeq_epi8(v0, sync_1),
+                                 _mm256_cmpeq_epi8(v1, sync_2)),
+                _mm256_and_si256(_mm256_cmpeq_epi8(v2, sync_3), fourth));
+
+        const unsigned int mask = static_cast<unsigned int>(
+                _mm256_movemask_epi8(_mm256_or_si256(packet, sync)));
+        if (mask != 0)
+            return offset + __builtin_ctz(mask);
+    }
+    return arduino_serial_scan_strobe_sse2(data + offset, size - offset) + offset;
+}
+
+bool arduino_serial_scan_strobe_has_avx2()
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+size_t arduino_serial_scan_strobe(const void* data, size_t size)
+{
+    using ScanFunction = size_t (*)(const void*, size_t);
+    static const ScanFunction scan = arduino_serial_scan_strobe_has_avx2()
+                                     ? &arduino_serial_scan_strobe_avx2
+                                     : &arduino_serial_scan_strobe_sse2;
+    return scan(data, size);
+}
+
+#else
+
+size_t arduino_serial_scan_strobe(const void* data, size_t size)
+{
+    return arduino_serial_scan_strobe_scalar(data, size);
+}
+
+#endif
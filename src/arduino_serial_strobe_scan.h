@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// Returns number of leading bytes which can not start a packet strobe
+// (0xA5 followed by 0x63, extended 0x9C or short 0xC6) or a sync request
+// (0xD3 0x74 0xE5 followed by 0x52, or 0xAD with parameters), i.e. the
+// offset of the first candidate, or size if there is none. A candidate
+// cut short by the end of buffer is kept, so it is completed by the
+// next read.
+size_t arduino_serial_scan_strobe(const void* data, size_t size);
+
+size_t arduino_serial_scan_strobe_scalar(const void* data, size_t size);
+
+#if !defined(ARDUINO) && (defined(__x86_64__) || defined(__i386__))
+    #define ARDUINO_SERIAL_SCAN_STROBE_X86 1
+
+    size_t arduino_serial_scan_strobe_sse2(const void* data, size_t size);
+    size_t arduino_serial_scan_strobe_avx2(const void* data, size_t size);
+
+    bool arduino_serial_scan_strobe_has_avx2();
+#endif
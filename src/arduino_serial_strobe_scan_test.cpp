@@ -0,0 +1,113 @@
+#include "gtest/gtest.h"
+
+#include "arduino_serial_strobe_scan.h"
+
+#include <stdlib.h>
+#include <vector>
+
+
+namespace
+{
+
+using ScanFunction = size_t (*)(const void*, size_t);
+
+std::vector<ScanFunction> scan_functions()
+{
+    std::vector<ScanFunction> result{&arduino_serial_scan_strobe_scalar,
+                                     &arduino_serial_scan_strobe};
+#ifdef ARDUINO_SERIAL_SCAN_STROBE_X86
+    result.push_back(&arduino_serial_scan_strobe_sse2);
+    if (arduino_serial_scan_strobe_has_avx2())
+        result.push_back(&arduino_serial_scan_strobe_avx2);
+#endif
+    return result;
+}
+
+// random bytes without any 0xA5 or 0xD3
+std::vector<uint8_t> make_noise(size_t size, unsigned int seed)
+{
+    std::vector<uint8_t> data(size);
+    srand(seed);
+    for (auto& value : data)
+    {
+        do
+            value = static_cast<uint8_t>(rand());
+        while (value == 0xA5 || value == 0xD3);
+    }
+    return data;
+}
+
+}
+
+
+TEST(ArduinoSerialStrobeScan, Empty)
+{
+    for (auto scan : scan_functions())
+        EXPECT_EQ(0, scan(nullptr, 0));
+}
+
+TEST(ArduinoSerialStrobeScan, NoCandidate)
+{
+    const auto data = make_noise(1000, 1);
+    for (auto scan : scan_functions())
+        EXPECT_EQ(data.size(), scan(data.data(), data.size()));
+}
+
+TEST(ArduinoSerialStrobeScan, Candidates)
+{
+    const std::vector<std::vector<uint8_t>> patterns = {
+            {0xA5, 0x63},
+            {0xA5, 0x9C},
+            {0xA5, 0xC6},
+            {0xD3, 0x74, 0xE5, 0x52},
+            {0xD3, 0x74, 0xE5, 0xAD}};
+
+    for (const auto& pattern : patterns)
+    {
+        for (size_t position = 0; position < 100; ++position)
+        {
+            auto data = make_noise(100 + pattern.size(), position);
+            std::copy(pattern.begin(), pattern.end(), data.begin() + position);
+            for (auto scan : scan_functions())
+                ASSERT_EQ(position, scan(data.data(), data.size()))
+                        << "position " << position;
+        }
+    }
+}
+
+TEST(ArduinoSerialStrobeScan, PartialCandidates)
+{
+    for (size_t position = 0; position < 70; ++position)
+    {
+        auto data = make_noise(80, position);
+        data[position] = 0xA5;
+        data[position + 1] = 0x64;
+        data[position + 5] = 0xD3;
+        data[position + 6] = 0x74;
+        data[position + 7] = 0xE5;
+        data[position + 8] = 0x53;
+        for (auto scan : scan_functions())
+            ASSERT_EQ(data.size(), scan(data.data(), data.size()))
+                    << "position " << position;
+    }
+}
+
+TEST(ArduinoSerialStrobeScan, TruncatedCandidate)
+{
+    for (size_t size = 1; size < 70; ++size)
+    {
+        auto data = make_noise(size, size);
+        data[size - 1] = 0xA5;
+        for (auto scan : scan_functions())
+            ASSERT_EQ(size - 1, scan(data.data(), data.size()));
+
+        if (size >= 3)
+        {
+            data[size - 3] = 0xD3;
+            data[size - 2] = 0x74;
+            data[size - 1] = 0xE5;
+            for (auto scan : scan_functions())
+                ASSERT_EQ(size - 3, scan(data.data(), data.size()));
+        }
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "arduino_serial_protocol.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared by the unit tests that need a synced ArduinoSerialProtocol
+
+// Sync request without parameters
+const uint8_t SYNC_STROBE[] = {0xD3, 0x74, 0xE5, 0x52};
+
+// Syncs secondary protocol as if the request was read and reply sent
+inline void sync(ArduinoSerialProtocol& protocol)
+{
+    for (size_t i = 0; i < sizeof(SYNC_STROBE); ++i)
+        protocol.readBytes(&SYNC_STROBE[i], 1);
+    protocol.syncReplySent();
+}
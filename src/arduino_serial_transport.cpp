@@ -0,0 +1,537 @@
+#include "arduino_serial_transport.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/serial.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+
+constexpr const size_t ArduinoSerialTransport::MAX_PENDING_WRITE;
+
+
+namespace
+{
+
+// how often a tty still draining before a rate switch is checked
+constexpr const int DRAIN_POLL_MS = 1;
+
+bool baud_to_speed(unsigned int baud_rate, speed_t& speed)
+{
+    struct BaudSpeed
+    {
+        unsigned int baud_rate;
+        speed_t speed;
+    };
+
+    static const BaudSpeed speeds[] = {
+            {9600, B9600},
+            {19200, B19200},
+            {38400, B38400},
+            {57600, B57600},
+            {115200, B115200},
+            {230400, B230400},
+            {460800, B460800},
+            {500000, B500000},
+            {576000, B576000},
+            {921600, B921600},
+            {1000000, B1000000},
+            {1152000, B1152000},
+            {1500000, B1500000},
+            {2000000, B2000000},
+            {2500000, B2500000},
+            {3000000, B3000000},
+            {3500000, B3500000},
+            {4000000, B4000000}};
+
+    for (const BaudSpeed& value : speeds)
+    {
+        if (value.baud_rate == baud_rate)
+        {
+            speed = value.speed;
+            return true;
+        }
+    }
+    return false;
+}
+
+int64_t now_ms()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<int64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+// Whether the tty driver and UART still hold output; drivers (and ptys)
+// without TIOCSERGETLSR count as empty once TIOCOUTQ is
+bool output_draining(int fd, bool& draining)
+{
+    int queued = 0;
+    if (ioctl(fd, TIOCOUTQ, &queued) != 0)
+        return false;
+    unsigned int lsr = TIOCSER_TEMT;
+    if (ioctl(fd, TIOCSERGETLSR, &lsr) != 0)
+        lsr = TIOCSER_TEMT;
+    draining = queued > 0 || (lsr & TIOCSER_TEMT) == 0;
+    return true;
+}
+
+// Rates of mask the tty driver can be set to
+uint8_t settable_rates(uint8_t rates)
+{
+    uint8_t result = 0;
+    for (uint8_t rate = 1; rate != 0; rate = static_cast<uint8_t>(rate << 1))
+    {
+        speed_t speed;
+        if ((rates & rate) != 0 && baud_to_speed(arduino_serial_baud_rate(rate), speed))
+            result |= rate;
+    }
+    return result;
+}
+
+bool is_send_operation(ArduinoSerialOperation operation)
+{
+    return operation == ArduinoSerialOperation::SEND_SYNC
+           || operation == ArduinoSerialOperation::SEND_SYNC_REPLY;
+}
+
+}
+
+ArduinoSerialTransportConfig arduino_serial_default_transport_config()
+{
+    ArduinoSerialTransportConfig config;
+    config.baud_rate = 115200;
+    config.low_latency = true;
+    config.read_buffer_size = 64 * 1024;
+    config.sync_retry_ms = 100;
+    config.baud_rates = 0;
+    return config;
+}
+
+ArduinoSerialTransport::ArduinoSerialTransport(
+        ArduinoSerialProtocol& protocol,
+        ArduinoSerialPacketCallback callback, void* context)
+: protocol(protocol)
+, decoder{protocol}
+, callback{callback}
+, context{context}
+, tty_fd{-1}
+, epoll_fd{-1}
+, stop_fd{-1}
+, low_latency{false}
+, want_write{false}
+, sync_retry_ms{0}
+, sync_deadline_ms{-1}
+, stop_requested{false}
+, initial_speed{0}
+, baud_rate{0}
+, rx_stale{false}
+, drain_pending{false}
+, tx_offset{0}
+{
+}
+
+ArduinoSerialTransport::~ArduinoSerialTransport()
+{
+    close();
+}
+
+ArduinoSerialTransportResult
+ArduinoSerialTransport::open(const char* path,
+                             const ArduinoSerialTransportConfig& config)
+{
+    const int fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return ArduinoSerialTransportResult::ERROR_OPEN;
+    return attach(fd, config);
+}
+
+ArduinoSerialTransportResult
+ArduinoSerialTransport::attach(int fd, const ArduinoSerialTransportConfig& config)
+{
+    close();
+    tty_fd = fd;
+
+    const ArduinoSerialTransportResult result = setup(config);
+    if (result != ArduinoSerialTransportResult::OK)
+        close();
+    return result;
+}
+
+ArduinoSerialTransportResult
+ArduinoSerialTransport::setup(const ArduinoSerialTransportConfig& config)
+{
+    struct termios tty;
+    if (tcgetattr(tty_fd, &tty) != 0)
+        return ArduinoSerialTransportResult::ERROR_CONFIGURE;
+
+    cfmakeraw(&tty);
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 0;
+
+    if (config.baud_rate != 0)
+    {
+        speed_t speed;
+        if (!baud_to_speed(config.baud_rate, speed))
+            return ArduinoSerialTransportResult::ERROR_BAUD_RATE;
+        cfsetispeed(&tty, speed);
+        cfsetospeed(&tty, speed);
+    }
+
+    if (tcsetattr(tty_fd, TCSANOW, &tty) != 0)
+        return ArduinoSerialTransportResult::ERROR_CONFIGURE;
+
+    const int flags = fcntl(tty_fd, F_GETFL);
+    if (flags < 0 || fcntl(tty_fd, F_SETFL, flags | O_NONBLOCK) != 0)
+        return ArduinoSerialTransportResult::ERROR_CONFIGURE;
+
+    if (config.low_latency)
+    {
+        struct serial_struct serial;
+        if (ioctl(tty_fd, TIOCGSERIAL, &serial) == 0)
+        {
+            serial.flags |= ASYNC_LOW_LATENCY;
+            low_latency = ioctl(tty_fd, TIOCSSERIAL, &serial) == 0;
+        }
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd < 0 || stop_fd < 0)
+        return ArduinoSerialTransportResult::ERROR_CONFIGURE;
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = tty_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, tty_fd, &event) != 0)
+        return ArduinoSerialTransportResult::ERROR_CONFIGURE;
+
+    event.data.fd = stop_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &event) != 0)
+        return ArduinoSerialTransportResult::ERROR_CONFIGURE;
+
+    rx_buffer.resize(config.read_buffer_size > 0 ? config.read_buffer_size : 1);
+    sync_retry_ms = config.sync_retry_ms;
+
+    initial_speed = cfgetospeed(&tty);
+    baud_rate = 0;
+    protocol.setBaudRates(settable_rates(config.baud_rates));
+
+    return serviceProtocol();
+}
+
+void ArduinoSerialTransport::close()
+{
+    if (stop_fd >= 0)
+        ::close(stop_fd);
+    if (epoll_fd >= 0)
+        ::close(epoll_fd);
+    if (tty_fd >= 0)
+        ::close(tty_fd);
+
+    tty_fd = -1;
+    epoll_fd = -1;
+    stop_fd = -1;
+    low_latency = false;
+    want_write = false;
+    sync_deadline_ms = -1;
+    rx_stale = false;
+    drain_pending = false;
+    tx_buffer.clear();
+    tx_offset = 0;
+    sync_backlog.clear();
+    decoder.reset();
+}
+
+ArduinoSerialTransportResult
+ArduinoSerialTransport::send(const void* payload, size_t payload_size)
+{
+    if (tty_fd < 0)
+        return ArduinoSerialTransportResult::ERROR_NOT_OPEN;
+
+    // every failure is found before a packet ID is taken, so failed
+    // sends leave no gap in the sequence
+    if (protocol.checkWrite(payload_size) != ArduinoSerialGeneralResult::OK)
+        return ArduinoSerialTransportResult::ERROR_PROTOCOL;
+
+    const size_t packet_size = protocol.packetSize(payload_size);
+    if (MAX_PENDING_WRITE - pendingWrite() < packet_size
+        || MAX_PENDING_WRITE - sync_backlog.size() < packet_size)
+        return ArduinoSerialTransportResult::ERROR_BUFFER_FULL;
+
+    const size_t offset = tx_buffer.size();
+    tx_buffer.resize(offset + packet_size);
+    protocol.writePacket(tx_buffer.data() + offset, protocol.createNextPacketId(),
+                         payload, payload_size);
+
+    if (sync_deadline_ms >= 0)
+        sync_backlog.insert(sync_backlog.end(),
+                            tx_buffer.begin() + offset, tx_buffer.end());
+
+    return flush();
+}
+
+ArduinoSerialTransportResult ArduinoSerialTransport::poll(int timeout_ms)
+{
+    if (tty_fd < 0)
+        return ArduinoSerialTransportResult::ERROR_NOT_OPEN;
+
+    struct epoll_event events[2];
+    const int count = epoll_wait(epoll_fd, events, 2, pollTimeout(timeout_ms));
+    if (count < 0 && errno != EINTR)
+        return ArduinoSerialTransportResult::ERROR_IO;
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (events[i].data.fd == stop_fd)
+        {
+            uint64_t value;
+            if (read(stop_fd, &value, sizeof(value)) > 0)
+                stop_requested = true;
+            continue;
+        }
+
+        ArduinoSerialTransportResult result = ArduinoSerialTransportResult::OK;
+        if (events[i].events & EPOLLIN)
+            result = readAvailable();
+        if (result == ArduinoSerialTransportResult::OK
+            && (events[i].events & EPOLLOUT))
+            result = flush();
+        if (result == ArduinoSerialTransportResult::OK
+            && (events[i].events & (EPOLLHUP | EPOLLERR)))
+            result = ArduinoSerialTransportResult::ERROR_CLOSED;
+        if (result != ArduinoSerialTransportResult::OK)
+            return result;
+    }
+
+    if (sync_deadline_ms >= 0 && now_ms() >= sync_deadline_ms)
+    {
+        protocol.syncTimeout();
+        return serviceProtocol();
+    }
+    // reply may have been left in tx buffer
+    return followBaudRate();
+}
+
+ArduinoSerialTransportResult ArduinoSerialTransport::run()
+{
+    stop_requested = false;
+    while (!stop_requested)
+    {
+        const ArduinoSerialTransportResult result = poll(-1);
+        if (result != ArduinoSerialTransportResult::OK)
+            return result;
+    }
+    return ArduinoSerialTransportResult::OK;
+}
+
+void ArduinoSerialTransport::stop()
+{
+    const uint64_t value = 1;
+    if (stop_fd >= 0)
+        (void) !write(stop_fd, &value, sizeof(value));
+}
+
+ArduinoSerialTransportResult ArduinoSerialTransport::readAvailable()
+{
+    for (;;)
+    {
+        const ssize_t size = read(tty_fd, rx_buffer.data(), rx_buffer.size());
+        if (size < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            if (errno == EIO)
+                return ArduinoSerialTransportResult::ERROR_CLOSED;
+            return ArduinoSerialTransportResult::ERROR_IO;
+        }
+        if (size == 0)
+            break;
+#if ARDUINO_SERIAL_LATENCY
+        protocol.dataArrived(arduino_serial_now_ticks());
+#endif
+
+        size_t offset = 0;
+        rx_stale = false;
+        for (;;)
+        {
+            const ArduinoSerialDecodeResult result =
+                    decoder.decode(rx_buffer.data() + offset,
+                                   static_cast<size_t>(size) - offset,
+                                   callback, context);
+            offset += result.bytes_read;
+
+            // decoder stops early only when something has to be sent
+            if (!is_send_operation(protocol.nextOperation().read_operation))
+                break;
+
+            const ArduinoSerialTransportResult service_result = serviceProtocol();
+            if (service_result != ArduinoSerialTransportResult::OK)
+                return service_result;
+            if (rx_stale)
+                break;
+        }
+
+        if (static_cast<size_t>(size) < rx_buffer.size())
+            break;
+    }
+    return serviceProtocol();
+}
+
+ArduinoSerialTransportResult ArduinoSerialTransport::serviceProtocol()
+{
+    uint8_t header[ArduinoSerialProtocol::MAX_SYNC_HEADER_SIZE];
+
+    // primary: reply agreed a rate, sync again at it
+    const ArduinoSerialTransportResult baud_result = followBaudRate();
+    if (baud_result != ArduinoSerialTransportResult::OK)
+        return baud_result;
+
+    switch (protocol.nextOperation().read_operation)
+    {
+        case ArduinoSerialOperation::SEND_SYNC_REPLY:
+        {
+            protocol.writeSyncReplyHeader(header);
+            protocol.syncReplySent();
+            const ArduinoSerialTransportResult result =
+                    queue(header, protocol.syncReplyHeaderSize());
+            if (result != ArduinoSerialTransportResult::OK)
+                return result;
+            return followBaudRate();
+        }
+        case ArduinoSerialOperation::SEND_SYNC:
+        {
+            protocol.writeSyncHeader(header);
+            protocol.syncSent();
+            sync_deadline_ms = now_ms() + sync_retry_ms;
+            const ArduinoSerialTransportResult result =
+                    queue(header, protocol.syncHeaderSize());
+            if (result != ArduinoSerialTransportResult::OK || sync_backlog.empty())
+                return result;
+            return queue(sync_backlog.data(), sync_backlog.size());
+        }
+        default:
+            break;
+    }
+
+    if (sync_deadline_ms >= 0 && protocol.isSynced())
+    {
+        sync_deadline_ms = -1;
+        sync_backlog.clear();
+    }
+    return ArduinoSerialTransportResult::OK;
+}
+
+ArduinoSerialTransportResult ArduinoSerialTransport::followBaudRate()
+{
+    const uint32_t rate = protocol.baudRate();
+    drain_pending = false;
+    if (rate == baud_rate || pendingWrite() > 0)
+        return ArduinoSerialTransportResult::OK;
+
+    speed_t speed = initial_speed;
+    if (rate != 0 && !baud_to_speed(rate, speed))
+        return ArduinoSerialTransportResult::ERROR_BAUD_RATE;
+
+    // checked again from poll() after DRAIN_POLL_MS
+    bool draining = false;
+    if (!output_draining(tty_fd, draining))
+        return ArduinoSerialTransportResult::ERROR_CONFIGURE;
+    if (draining)
+    {
+        drain_pending = true;
+        return ArduinoSerialTransportResult::OK;
+    }
+
+    struct termios tty;
+    if (tcgetattr(tty_fd, &tty) != 0)
+        return ArduinoSerialTransportResult::ERROR_CONFIGURE;
+    cfsetispeed(&tty, speed);
+    cfsetospeed(&tty, speed);
+    if (tcsetattr(tty_fd, TCSANOW, &tty) != 0)
+        return ArduinoSerialTransportResult::ERROR_CONFIGURE;
+
+    tcflush(tty_fd, TCIFLUSH);
+    decoder.reset();
+    baud_rate = rate;
+    rx_stale = true;
+    return ArduinoSerialTransportResult::OK;
+}
+
+ArduinoSerialTransportResult
+ArduinoSerialTransport::queue(const void* _data, size_t size)
+{
+    if (MAX_PENDING_WRITE - pendingWrite() < size)
+        return ArduinoSerialTransportResult::ERROR_BUFFER_FULL;
+
+    const uint8_t* data = static_cast<const uint8_t*>(_data);
+    tx_buffer.insert(tx_buffer.end(), data, data + size);
+    return flush();
+}
+
+ArduinoSerialTransportResult ArduinoSerialTransport::flush()
+{
+    while (tx_offset < tx_buffer.size())
+    {
+        const ssize_t written = write(tty_fd, tx_buffer.data() + tx_offset,
+                                      tx_buffer.size() - tx_offset);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EIO)
+                return ArduinoSerialTransportResult::ERROR_CLOSED;
+            return ArduinoSerialTransportResult::ERROR_IO;
+        }
+        tx_offset += static_cast<size_t>(written);
+    }
+
+    if (tx_offset == tx_buffer.size())
+    {
+        tx_buffer.clear();
+        tx_offset = 0;
+    }
+
+    updateEvents();
+    return ArduinoSerialTransportResult::OK;
+}
+
+void ArduinoSerialTransport::updateEvents()
+{
+    const bool need_write = tx_offset < tx_buffer.size();
+    if (need_write == want_write || epoll_fd < 0)
+        return;
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | (need_write ? EPOLLOUT : 0);
+    event.data.fd = tty_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, tty_fd, &event) == 0)
+        want_write = need_write;
+}
+
+int ArduinoSerialTransport::pollTimeout(int timeout_ms) const
+{
+    if (drain_pending && (timeout_ms < 0 || timeout_ms > DRAIN_POLL_MS))
+        timeout_ms = DRAIN_POLL_MS;
+    if (sync_deadline_ms < 0)
+        return timeout_ms;
+
+    int64_t remaining = sync_deadline_ms - now_ms();
+    if (remaining < 0)
+        remaining = 0;
+    if (timeout_ms >= 0 && timeout_ms < remaining)
+        return timeout_ms;
+    return static_cast<int>(remaining);
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "arduino_serial_protocol.h"
+#include "arduino_serial_stream_decoder.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+
+enum class ArduinoSerialTransportResult
+{
+    OK,
+    ERROR_OPEN,
+    ERROR_CONFIGURE,
+    ERROR_BAUD_RATE,
+    ERROR_NOT_OPEN,
+    ERROR_IO,
+    ERROR_CLOSED,
+    ERROR_PROTOCOL,
+    ERROR_BUFFER_FULL
+};
+
+struct ArduinoSerialTransportConfig
+{
+    // 0 keeps the current speed of the tty
+    unsigned int baud_rate;
+    // ASYNC_LOW_LATENCY, silently skipped where the driver does not
+    // support it (e.g. pty)
+    bool low_latency;
+    size_t read_buffer_size;
+    // primary only: resend sync request when no reply arrives in time
+    int sync_retry_ms;
+    // rates (ARDUINO_SERIAL_BAUD_*) offered in the sync handshake, tty
+    // follows the one agreed; 0 stays at baud_rate
+    uint8_t baud_rates;
+};
+
+ArduinoSerialTransportConfig arduino_serial_default_transport_config();
+
+
+// Host-only Linux tty transport: raw non-blocking termios, epoll loop,
+// large reads fed through ArduinoSerialStreamDecoder. Answers sync
+// requests (secondary) or drives sync handshake with retries (primary).
+//
+// Packets sent by a primary while its sync is in flight are kept and
+// sent again behind every retried sync request until the reply arrives.
+// A peer that got them but whose reply was lost receives them again with
+// the same packet IDs; send only once synced where duplicates matter.
+//
+// Rate agreed in the handshake is set once everything queued before it
+// is out; bytes received around the switch are dropped. Waiting for the
+// tty to drain is timer driven, poll() never blocks on it.
+class ArduinoSerialTransport
+{
+public:
+    // bytes queued but not written yet, send() fails beyond it
+    static constexpr const size_t MAX_PENDING_WRITE = 64 * 1024;
+
+    ArduinoSerialTransport(ArduinoSerialProtocol& protocol,
+                           ArduinoSerialPacketCallback callback,
+                           void* context);
+
+    ArduinoSerialTransport(const ArduinoSerialTransport&) = delete;
+    ArduinoSerialTransport& operator=(const ArduinoSerialTransport&) = delete;
+
+    ~ArduinoSerialTransport();
+
+    ArduinoSerialTransportResult open(const char* path,
+                                      const ArduinoSerialTransportConfig& config);
+
+    // Takes ownership of an already open tty (e.g. openpty() slave)
+    ArduinoSerialTransportResult attach(int fd,
+                                        const ArduinoSerialTransportConfig& config);
+
+    void close();
+
+    int fd() const
+    { return tty_fd; }
+
+    bool lowLatency() const
+    { return low_latency; }
+
+    // epoll fd that becomes readable whenever poll() has work,
+    // lets the transport be nested into an outer event loop
+    int pollFd() const
+    { return epoll_fd; }
+
+    ArduinoSerialTransportResult send(const void* payload, size_t payload_size);
+
+    size_t pendingWrite() const
+    { return tx_buffer.size() - tx_offset; }
+
+    // poll() has work on a timer (sync retry, rate switch waiting for
+    // output to drain), outer loops nesting pollFd() have to call it
+    bool timerPending() const
+    { return sync_deadline_ms >= 0 || drain_pending; }
+
+    // ms until poll() has timer work, -1 when none is pending
+    int timerTimeout() const
+    { return pollTimeout(-1); }
+
+    // One epoll_wait round, waits at most timeout_ms (-1 forever)
+    ArduinoSerialTransportResult poll(int timeout_ms);
+
+    // Loops poll() until stop() is called (from any thread) or an error
+    ArduinoSerialTransportResult run();
+
+    void stop();
+
+private:
+    ArduinoSerialTransportResult setup(const ArduinoSerialTransportConfig& config);
+    ArduinoSerialTransportResult readAvailable();
+    ArduinoSerialTransportResult serviceProtocol();
+    ArduinoSerialTransportResult followBaudRate();
+    ArduinoSerialTransportResult flush();
+    ArduinoSerialTransportResult queue(const void* data, size_t size);
+    void updateEvents();
+    int pollTimeout(int timeout_ms) const;
+
+    ArduinoSerialProtocol& protocol;
+    ArduinoSerialStreamDecoder decoder;
+    ArduinoSerialPacketCallback callback;
+    void* context;
+
+    int tty_fd;
+    int epoll_fd;
+    int stop_fd;
+    bool low_latency;
+    bool want_write;
+    int sync_retry_ms;
+    int64_t sync_deadline_ms;
+    bool stop_requested;
+    // tty speed code of config.baud_rate, restored on rollback
+    unsigned int initial_speed;
+    uint32_t baud_rate;
+    // rest of the read was received at the previous rate
+    bool rx_stale;
+    // new rate agreed, tty still sending at the old one
+    bool drain_pending;
+
+    std::vector<uint8_t> rx_buffer;
+    std::vector<uint8_t> tx_buffer;
+    size_t tx_offset;
+    std::vector<uint8_t> sync_backlog;
+
+}; // class ArduinoSerialTransport
@@ -0,0 +1,346 @@
+#include "gtest/gtest.h"
+
+#include "arduino_serial_protocol.h"
+#include "arduino_serial_protocol_string.h"
+#include "arduino_serial_transport.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+
+namespace
+{
+
+const uint8_t SYNC_REQUEST[] = {0xD3, 0x74, 0xE5, 0x52};
+const uint8_t SYNC_REPLY[] = {0xD3, 0x74, 0xE5, 0x25};
+
+struct ReceivedPacket
+{
+    ArduinoSerialProtocolID id;
+    std::vector<uint8_t> payload;
+};
+
+void collect_packet(void* context, ArduinoSerialProtocolID id,
+                    const void* payload, size_t payload_size)
+{
+    const uint8_t* data = static_cast<const uint8_t*>(payload);
+    ReceivedPacket packet;
+    packet.id = id;
+    packet.payload.assign(data, data + payload_size);
+    static_cast<std::vector<ReceivedPacket>*>(context)->push_back(packet);
+}
+
+// reads until size bytes arrived or nothing came for timeout_ms
+std::vector<uint8_t> read_fd(int fd, size_t size, int timeout_ms = 1000)
+{
+    std::vector<uint8_t> result;
+    while (result.size() < size)
+    {
+        struct pollfd poll_fd = {fd, POLLIN, 0};
+        if (::poll(&poll_fd, 1, timeout_ms) <= 0)
+            break;
+        uint8_t buffer[256];
+        const ssize_t count = read(fd, buffer, sizeof(buffer));
+        if (count <= 0)
+            break;
+        result.insert(result.end(), buffer, buffer + count);
+    }
+    return result;
+}
+
+void write_fd(int fd, const void* data, size_t size)
+{
+    ASSERT_EQ(static_cast<ssize_t>(size), write(fd, data, size));
+}
+
+}
+
+
+class FArduinoSerialTransport : public ::testing::Test
+{
+public:
+    void SetUp() override
+    {
+        ASSERT_EQ(0, openpty(&master_fd, &slave_fd, nullptr, nullptr, nullptr));
+
+        // master side stands in for the Arduino and must not echo
+        struct termios tty;
+        ASSERT_EQ(0, tcgetattr(master_fd, &tty));
+        cfmakeraw(&tty);
+        ASSERT_EQ(0, tcsetattr(master_fd, TCSANOW, &tty));
+
+        config = arduino_serial_default_transport_config();
+        config.read_buffer_size = 256;
+        config.sync_retry_ms = 50;
+    }
+
+    void TearDown() override
+    {
+        if (master_fd >= 0)
+            close(master_fd);
+    }
+
+    testing::AssertionResult pollUntil(ArduinoSerialTransport& transport,
+                                       size_t packet_count)
+    {
+        for (int i = 0; i < 100 && packets.size() < packet_count; ++i)
+        {
+            const auto result = transport.poll(10);
+            if (result != ArduinoSerialTransportResult::OK)
+                return testing::AssertionFailure() << "poll failed";
+        }
+        if (packets.size() != packet_count)
+            return testing::AssertionFailure()
+                    << "received " << packets.size() << " packets";
+        return testing::AssertionSuccess();
+    }
+
+protected:
+    int master_fd = -1;
+    int slave_fd = -1;
+    ArduinoSerialTransportConfig config;
+    std::vector<ReceivedPacket> packets;
+
+};
+
+
+TEST_F(FArduinoSerialTransport, SecondaryAnswersSyncAndReceives)
+{
+    auto protocol = ArduinoSerialProtocol::createSecondary();
+    ArduinoSerialTransport transport{protocol, &collect_packet, &packets};
+    ASSERT_EQ(ArduinoSerialTransportResult::OK, transport.attach(slave_fd, config));
+    EXPECT_FALSE(transport.lowLatency());
+
+    // sync request and two packets in one burst, bigger than read buffer
+    auto sender = ArduinoSerialProtocol::createPrimary();
+    sender.syncSent();
+    std::vector<uint8_t> data(SYNC_REQUEST, SYNC_REQUEST + sizeof(SYNC_REQUEST));
+    std::vector<uint8_t> payload1(200, 0x11);
+    std::vector<uint8_t> payload2(100, 0x22);
+    for (const auto* payload : {&payload1, &payload2})
+    {
+        const size_t offset = data.size();
+        data.resize(offset + sender.packetSize(payload->size()));
+        sender.writePacket(data.data() + offset, sender.createNextPacketId(),
+                           payload->data(), payload->size());
+    }
+    write_fd(master_fd, data.data(), data.size());
+
+    ASSERT_TRUE(pollUntil(transport, 2));
+    EXPECT_EQ(1, packets[0].id);
+    EXPECT_EQ(payload1, packets[0].payload);
+    EXPECT_EQ(2, packets[1].id);
+    EXPECT_EQ(payload2, packets[1].payload);
+    EXPECT_TRUE(protocol.isSynced());
+#if ARDUINO_SERIAL_LATENCY
+    EXPECT_EQ(2, protocol.latency().count());
+#endif
+
+    EXPECT_EQ(std::vector<uint8_t>(SYNC_REPLY, SYNC_REPLY + sizeof(SYNC_REPLY)),
+              read_fd(master_fd, sizeof(SYNC_REPLY)));
+}
+
+TEST_F(FArduinoSerialTransport, PrimarySendsPipelined)
+{
+    auto protocol = ArduinoSerialProtocol::createPrimary();
+    ArduinoSerialTransport transport{protocol, &collect_packet, &packets};
+    ASSERT_EQ(ArduinoSerialTransportResult::OK, transport.attach(slave_fd, config));
+
+    const uint8_t payload[] = {0x0A, 0x2B, 0x30, 0x45};
+    ASSERT_EQ(ArduinoSerialTransportResult::OK, transport.send(payload, sizeof(payload)));
+
+    const auto sent = read_fd(master_fd, sizeof(SYNC_REQUEST)
+                                         + protocol.packetSize(sizeof(payload)));
+    ASSERT_EQ(sizeof(SYNC_REQUEST) + protocol.packetSize(sizeof(payload)), sent.size());
+    EXPECT_TRUE(std::equal(SYNC_REQUEST, SYNC_REQUEST + sizeof(SYNC_REQUEST),
+                           sent.begin()));
+
+    auto secondary = ArduinoSerialProtocol::createSecondary();
+    size_t offset = 0;
+    for (; offset < sizeof(SYNC_REQUEST); ++offset)
+        secondary.readBytes(sent.data() + offset, 1);
+    secondary.syncReplySent();
+    offset += secondary.readBytes(sent.data() + offset, sent.size() - offset).bytes_read;
+    auto payload_result = secondary.readBytes(sent.data() + offset, sent.size() - offset);
+    ASSERT_EQ(ArduinoSerialReadResult::OK, payload_result.read_result);
+    EXPECT_EQ(1, payload_result.packet_id);
+
+    EXPECT_FALSE(protocol.isSynced());
+    write_fd(master_fd, SYNC_REPLY, sizeof(SYNC_REPLY));
+
+    std::vector<uint8_t> reply(secondary.packetSize(1));
+    const uint8_t reply_payload = 0x42;
+    secondary.writePacket(reply.data(), 7, &reply_payload, 1);
+    write_fd(master_fd, reply.data(), reply.size());
+
+    ASSERT_TRUE(pollUntil(transport, 1));
+    EXPECT_TRUE(protocol.isSynced());
+    EXPECT_EQ(7, packets[0].id);
+    EXPECT_EQ(std::vector<uint8_t>({0x42}), packets[0].payload);
+}
+
+TEST_F(FArduinoSerialTransport, PrimaryRetriesSync)
+{
+    auto protocol = ArduinoSerialProtocol::createPrimary();
+    ArduinoSerialTransport transport{protocol, &collect_packet, &packets};
+    ASSERT_EQ(ArduinoSerialTransportResult::OK, transport.attach(slave_fd, config));
+    EXPECT_TRUE(transport.timerPending());
+    EXPECT_LE(0, transport.timerTimeout());
+    EXPECT_GE(config.sync_retry_ms, transport.timerTimeout());
+
+    const uint8_t payload[] = {0x0A};
+    ASSERT_EQ(ArduinoSerialTransportResult::OK, transport.send(payload, sizeof(payload)));
+
+    const size_t burst = sizeof(SYNC_REQUEST) + protocol.packetSize(sizeof(payload));
+    ASSERT_EQ(burst, read_fd(master_fd, burst).size());
+
+    // no reply, the whole burst is sent again after retry interval
+    for (int i = 0; i < 10; ++i)
+        ASSERT_EQ(ArduinoSerialTransportResult::OK, transport.poll(10));
+    const auto resent = read_fd(master_fd, burst, 100);
+    ASSERT_LE(burst, resent.size());
+    EXPECT_TRUE(std::equal(SYNC_REQUEST, SYNC_REQUEST + sizeof(SYNC_REQUEST),
+                           resent.begin()));
+
+    write_fd(master_fd, SYNC_REPLY, sizeof(SYNC_REPLY));
+    ASSERT_EQ(ArduinoSerialTransportResult::OK, transport.poll(100));
+    EXPECT_TRUE(protocol.isSynced());
+    EXPECT_FALSE(transport.timerPending());
+    EXPECT_EQ(-1, transport.timerTimeout());
+
+    // after sync nothing is repeated
+    read_fd(master_fd, 4096, 20);
+    for (int i = 0; i < 10; ++i)
+        ASSERT_EQ(ArduinoSerialTransportResult::OK, transport.poll(10));
+    EXPECT_TRUE(read_fd(master_fd, 1, 50).empty());
+}
+
+TEST_F(FArduinoSerialTransport, SecondarySwitchesBaudRate)
+{
+    auto protocol = ArduinoSerialProtocol::createSecondary();
+    ArduinoSerialTransport transport{protocol, &collect_packet, &packets};
+    config.baud_rates = ARDUINO_SERIAL_BAUD_921600 | ARDUINO_SERIAL_BAUD_250000;
+    ASSERT_EQ(ArduinoSerialTransportResult::OK, transport.attach(slave_fd, config));
+
+    // 250000 has no termios speed, only 921600 is offered
+    auto sender = ArduinoSerialProtocol::createPrimary();
+    sender.setBaudRates(ARDUINO_SERIAL_BAUD_921600 | ARDUINO_SERIAL_BAUD_250000);
+    for (int round = 0; round < 2; ++round)
+    {
+        std::vector<uint8_t> request(sender.syncHeaderSize());
+        sender.writeSyncHeader(request.data());
+        sender.syncSent();
+        write_fd(master_fd, request.data(), request.size());
+        for (int i = 0; i < 5; ++i)
+            ASSERT_EQ(ArduinoSerialTransportResult::OK, transport.poll(10));
+
+        const auto reply = read_fd(master_fd, ArduinoSerialProtocol::MAX_SYNC_HEADER_SIZE);
+        ASSERT_EQ(ArduinoSerialProtocol::MAX_SYNC_HEADER_SIZE, reply.size());
+        EXPECT_EQ(ARDUINO_SERIAL_BAUD_921600, reply[5]);
+        for (size_t offset = 0; offset < reply.size();)
+        {
+            const auto result = sender.readBytes(reply.data() + offset,
+                                                 reply.size() - offset);
+            ASSERT_EQ(ArduinoSerialReadResult::OK, result.read_result);
+            offset += result.bytes_read;
+        }
+        EXPECT_EQ(921600u, sender.baudRate());
+    }
+    EXPECT_TRUE(sender.isSynced());
+
+    struct termios tty;
+    ASSERT_EQ(0, tcgetattr(transport.fd(), &tty));
+    EXPECT_EQ(static_cast<speed_t>(B921600), cfgetospeed(&tty));
+
+    const uint8_t payload[] = {0x5A, 0x01};
+    std::vector<uint8_t> packet(sender.packetSize(sizeof(payload)));
+    sender.writePacket(packet.data(), sender.createNextPacketId(),
+                       payload, sizeof(payload));
+    write_fd(master_fd, packet.data(), packet.size());
+    ASSERT_TRUE(pollUntil(transport, 1));
+    EXPECT_EQ(std::vector<uint8_t>(payload, payload + sizeof(payload)),
+              packets[0].payload);
+}
+
+TEST_F(FArduinoSerialTransport, SendFailsWhenTtyStopsDraining)
+{
+    auto protocol = ArduinoSerialProtocol::createSecondary();
+    ArduinoSerialTransport transport{protocol, &collect_packet, &packets};
+    ASSERT_EQ(ArduinoSerialTransportResult::OK, transport.attach(slave_fd, config));
+    write_fd(master_fd, SYNC_REQUEST, sizeof(SYNC_REQUEST));
+    ASSERT_EQ(ArduinoSerialTransportResult::OK, transport.poll(100));
+    ASSERT_TRUE(protocol.isSynced());
+
+    // nobody reads master, pty fills up and then the transmit buffer
+    const std::vector<uint8_t> payload(255, 0x5A);
+    ArduinoSerialTransportResult result = ArduinoSerialTransportResult::OK;
+    for (int i = 0; i < 10000 && result == ArduinoSerialTransportResult::OK; ++i)
+        result = transport.send(payload.data(), payload.size());
+    EXPECT_EQ(ArduinoSerialTransportResult::ERROR_BUFFER_FULL, result);
+    EXPECT_LE(transport.pendingWrite(), ArduinoSerialTransport::MAX_PENDING_WRITE);
+    EXPECT_LT(ArduinoSerialTransport::MAX_PENDING_WRITE - protocol.packetSize(payload.size()),
+              transport.pendingWrite());
+
+    // drains again once the other side reads
+    read_fd(master_fd, SIZE_MAX, 50);
+    ASSERT_EQ(ArduinoSerialTransportResult::OK, transport.poll(10));
+    EXPECT_EQ(ArduinoSerialTransportResult::OK, transport.send(payload.data(), payload.size()));
+}
+
+TEST_F(FArduinoSerialTransport, FailedSendKeepsPacketIds)
+{
+    auto protocol = ArduinoSerialProtocol::createSecondary();
+    ArduinoSerialTransport transport{protocol, &collect_packet, &packets};
+    ASSERT_EQ(ArduinoSerialTransportResult::OK, transport.attach(slave_fd, config));
+
+    const uint8_t payload[] = {0x0A, 0x2B};
+    EXPECT_EQ(ArduinoSerialTransportResult::ERROR_PROTOCOL,
+              transport.send(payload, sizeof(payload)));
+
+    write_fd(master_fd, SYNC_REQUEST, sizeof(SYNC_REQUEST));
+    ASSERT_EQ(ArduinoSerialTransportResult::OK, transport.poll(100));
+    ASSERT_TRUE(protocol.isSynced());
+    ASSERT_EQ(sizeof(SYNC_REPLY), read_fd(master_fd, sizeof(SYNC_REPLY)).size());
+
+    const std::vector<uint8_t> too_big(protocol.maxPayloadSize() + 1, 0x5A);
+    EXPECT_EQ(ArduinoSerialTransportResult::ERROR_PROTOCOL,
+              transport.send(too_big.data(), too_big.size()));
+    ASSERT_EQ(ArduinoSerialTransportResult::OK, transport.send(payload, sizeof(payload)));
+
+    auto receiver = ArduinoSerialProtocol::createSecondary();
+    for (size_t i = 0; i < sizeof(SYNC_REQUEST); ++i)
+        receiver.readBytes(&SYNC_REQUEST[i], 1);
+    receiver.syncReplySent();
+    const auto sent = read_fd(master_fd, protocol.packetSize(sizeof(payload)));
+    ArduinoSerialStreamDecoder decoder{receiver};
+    decoder.decode(sent.data(), sent.size(), &collect_packet, &packets);
+    ASSERT_EQ(1u, packets.size());
+    EXPECT_EQ(1, packets[0].id);
+}
+
+TEST_F(FArduinoSerialTransport, StopFromOtherThread)
+{
+    auto protocol = ArduinoSerialProtocol::createSecondary();
+    ArduinoSerialTransport transport{protocol, &collect_packet, &packets};
+    ASSERT_EQ(ArduinoSerialTransportResult::OK, transport.attach(slave_fd, config));
+
+    ArduinoSerialTransportResult result = ArduinoSerialTransportResult::ERROR_IO;
+    std::thread loop{[&transport, &result]() { result = transport.run(); }};
+    transport.stop();
+    loop.join();
+    EXPECT_EQ(ArduinoSerialTransportResult::OK, result);
+}
+
+TEST_F(FArduinoSerialTransport, NotOpen)
+{
+    auto protocol = ArduinoSerialProtocol::createSecondary();
+    ArduinoSerialTransport transport{protocol, &collect_packet, &packets};
+    EXPECT_EQ(ArduinoSerialTransportResult::ERROR_NOT_OPEN, transport.poll(0));
+    EXPECT_EQ(ArduinoSerialTransportResult::ERROR_OPEN,
+              transport.open("/nonexistent/tty", config));
+    close(slave_fd);
+}